@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+// Cache line size, used for Matrix rows and per-thread buffers
+const size_t cache_line_size = 64;
+
+/*
+ * std::allocator replacement returning storage aligned on `Alignment` bytes
+ */
+template <typename T, size_t Alignment = cache_line_size>
+class AlignedAllocator
+{
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &)
+    {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(
+            ::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T *ptr, size_t)
+    {
+        ::operator delete(ptr, std::align_val_t(Alignment));
+    }
+};
+
+template <typename T, typename U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment> &,
+                const AlignedAllocator<U, Alignment> &)
+{
+    return true;
+}
+
+template <typename T, typename U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment> &,
+                const AlignedAllocator<U, Alignment> &)
+{
+    return false;
+}
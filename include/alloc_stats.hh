@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+ * Heap allocations made through operator new since the start of the
+ * process, all threads together. Processing a frame in the steady state
+ * should not add any: frame scratch comes from FrameArena and every other
+ * buffer is kept from frame to frame.
+ */
+struct AllocationStats
+{
+    size_t count = 0;
+    size_t bytes = 0;
+};
+
+AllocationStats get_allocation_stats();
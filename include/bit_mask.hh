@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+#include "matrix.hh"
+
+/*
+ * One bit per pixel mask, every row is padded to whole 64 bit words so a
+ * single word test covers 64 pixels
+ */
+class BitMask
+{
+public:
+    BitMask(size_t rows, size_t cols);
+
+    size_t get_rows() const;
+    size_t get_cols() const;
+    size_t get_words_per_row() const;
+
+    uint64_t *row(size_t y);
+    const uint64_t *row(size_t y) const;
+
+    bool get(size_t x, size_t y) const;
+    void set(size_t x, size_t y, bool val);
+
+    void clear();
+
+    // Set a bit for every non zero value of `mask`
+    void pack(MatrixView<uint8_t> mask);
+
+private:
+    size_t mRows;
+    size_t mCols;
+    size_t mWords;
+    std::vector<uint64_t, AlignedAllocator<uint64_t>> mData;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+
+#include "frame_settings.hh"
+
+// Quality levels, 0 is the quality of the settings, see BudgetController
+#define BUDGET_LEVELS 7
+// Weight of the last frame in the average processing time
+#define BUDGET_SMOOTHING 0.2
+// Frames between two quality changes, for the average to follow
+#define BUDGET_SETTLE_FRAMES 8
+// Average below budget * BUDGET_HEADROOM for this many frames before the
+// quality is raised, doubled every time a raise has to be undone
+#define BUDGET_RAISE_FRAMES 30
+#define BUDGET_HEADROOM 0.7
+// Upper bound of the doubling above
+#define BUDGET_MAX_RAISE_FRAMES 960
+
+/*
+ * Keeps the processing time of a frame under a budget by lowering the
+ * quality of the settings, one step at a time:
+ * 1. streaming Gaussian instead of the median, bilateral or box blur
+ * 2. global contrast correction instead of CLAHE
+ * 3. palette looked up once per 2x2 block
+ * 4. Canny at half resolution, without refinement
+ * 5. palette looked up once per 4x4 block
+ * 6. Canny at quarter resolution
+ * Levels that would not change the settings are skipped.
+ *
+ * The quality is lowered when the average processing time goes over the
+ * budget and raised once it stays well under it. A raise undone right away
+ * makes the next one wait twice as long, the controller does not oscillate
+ * between a level that is too slow and one that is fast enough.
+ */
+class BudgetController
+{
+public:
+    // `budget_ms` of processing per frame, 0 disables the controller
+    explicit BudgetController(double budget_ms = 0);
+
+    double get_budget();
+    // Back to full quality
+    void set_budget(double budget_ms);
+
+    size_t get_level();
+    // Average processing time
+    double get_frame_ms();
+
+    // Processing time of the last frame, `settings` are the ones asked for
+    void update(double frame_ms, const FrameSettings &settings);
+
+    // `settings` at the current quality level
+    FrameSettings apply(const FrameSettings &settings);
+
+private:
+    static FrameSettings lower(const FrameSettings &settings, size_t level);
+    // Whether both levels give the same settings
+    static bool same_quality(const FrameSettings &settings, size_t a,
+                             size_t b);
+
+    void set_level(size_t level);
+
+    double mBudgetMs;
+    size_t mLevel;
+    double mFrameMs;
+    size_t mFramesAtLevel;
+    size_t mRaiseFrames;
+    bool mRaised;
+};
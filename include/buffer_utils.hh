@@ -1,10 +1,14 @@
 #pragma once
 #include <set>
-#include <tbb/concurrent_vector.h>
 
+#include "bit_mask.hh"
 #include "color.hh"
+#include "histogram.hh"
+#include "integral_image.hh"
 #include "matrix.hh"
 #include "octree.hh"
+#include "palette.hh"
+#include "tiles.hh"
 
 const size_t screen_width = 1280;
 const size_t screen_height = 720;
@@ -24,35 +28,69 @@ RGB get_pixel(unsigned char *raw_buffer, size_t offset);
  */
 void set_pixel(unsigned char *raw_buffer, size_t offset, RGB &col);
 
+/*
+ * Copy `tiles` from one raw buffer to another
+ */
+void copy_tiles(const unsigned char *src, unsigned char *dst,
+                const std::vector<Tile> &tiles);
+
 /*
  * Make a Matrix out of buffer
  */
 void to_rgb_matrix(unsigned char *raw_buffer, Matrix<RGB> &output);
 
 /*
- * Get grayscale matrix from RGB input buffer
+ * Get grayscale matrix from RGB input buffer, output can be the interior of a
+ * padded matrix
+ */
+template <typename T>
+void to_grayscale(unsigned char *raw_buffer, MatrixView<T> output);
+
+/*
+ * Same, restricted to `tiles`, output has the size of the frame
  */
 template <typename T>
-void to_grayscale(unsigned char *raw_buffer, Matrix<T> &output);
+void to_grayscale(unsigned char *raw_buffer, MatrixView<T> output,
+                  const std::vector<Tile> &tiles);
 
 /*
  * Converts to HSV, then boosts saturation, to converts back to RGB
  */
 void saturation_modification(unsigned char *raw_buffer,
                              const double saturation_factor);
+void saturation_modification(unsigned char *raw_buffer,
+                             const double saturation_factor,
+                             const std::vector<Tile> &tiles);
 
 /*
- * Compute cumulative histogram of V channel in HSV color space, assumes RGB
- * buffer
+ * Compute cumulative histogram of V channel in HSV color space into
+ * `cum_histo`, assumes RGB buffer. `histogram` holds the counts.
  */
-std::vector<size_t>
-compute_lightness_cumul_histogram(unsigned char *raw_buffer);
+void compute_lightness_cumul_histogram(unsigned char *raw_buffer,
+                                       Histogram &histogram,
+                                       std::vector<size_t> &cum_histo);
 
 /*
  * Does a constrast correction on HSV, assumes RGB buffer
  */
 void contrast_correction(unsigned char *raw_buffer,
                          std::vector<size_t> &cum_histo);
+void contrast_correction(unsigned char *raw_buffer,
+                         std::vector<size_t> &cum_histo,
+                         const std::vector<Tile> &tiles);
+
+/*
+ * to_grayscale of the frame contrast_correction would give, in a single pass
+ * that leaves the frame untouched: equalizing V scales r, g and b, hence the
+ * luma, by new V / V, which is a 256 entries table
+ */
+void to_equalized_grayscale(unsigned char *raw_buffer,
+                            std::vector<size_t> &cum_histo,
+                            MatrixView<float> output);
+void to_equalized_grayscale(unsigned char *raw_buffer,
+                            std::vector<size_t> &cum_histo,
+                            MatrixView<float> output,
+                            const std::vector<Tile> &tiles);
 
 /*
  * Remap matrix values to RGB range (0-255)
@@ -64,7 +102,10 @@ void remap_to_rgb(Matrix<T> &mat);
  * Fill buffer using matrix values (assumed to be in RGB range)
  */
 template <typename T>
-void fill_buffer(unsigned char *raw_buffer, Matrix<T> &mat);
+void fill_buffer(unsigned char *raw_buffer, MatrixView<T> mat);
+template <typename T>
+void fill_buffer(unsigned char *raw_buffer, MatrixView<T> mat,
+                 const std::vector<Tile> &tiles);
 
 /*
  * Fill buffer using matrix RGB values
@@ -72,26 +113,105 @@ void fill_buffer(unsigned char *raw_buffer, Matrix<T> &mat);
 void fill_buffer(unsigned char *raw_buffer, Matrix<RGB> &mat);
 
 /*
- * Apply new color palette
+ * Apply new color palette, with a `step` above 1 every step x step block
+ * takes the palette color of its top left pixel
  */
-void apply_palette(unsigned char *raw_buffer, Quantizer &q,
-                   std::vector<RGB> &palette);
+void apply_palette(unsigned char *raw_buffer, const Palette &palette,
+                   size_t step = 1);
+void apply_palette(unsigned char *raw_buffer, const Palette &palette,
+                   const std::vector<Tile> &tiles);
 
 /*
  * Apply new color palette only in [0; x_limit] range
  */
-void apply_palette_debug(unsigned char *raw_buffer, Quantizer &q,
-                         std::vector<RGB> &palette, size_t x_limit);
+void apply_palette_debug(unsigned char *raw_buffer, const Palette &palette,
+                         size_t x_limit);
 
 /*
  * Set detected borders in black
  */
 template <typename T>
-void set_dark_borders(unsigned char *raw_buffer, Matrix<T> &border_mask);
+void set_dark_borders(unsigned char *raw_buffer, MatrixView<T> border_mask);
+template <typename T>
+void set_dark_borders(unsigned char *raw_buffer, MatrixView<T> border_mask,
+                      const std::vector<Tile> &tiles);
 
 /*
- * Simple pixelation filter
+ * Set detected borders in black, skips 64 pixels at once where there are none
  */
-void pixelate_buffer(unsigned char *raw_buffer, size_t pixel_size);
+void set_dark_borders(unsigned char *raw_buffer, const BitMask &border_mask);
+
+enum class PixelShape
+{
+    SQUARE,
+    HEX,
+    ADAPTIVE,
+    __LAST_PIXEL_SHAPE,
+};
+
+inline PixelShape &operator++(PixelShape &shape)
+{
+    return shape = static_cast<PixelShape>(
+               (static_cast<int>(shape) + 1)
+               % static_cast<int>(PixelShape::__LAST_PIXEL_SHAPE));
+}
+
+inline std::ostream &operator<<(std::ostream &out, PixelShape shape)
+{
+    switch (shape)
+    {
+    case PixelShape::SQUARE:
+        return out << "SQUARE";
+    case PixelShape::HEX:
+        return out << "HEX";
+    case PixelShape::ADAPTIVE:
+        return out << "ADAPTIVE";
+    default:
+        return out << "UNKNOWN";
+    }
+}
+
+/*
+ * Scratch space of the pixelation filters, one per stream
+ */
+struct PixelateBuffers
+{
+    PixelateBuffers(size_t rows, size_t cols);
+
+    RGBIntegral integral;
+    // Hexagon of every pixel, only rebuilt when the size changes
+    Matrix<uint32_t> cells;
+    size_t cells_size;
+    std::vector<RGB> cell_colors;
+};
+
+/*
+ * Pixelation filters, every block takes the mean color of its pixels.
+ * Means come from a summed-area table of the frame so a block costs the same
+ * whatever its size, blocks are clipped to the frame.
+ */
+void pixelate_buffer(unsigned char *raw_buffer, PixelateBuffers &buffers,
+                     size_t pixel_size);
+void pixelate_buffer(unsigned char *raw_buffer, PixelateBuffers &buffers,
+                     size_t block_width, size_t block_height);
+
+/*
+ * Pointy top hexagons, `pixel_size` is the distance from their center to a
+ * corner
+ */
+void pixelate_buffer_hex(unsigned char *raw_buffer, PixelateBuffers &buffers,
+                         size_t pixel_size);
+
+/*
+ * Quadtree of blocks from `max_size` down to `min_size`, a block is split
+ * while one of its quarters has a mean color more than `threshold` away from
+ * its own on some channel
+ */
+void pixelate_buffer_adaptive(unsigned char *raw_buffer,
+                              PixelateBuffers &buffers, size_t min_size,
+                              size_t max_size, unsigned threshold);
+
+void pixelate_buffer(unsigned char *raw_buffer, PixelateBuffers &buffers,
+                     PixelShape shape, size_t pixel_size);
 
 #include "buffer_utils.hxx"
@@ -3,20 +3,38 @@
 #include "matrix.hh"
 
 template <typename T>
-void to_grayscale(unsigned char *raw_buffer, Matrix<T> &output)
+void to_grayscale(unsigned char *raw_buffer, MatrixView<T> output)
 {
     tbb::parallel_for(
-        tbb::blocked_range<size_t>(0, screen_height * screen_width),
+        tbb::blocked_range<size_t>(0, output.get_rows()),
         [&](tbb::blocked_range<size_t> r) {
             for (size_t i = r.begin(); i < r.end(); i++)
             {
-                RGB color = get_pixel(raw_buffer, i * 4);
-                output.get_data()[i] =
-                    color.r * 0.299 + color.g * 0.587 + color.b * 0.114;
+                T *out = output.row(i);
+                for (size_t j = 0; j < output.get_cols(); j++)
+                {
+                    RGB color = get_pixel(raw_buffer, get_offset(j, i));
+                    out[j] =
+                        color.r * 0.299 + color.g * 0.587 + color.b * 0.114;
+                }
             }
         });
 }
 
+template <typename T>
+void to_grayscale(unsigned char *raw_buffer, MatrixView<T> output,
+                  const std::vector<Tile> &tiles)
+{
+    for_each_tile_row(tiles, [&](size_t y, size_t x_begin, size_t x_end) {
+        T *out = output.row(y);
+        for (size_t x = x_begin; x < x_end; x++)
+        {
+            RGB color = get_pixel(raw_buffer, get_offset(x, y));
+            out[x] = color.r * 0.299 + color.g * 0.587 + color.b * 0.114;
+        }
+    });
+}
+
 template <typename T>
 void remap_to_rgb(Matrix<T> &mat)
 {
@@ -24,44 +42,84 @@ void remap_to_rgb(Matrix<T> &mat)
     T diff = minmax.second - minmax.first;
 
     tbb::parallel_for(
-        tbb::blocked_range<size_t>(0, screen_height * screen_width),
+        tbb::blocked_range<size_t>(0, mat.get_rows()),
         [&](tbb::blocked_range<size_t> r) {
             for (size_t i = r.begin(); i < r.end(); i++)
             {
-                mat.get_data()[i] =
-                    (int)((mat.get_data()[i] - minmax.first) * 255. / diff);
+                T *row = mat.row(i);
+                for (size_t j = 0; j < mat.get_cols(); j++)
+                    row[j] = (int)((row[j] - minmax.first) * 255. / diff);
             }
         });
 }
 
 template <typename T>
-void fill_buffer(unsigned char *raw_buffer, Matrix<T> &mat)
+void fill_buffer(unsigned char *raw_buffer, MatrixView<T> mat)
 {
     tbb::parallel_for(
-        tbb::blocked_range<size_t>(0, screen_height * screen_width),
+        tbb::blocked_range<size_t>(0, mat.get_rows()),
         [&](tbb::blocked_range<size_t> r) {
             for (size_t i = r.begin(); i < r.end(); i++)
             {
-                unsigned char value = (unsigned char)mat.get_data()[i];
-                RGB c(value, value, value);
-                set_pixel(raw_buffer, i * 4, c);
+                const T *row = mat.row(i);
+                for (size_t j = 0; j < mat.get_cols(); j++)
+                {
+                    unsigned char value = (unsigned char)row[j];
+                    RGB c(value, value, value);
+                    set_pixel(raw_buffer, get_offset(j, i), c);
+                }
             }
         });
 }
 
 template <typename T>
-void set_dark_borders(unsigned char *raw_buffer, Matrix<T> &border_mask)
+void fill_buffer(unsigned char *raw_buffer, MatrixView<T> mat,
+                 const std::vector<Tile> &tiles)
+{
+    for_each_tile_row(tiles, [&](size_t y, size_t x_begin, size_t x_end) {
+        const T *row = mat.row(y);
+        for (size_t x = x_begin; x < x_end; x++)
+        {
+            unsigned char value = (unsigned char)row[x];
+            RGB c(value, value, value);
+            set_pixel(raw_buffer, get_offset(x, y), c);
+        }
+    });
+}
+
+template <typename T>
+void set_dark_borders(unsigned char *raw_buffer, MatrixView<T> border_mask)
 {
     auto border_color = RGB(0, 0, 0);
 
     tbb::parallel_for(
-        tbb::blocked_range<size_t>(0, screen_height * screen_width),
+        tbb::blocked_range<size_t>(0, border_mask.get_rows()),
         [&](tbb::blocked_range<size_t> r) {
             for (size_t i = r.begin(); i < r.end(); i++)
             {
-                unsigned char value = (unsigned char)border_mask.get_data()[i];
-                if (value > 0)
-                    set_pixel(raw_buffer, i * 4, border_color);
+                const T *row = border_mask.row(i);
+                for (size_t j = 0; j < border_mask.get_cols(); j++)
+                {
+                    unsigned char value = (unsigned char)row[j];
+                    if (value > 0)
+                        set_pixel(raw_buffer, get_offset(j, i), border_color);
+                }
             }
         });
 }
+
+template <typename T>
+void set_dark_borders(unsigned char *raw_buffer, MatrixView<T> border_mask,
+                      const std::vector<Tile> &tiles)
+{
+    auto border_color = RGB(0, 0, 0);
+
+    for_each_tile_row(tiles, [&](size_t y, size_t x_begin, size_t x_end) {
+        const T *row = border_mask.row(y);
+        for (size_t x = x_begin; x < x_end; x++)
+        {
+            if ((unsigned char)row[x] > 0)
+                set_pixel(raw_buffer, get_offset(x, y), border_color);
+        }
+    });
+}
@@ -2,7 +2,10 @@
 
 #include <iostream>
 
+#include "frame_arena.hh"
+#include "integral_image.hh"
 #include "matrix.hh"
+#include "tiles.hh"
 
 enum Edge : uint8_t
 {
@@ -11,12 +14,28 @@ enum Edge : uint8_t
     STRONG = 255,
 };
 
+// Gradient direction, quantized to the 4 sectors used by the Canny stages
+enum EdgeDirection : uint8_t
+{
+    DEG_0,
+    DEG_45,
+    DEG_90,
+    DEG_135,
+};
+
+// Gradient magnitudes are stored as uint16 fixed point numbers with 4
+// fractional bits, Sobel on 8 bit values never exceeds 2040
+const float gradient_scale = 16;
+
 enum class Blur
 {
     NONE,
     GAUSS,
     MEDIAN,
     BILATERAL,
+    BOX,
+    // Derivative of gaussian instead of a blur followed by Sobel
+    DOG,
     __LAST_BLUR,
 };
 
@@ -46,14 +65,71 @@ inline std::ostream &operator<<(std::ostream &out, Blur blur)
         return out << "MEDIAN";
     case Blur::BILATERAL:
         return out << "BILATERAL";
+    case Blur::BOX:
+        return out << "BOX";
+    case Blur::DOG:
+        return out << "DOG";
     default:
         return out << "UNKNOWN";
     }
 }
 
-void edge_detection(std::vector<Matrix<float>> &padded_buffers, size_t padding,
-                    Blur blur, float low_threshold_ratio,
-                    float hight_threshold_ratio);
+/*
+ * Buffers of the multi-pass Canny, all padded by `padding`
+ */
+struct EdgeBuffers
+{
+    EdgeBuffers(size_t rows, size_t cols, size_t padding);
+
+    size_t padding;
+    // Luma input in blur[0], blur[1] is scratch space
+    std::vector<Matrix<float>> blur;
+    Matrix<uint16_t> gradient;
+    Matrix<uint16_t> suppressed;
+    Matrix<uint8_t> direction;
+    Matrix<uint8_t> state;
+    // Final edges, then their thickened version
+    Matrix<uint8_t> edges;
+    Matrix<uint8_t> thick_edges;
+    // Summed-area table of the box blur, unpadded
+    IntegralImage<float> box_integral;
+};
+
+EdgeDirection quantize_direction(float g_x, float g_y);
+
+uint16_t to_gradient(float magnitude);
+
+/*
+ * Integer thresholds of the hysteresis, the ratios are clamped to [0, 1] so
+ * the thresholds stay within the gradients
+ */
+void hysteresis_thresholds(uint16_t gradient_max, float low_threshold_ratio,
+                           float high_threshold_ratio, uint16_t &low,
+                           uint16_t &high);
+
+/*
+ * Multi-pass Canny, reads the padded luma in buffers.blur[0] and writes
+ * buffers.edges and buffers.direction. `sigma` is the one of Blur::DOG. The
+ * blurs take their scratch from `arena`.
+ */
+void edge_detection(EdgeBuffers &buffers, Blur blur, float sigma,
+                    float low_threshold_ratio, float hight_threshold_ratio,
+                    FrameArena &arena);
+
+/*
+ * Share of the edge pixels of `a` and `b` without an edge of the other one
+ * within `radius` pixels (0 for the same pixel), 0 when both have the same
+ * edges. Bounds the difference between two Canny implementations.
+ */
+float edge_mismatch(MatrixView<uint8_t> a, MatrixView<uint8_t> b,
+                    size_t radius);
+
+void thicken_edges(Matrix<uint8_t> &edges_in, Matrix<uint8_t> &direction_in,
+                   Matrix<uint8_t> &edges_out, size_t padding);
 
-void thicken_edges(Matrix<float> &edges_in, Matrix<float> &angle_in,
-                   Matrix<float> &edges_out, size_t padding);
+/*
+ * Same, only writes `tiles` (frame coordinates) of edges_out
+ */
+void thicken_edges(Matrix<uint8_t> &edges_in, Matrix<uint8_t> &direction_in,
+                   Matrix<uint8_t> &edges_out, size_t padding,
+                   const std::vector<Tile> &tiles);
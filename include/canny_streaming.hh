@@ -0,0 +1,79 @@
+#pragma once
+
+#include "canny.hh"
+#include "matrix.hh"
+#include "tiles.hh"
+
+// Rows of output handled by a single task of edge_detection_streaming
+const size_t streaming_band_height = 64;
+
+// Pixels around a tile that can change its edges (blur, Sobel, non maximum
+// suppression and hysteresis radii)
+const size_t streaming_halo = 8;
+
+/*
+ * Whether edge_detection_streaming supports this blur, median and bilateral
+ * filters need the whole frame and stay on the multi-pass edge_detection
+ */
+bool is_streamable(Blur blur);
+
+/*
+ * Fused Canny: blur, intensity gradients, non maximum suppression,
+ * thresholding and weak edges removal in a single pass.
+ * The frame is cut into horizontal bands processed in parallel, every stage
+ * only keeps the few rows its neighbourhood needs in small ring buffers so
+ * the working set stays in cache. Borders are mirrored like pad_borders.
+ *
+ * Thresholds are relative to `gradient_max`, usually the value returned for
+ * the previous frame (a cheap gradient-only pass computes it when 0).
+ * `direction_out` receives the EdgeDirection plane used by thicken_edges.
+ * Returns the max gradient of this frame, see gradient_scale.
+ */
+uint16_t edge_detection_streaming(MatrixView<float> input,
+                                  MatrixView<uint8_t> edges_out,
+                                  MatrixView<uint8_t> direction_out, Blur blur,
+                                  float low_threshold_ratio,
+                                  float high_threshold_ratio,
+                                  uint16_t gradient_max);
+
+/*
+ * Same as above restricted to `tiles`, the input is read up to
+ * streaming_halo pixels around each tile and the outputs are only written
+ * inside the tiles. `gradient_max` must come from a full frame.
+ */
+void edge_detection_streaming(MatrixView<float> input,
+                              MatrixView<uint8_t> edges_out,
+                              MatrixView<uint8_t> direction_out,
+                              const std::vector<Tile> &tiles, Blur blur,
+                              float low_threshold_ratio,
+                              float high_threshold_ratio,
+                              uint16_t gradient_max);
+
+/*
+ * Fixed point versions of both, for the 8 bit luma: the blur keeps 8
+ * fractional bits in uint16 rows, Sobel runs on int16 values with the 4
+ * fractional bits of gradient_scale, non maximum suppression and thresholds
+ * are the same integer stages. Without blur the edges are the ones of the
+ * float version on the same 8 bit luma, the fixed point blur moves a few
+ * edge pixels by one pixel (see edge_mismatch).
+ */
+uint16_t edge_detection_streaming(MatrixView<uint8_t> input,
+                                  MatrixView<uint8_t> edges_out,
+                                  MatrixView<uint8_t> direction_out, Blur blur,
+                                  float low_threshold_ratio,
+                                  float high_threshold_ratio,
+                                  uint16_t gradient_max);
+void edge_detection_streaming(MatrixView<uint8_t> input,
+                              MatrixView<uint8_t> edges_out,
+                              MatrixView<uint8_t> direction_out,
+                              const std::vector<Tile> &tiles, Blur blur,
+                              float low_threshold_ratio,
+                              float high_threshold_ratio,
+                              uint16_t gradient_max);
+
+/*
+ * 8 bit input of the fixed point Canny out of a float luma, rounded
+ */
+void quantize_luma(MatrixView<float> input, MatrixView<uint8_t> output);
+void quantize_luma(MatrixView<float> input, MatrixView<uint8_t> output,
+                   const std::vector<Tile> &tiles);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+
+#include "matrix.hh"
+#include "tiles.hh"
+
+/*
+ * Contrast limited adaptive histogram equalization of the V channel
+ * (max of r, g, b, same as contrast_correction).
+ * The frame is cut in a grid of tiles, each one gets its own equalization
+ * lookup table from a histogram whose bins are clipped to `clip_limit`
+ * times the mean bin count, so flat areas are not stretched into noise.
+ * Every pixel blends the tables of its 4 nearest tiles.
+ */
+class Clahe
+{
+public:
+    Clahe(size_t width, size_t height, size_t tiles_x, size_t tiles_y,
+          float clip_limit);
+
+    float get_clip_limit();
+    void set_clip_limit(float clip_limit);
+
+    // Histograms and lookup tables, one task per tile
+    void compute(const unsigned char *raw_buffer);
+
+    // Remap V, channels are scaled by new V / V so hue and saturation do not
+    // move
+    void apply(unsigned char *raw_buffer);
+    void apply(unsigned char *raw_buffer, const std::vector<Tile> &tiles);
+
+    // Luma of the remapped frame without touching the frame, `output` can be
+    // the interior of a padded matrix
+    void apply_grayscale(const unsigned char *raw_buffer,
+                         MatrixView<float> output);
+    void apply_grayscale(const unsigned char *raw_buffer,
+                         MatrixView<float> output,
+                         const std::vector<Tile> &tiles);
+
+private:
+    // new V / V of the pixels [x_begin, x_end) of row y, into
+    // ratios[x_begin, x_end)
+    void row_ratios(const unsigned char *row, size_t y, size_t x_begin,
+                    size_t x_end, float *ratios);
+
+    void apply_row(unsigned char *raw_buffer, size_t y, size_t x_begin,
+                   size_t x_end);
+    void grayscale_row(const unsigned char *raw_buffer, float *output,
+                       size_t y, size_t x_begin, size_t x_end);
+
+    size_t mWidth;
+    size_t mHeight;
+    size_t mTilesX;
+    size_t mTilesY;
+    float mClipLimit;
+    // 256 new V / V values per tile (0 for V = 0), row major
+    std::vector<float> mRatios;
+    // Nearest tile centers on the left and weight of the right one, per
+    // column (same along rows). The right tile is the left one past the last
+    // center.
+    std::vector<size_t> mLeft;
+    std::vector<size_t> mRight;
+    std::vector<float> mRightWeight;
+    // First column of which every tile is the left one, mTilesX + 1 entries
+    std::vector<size_t> mSpanStart;
+    std::vector<size_t> mTop;
+    std::vector<size_t> mBottom;
+    std::vector<float> mBottomWeight;
+};
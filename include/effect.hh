@@ -0,0 +1,146 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "canny.hh"
+#include "frame_arena.hh"
+#include "frame_settings.hh"
+#include "octree.hh"
+#include "palette.hh"
+#include "pyramid.hh"
+#include "tiles.hh"
+#include "yuv.hh"
+
+#define PYRAMID_LEVELS 4
+
+// Halo of the luma and edge planes
+const size_t edge_padding = 2;
+
+/*
+ * Planes a stage reads or writes, or'ed together
+ */
+enum Plane : unsigned
+{
+    PLANE_RGBA = 1 << 0,
+    PLANE_LUMA = 1 << 1,
+    // Edges, their directions and their thickened version
+    PLANE_EDGES = 1 << 2,
+};
+
+/*
+ * Planes and shared state of the stages, planes are only allocated when a
+ * stage of the chain uses them
+ */
+struct EffectFrame
+{
+    void allocate(unsigned planes);
+
+    MatrixView<float> get_luma();
+    // Whether the Canny reads luma8 instead of get_luma()
+    bool uses_luma8(const FrameSettings &settings);
+
+    // Input frame, RGBA
+    unsigned char *raw = nullptr;
+    // Same frame as decoded, null for RGBA input. `raw` is only filled when
+    // an enabled stage needs its colors, see Effect::needs_rgba.
+    const unsigned char *yuv = nullptr;
+    PixelFormat format = PixelFormat::RGBA;
+    // Frame being drawn: `raw` or, in incremental mode, the output cache
+    unsigned char *rgba = nullptr;
+    // Tiles to recompute, null for the whole frame
+    const std::vector<Tile> *region = nullptr;
+
+    // Luma in edges->blur[0], or the level 0 of the pyramid below full
+    // resolution
+    std::unique_ptr<EdgeBuffers> edges;
+    std::unique_ptr<PyramidEdgeDetector> pyramid;
+    // Luma of the fixed point Canny, see FrameSettings::integer_canny
+    std::unique_ptr<Matrix<uint8_t>> luma8;
+
+    // Palette of the color quantization, made by `quantizer` or taken from
+    // the palette library, null until there is one
+    Quantizer quantizer;
+    std::shared_ptr<const Palette> palette;
+    // Its cumulative lightness histogram
+    std::vector<size_t> palette_histo;
+
+    // Scratch memory of the stages, released once the frame is finished
+    FrameArena arena;
+};
+
+/*
+ * Stage of the effect chain. Stages declare the planes they use, the engine
+ * orders them from that: a stage waits for the previous writers of what it
+ * reads or writes and for the previous readers of what it writes, anything
+ * else runs concurrently.
+ */
+class Effect
+{
+public:
+    virtual ~Effect() = default;
+
+    virtual const char *get_name() const = 0;
+
+    virtual unsigned get_inputs() const = 0;
+    virtual unsigned get_outputs() const = 0;
+    // Pixels around an output pixel that change it, bounds the halo of the
+    // incremental mode
+    virtual size_t get_radius(const FrameSettings &settings) const = 0;
+    // Whether it can be restricted to EffectFrame::region
+    virtual bool supports_tiles(const FrameSettings &settings) const;
+
+    // Whether it reads the colors of the frame (PLANE_RGBA input by default)
+    virtual bool needs_rgba(const EffectFrame &frame,
+                            const FrameSettings &settings) const;
+    // Whether it writes every pixel without reading them, the frame before
+    // it does not need to be converted
+    virtual bool overwrites_rgba(const FrameSettings &settings) const;
+
+    // Parameters of the chain description, see set_parameter
+    virtual std::vector<std::string> get_parameters() const;
+    // False for an unknown parameter or an invalid value
+    virtual bool set_parameter(FrameSettings &settings,
+                               const std::string &name,
+                               const std::string &value);
+
+    virtual bool is_enabled(const FrameSettings &settings) const = 0;
+    virtual void apply(EffectFrame &frame, const FrameSettings &settings) = 0;
+};
+
+using EffectChain = std::vector<std::unique_ptr<Effect>>;
+using EffectFactory = std::function<std::unique_ptr<Effect>()>;
+
+/*
+ * Stage registry, the built-in stages are always registered
+ */
+void register_effect(const std::string &name, EffectFactory factory);
+std::vector<std::string> get_effect_names();
+// Null for an unknown name
+std::unique_ptr<Effect> make_effect(const std::string &name);
+
+/*
+ * Built-in processing: luma, canny, thicken, colors, borders, pixelate
+ */
+EffectChain default_effect_chain();
+
+/*
+ * Chain description, one stage per line in processing order followed by
+ * its parameters:
+ *
+ *   # comment
+ *   canny blur=gauss low=0.03 high=0.15
+ *   borders mode=dark
+ *
+ * Parameters set the initial settings, the shortcuts still apply.
+ * Throws std::runtime_error on the first invalid line.
+ */
+EffectChain load_effect_chain(const std::string &path,
+                              FrameSettings &settings);
+
+/*
+ * Stages each stage waits for, see Effect
+ */
+std::vector<std::vector<size_t>> effect_dependencies(const EffectChain &chain);
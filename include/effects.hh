@@ -0,0 +1,146 @@
+#pragma once
+
+#include "bit_mask.hh"
+#include "clahe.hh"
+#include "effect.hh"
+
+#define CLAHE_TILES 8
+#define CLAHE_CLIP_LIMIT 3.f
+// Largest pixelate size, a third of the frame height
+#define PIXELATE_MAX_SIZE 240
+
+/*
+ * Built-in stages, registered under their get_name()
+ */
+
+/*
+ * Canny input, with the edge contrast correction. YUV input is read from
+ * its Y plane, equalized on its own histogram, CLAHE still needs the colors.
+ */
+class LumaEffect : public Effect
+{
+public:
+    LumaEffect();
+
+    const char *get_name() const override;
+    unsigned get_inputs() const override;
+    unsigned get_outputs() const override;
+    size_t get_radius(const FrameSettings &settings) const override;
+    std::vector<std::string> get_parameters() const override;
+    bool set_parameter(FrameSettings &settings, const std::string &name,
+                       const std::string &value) override;
+    bool needs_rgba(const EffectFrame &frame,
+                    const FrameSettings &settings) const override;
+    bool is_enabled(const FrameSettings &settings) const override;
+    void apply(EffectFrame &frame, const FrameSettings &settings) override;
+
+private:
+    // Global statistics, only refreshed on full frames in incremental mode
+    Histogram mHistogram;
+    std::vector<size_t> mHisto;
+    Clahe mClahe;
+    // Y to luma of YUV input, and its rounded version for the 8 bit luma
+    float mLut[256];
+    uint8_t mLut8[256];
+};
+
+class CannyEffect : public Effect
+{
+public:
+    CannyEffect();
+
+    const char *get_name() const override;
+    unsigned get_inputs() const override;
+    unsigned get_outputs() const override;
+    size_t get_radius(const FrameSettings &settings) const override;
+    bool supports_tiles(const FrameSettings &settings) const override;
+    std::vector<std::string> get_parameters() const override;
+    bool set_parameter(FrameSettings &settings, const std::string &name,
+                       const std::string &value) override;
+    bool is_enabled(const FrameSettings &settings) const override;
+    void apply(EffectFrame &frame, const FrameSettings &settings) override;
+
+private:
+    // Max gradient of the previous frame, thresholds of the streaming Canny
+    uint16_t mGradientMax;
+};
+
+class ThickenEffect : public Effect
+{
+public:
+    const char *get_name() const override;
+    unsigned get_inputs() const override;
+    unsigned get_outputs() const override;
+    size_t get_radius(const FrameSettings &settings) const override;
+    std::vector<std::string> get_parameters() const override;
+    bool set_parameter(FrameSettings &settings, const std::string &name,
+                       const std::string &value) override;
+    bool is_enabled(const FrameSettings &settings) const override;
+    void apply(EffectFrame &frame, const FrameSettings &settings) override;
+};
+
+/*
+ * Color quantization, then contrast correction and saturation boost
+ */
+class ColorsEffect : public Effect
+{
+public:
+    ColorsEffect();
+
+    const char *get_name() const override;
+    unsigned get_inputs() const override;
+    unsigned get_outputs() const override;
+    size_t get_radius(const FrameSettings &settings) const override;
+    std::vector<std::string> get_parameters() const override;
+    bool set_parameter(FrameSettings &settings, const std::string &name,
+                       const std::string &value) override;
+    bool is_enabled(const FrameSettings &settings) const override;
+    void apply(EffectFrame &frame, const FrameSettings &settings) override;
+
+private:
+    Clahe mClahe;
+};
+
+/*
+ * Dark borders over the frame, or edges only
+ */
+class BordersEffect : public Effect
+{
+public:
+    BordersEffect();
+
+    const char *get_name() const override;
+    unsigned get_inputs() const override;
+    unsigned get_outputs() const override;
+    size_t get_radius(const FrameSettings &settings) const override;
+    std::vector<std::string> get_parameters() const override;
+    bool set_parameter(FrameSettings &settings, const std::string &name,
+                       const std::string &value) override;
+    bool needs_rgba(const EffectFrame &frame,
+                    const FrameSettings &settings) const override;
+    bool overwrites_rgba(const FrameSettings &settings) const override;
+    bool is_enabled(const FrameSettings &settings) const override;
+    void apply(EffectFrame &frame, const FrameSettings &settings) override;
+
+private:
+    BitMask mMask;
+};
+
+class PixelateEffect : public Effect
+{
+public:
+    const char *get_name() const override;
+    unsigned get_inputs() const override;
+    unsigned get_outputs() const override;
+    size_t get_radius(const FrameSettings &settings) const override;
+    bool supports_tiles(const FrameSettings &settings) const override;
+    std::vector<std::string> get_parameters() const override;
+    bool set_parameter(FrameSettings &settings, const std::string &name,
+                       const std::string &value) override;
+    bool is_enabled(const FrameSettings &settings) const override;
+    void apply(EffectFrame &frame, const FrameSettings &settings) override;
+
+private:
+    // Allocated by the first frame
+    std::unique_ptr<PixelateBuffers> mBuffers;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <tbb/concurrent_queue.h>
+#include <thread>
+#include <vector>
+
+// Frames queued for the encoder before write() blocks
+#define ENCODER_BUFFERS 2
+
+/*
+ * Streams RGBA frames into an ffmpeg encoder, the mirror image of the input
+ * pipe. write() copies the frame into a free buffer of a fixed pool and
+ * returns, a dedicated thread feeds the pipe. When the encoder is too slow
+ * every buffer ends up queued and write() blocks until one is written back:
+ * the encoder slows the display down instead of growing a queue.
+ */
+class EncoderSink
+{
+public:
+    // `output` is anything ffmpeg can write, the format follows its extension
+    EncoderSink(const std::string &output,
+                size_t buffer_count = ENCODER_BUFFERS);
+    ~EncoderSink();
+
+    // False when ffmpeg could not be started
+    bool is_open();
+
+    void write(const unsigned char *raw_buffer);
+
+    // Wait for the queued frames and close the encoder
+    void close();
+
+    size_t get_frames_written();
+    // Frames waiting for the encoder
+    size_t get_queue_depth();
+    // Time write() spent waiting for a free buffer
+    double get_blocked_ms();
+    // The encoder stopped accepting frames, the next ones are dropped
+    bool has_failed();
+
+private:
+    void run();
+
+    FILE *mPipe;
+    std::vector<std::vector<unsigned char>> mBuffers;
+    tbb::concurrent_bounded_queue<unsigned char *> mFreeBuffers;
+    // Frames to encode, a null buffer stops the thread
+    tbb::concurrent_bounded_queue<unsigned char *> mPendingBuffers;
+
+    std::atomic<size_t> mFramesWritten;
+    std::atomic<double> mBlockedMs;
+    std::atomic<bool> mFailed;
+    std::thread mThread;
+};
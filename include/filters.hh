@@ -1,17 +1,73 @@
 #pragma once
 
 #include "color.hh"
+#include "frame_arena.hh"
+#include "integral_image.hh"
+#include "kernels.hh"
 #include "matrix.hh"
 
-extern float cGaussian[64];
+// Largest radius of the derivative of gaussian taps, 3 sigma up to sigma 2.67
+#define DERIVATIVE_GAUSS_MAX_RADIUS 8
 
+/*
+ * Convolutions with a compile time kernel of kernels.hh, passed as template
+ * argument: the loops over the taps are unrolled with the taps as
+ * immediates. Only the interior of the padded matrices is written, the
+ * padding must cover the radius of the kernel.
+ */
+template <const auto &Taps>
+void convolve_rows(Matrix<float> &input, Matrix<float> &output,
+                   size_t padding);
+template <const auto &Taps>
+void convolve_columns(Matrix<float> &input, Matrix<float> &output,
+                      size_t padding);
+
+// Single output of a 2D kernel, `in` is under its top left tap. The taps are
+// added row by row, in order.
+template <const auto &Kernel>
+float apply_kernel(const float *in, size_t pitch);
+
+// GAUSS_1D horizontally then vertically
 void gaussian_blur(Matrix<float> &input_output, Matrix<float> &tmp_buffer,
                    size_t padding);
 
-template <typename T>
-void median_filter(Matrix<T> &mat, size_t window_size);
+/*
+ * Separable derivative of gaussian of standard deviation `sigma`, in one pass
+ * over `input`: per row, the vertical gaussian and derivative taps, then the
+ * horizontal derivative of the first (g_x) and gaussian of the second (g_y).
+ * Calls consume(i, g_x, g_y) with both rows, valid from `padding` to
+ * cols - padding and scaled so that a ramp of slope 1 gives 1. The rows past
+ * the borders of the padded matrix repeat them. Scratch rows come from
+ * `arena`.
+ */
+template <typename F>
+void derivative_gauss(Matrix<float> &input, float sigma, size_t padding,
+                      FrameArena &arena, const F &consume);
+
+// Radius of the taps of derivative_gauss, 3 sigma rounded up
+size_t derivative_gauss_radius(float sigma);
 
-void updateGaussian(float delta, int radius);
+// Same, into matrices the size of `img`
+Matrix<float> derivative_gauss_x(Matrix<float> img, float sigma);
+
+Matrix<float> derivative_gauss_y(Matrix<float> img, float sigma);
+
+/*
+ * Mean over the (2 * radius + 1) wide square around every pixel, clipped to
+ * the borders. Built on a summed-area table, so the cost per pixel does not
+ * depend on the radius. `integral` is the table, of the size of `input`.
+ */
+void box_blur(MatrixView<float> input, MatrixView<float> output,
+              size_t radius, IntegralImage<float> &integral);
+
+/*
+ * Median of the window_size x window_size square around every pixel, the
+ * window_size / 2 wide border is left as is. The windows are sorted in
+ * `arena`.
+ */
+template <typename T>
+void median_filter(Matrix<T> &input, Matrix<T> &output, size_t window_size,
+                   FrameArena &arena);
 
 void bilateral_filter(Matrix<float> &input, Matrix<float> &output, int diameter,
                       double sigmaI, double sigmaS);
@@ -1,12 +1,166 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
 #include <tbb/parallel_for.h>
+#include <utility>
 
 #include "filters.hh"
 
+// Sum of in[i * stride] * taps[i], unrolled and added in tap order
+template <const auto &Taps, size_t... I>
+inline float dot_taps(const float *in, size_t stride,
+                      std::index_sequence<I...>)
+{
+    float acc = 0;
+    ((acc += in[I * stride] * Taps[I]), ...);
+    return acc;
+}
+
+template <const auto &Taps>
+void convolve_rows(Matrix<float> &input, Matrix<float> &output,
+                   size_t padding)
+{
+    constexpr size_t size = std::size(Taps);
+    constexpr size_t radius = size / 2;
+    size_t rows = input.get_rows();
+    size_t cols = input.get_cols();
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(padding, rows - padding),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t i = r.begin(); i < r.end(); i++)
+            {
+                const float *in = input.row(i);
+                float *out = output.row(i);
+                for (size_t j = padding; j < cols - padding; j++)
+                {
+                    out[j] = dot_taps<Taps>(in + j - radius, 1,
+                                            std::make_index_sequence<size>());
+                }
+            }
+        });
+}
+
+template <const auto &Taps>
+void convolve_columns(Matrix<float> &input, Matrix<float> &output,
+                      size_t padding)
+{
+    constexpr size_t size = std::size(Taps);
+    constexpr size_t radius = size / 2;
+    size_t rows = input.get_rows();
+    size_t cols = input.get_cols();
+    size_t pitch = input.get_pitch();
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(padding, rows - padding),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t i = r.begin(); i < r.end(); i++)
+            {
+                const float *in = input.row(i - radius);
+                float *out = output.row(i);
+                for (size_t j = padding; j < cols - padding; j++)
+                {
+                    out[j] = dot_taps<Taps>(in + j, pitch,
+                                            std::make_index_sequence<size>());
+                }
+            }
+        });
+}
+
+// Tap I of the kernel, in row major order
+template <const auto &Kernel, size_t... I>
+inline float dot_kernel(const float *in, size_t pitch,
+                        std::index_sequence<I...>)
+{
+    constexpr size_t cols = std::size(Kernel[0]);
+    float acc = 0;
+    ((acc += in[I / cols * pitch + I % cols] * Kernel[I / cols][I % cols]),
+     ...);
+    return acc;
+}
+
+template <const auto &Kernel>
+float apply_kernel(const float *in, size_t pitch)
+{
+    constexpr size_t size = std::size(Kernel) * std::size(Kernel[0]);
+    return dot_kernel<Kernel>(in, pitch, std::make_index_sequence<size>());
+}
+
+// out[j] += tap * in[j], the `first` tap overwrites out instead
+inline void accumulate_taps(const float *in, float *out, size_t cols,
+                            float tap, bool first)
+{
+    if (first)
+    {
+        for (size_t j = 0; j < cols; j++)
+            out[j] = tap * in[j];
+    }
+    else
+    {
+        for (size_t j = 0; j < cols; j++)
+            out[j] += tap * in[j];
+    }
+}
+
+template <typename F>
+void derivative_gauss(Matrix<float> &input, float sigma, size_t padding,
+                      FrameArena &arena, const F &consume)
+{
+    size_t radius = derivative_gauss_radius(sigma);
+    const float *smooth_taps = gaussian_row(sigma, radius).row(0);
+    const float *derivative_taps =
+        derivative_gaussian_row(sigma, radius).row(0);
+    size_t rows = input.get_rows();
+    size_t cols = input.get_cols();
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(padding, rows - padding),
+        [&](tbb::blocked_range<size_t> r) {
+            // Vertical passes, `radius` extra columns on both sides
+            float *smooth = arena.allocate<float>(cols + 2 * radius);
+            float *derivative = arena.allocate<float>(cols + 2 * radius);
+            float *g_x = arena.allocate<float>(cols);
+            float *g_y = arena.allocate<float>(cols);
+
+            for (size_t i = r.begin(); i < r.end(); i++)
+            {
+                for (size_t k = 0; k <= 2 * radius; k++)
+                {
+                    // Row i + k - radius, clamped to the matrix
+                    size_t y = std::max(i + k, radius) - radius;
+                    const float *in = input.row(std::min(y, rows - 1));
+                    accumulate_taps(in, smooth + radius, cols, smooth_taps[k],
+                                    k == 0);
+                    accumulate_taps(in, derivative + radius, cols,
+                                    derivative_taps[k], k == 0);
+                }
+
+                for (size_t j = 0; j < radius; j++)
+                {
+                    smooth[j] = smooth[radius];
+                    smooth[radius + cols + j] = smooth[radius + cols - 1];
+                    derivative[j] = derivative[radius];
+                    derivative[radius + cols + j] =
+                        derivative[radius + cols - 1];
+                }
+
+                for (size_t k = 0; k <= 2 * radius; k++)
+                {
+                    accumulate_taps(smooth + k, g_x, cols, derivative_taps[k],
+                                    k == 0);
+                    accumulate_taps(derivative + k, g_y, cols, smooth_taps[k],
+                                    k == 0);
+                }
+
+                consume(i, g_x, g_y);
+            }
+        });
+}
+
 template <typename T>
-void median_filter(Matrix<T> &input, Matrix<T> &output, size_t window_size)
+void median_filter(Matrix<T> &input, Matrix<T> &output, size_t window_size,
+                   FrameArena &arena)
 {
     size_t half_size = window_size / 2;
 
@@ -16,14 +170,12 @@ void median_filter(Matrix<T> &input, Matrix<T> &output, size_t window_size)
     tbb::parallel_for(
         tbb::blocked_range<size_t>(half_size, m_rows - half_size),
         [&](tbb::blocked_range<size_t> r) {
+            T *entries = arena.allocate<T>(window_size * window_size);
             for (size_t i = r.begin(); i < r.end(); i++)
             {
-                std::vector<T> entries;
-                entries.reserve(window_size * window_size);
-
                 for (size_t j = half_size; j < m_cols - half_size; j++)
                 {
-                    entries.clear();
+                    size_t count = 0;
 
                     for (size_t m = 0; m < window_size; m++)
                     {
@@ -33,13 +185,12 @@ void median_filter(Matrix<T> &input, Matrix<T> &output, size_t window_size)
                             size_t jj = j + n - half_size;
 
                             if (ii < m_rows && jj < m_cols)
-                                entries.push_back(
-                                    input.get_data()[ii * m_cols + jj]);
+                                entries[count++] = input.get_value(jj, ii);
                         }
                     }
 
-                    std::sort(entries.begin(), entries.end());
-                    output.set_value(j, i, entries[entries.size() / 2]);
+                    std::sort(entries, entries + count);
+                    output.set_value(j, i, entries[count / 2]);
                 }
             }
         });
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "aligned_allocator.hh"
+
+/*
+ * Scratch memory that lives for one frame. Allocating is an atomic pointer
+ * bump in a block kept from frame to frame, nothing is freed before reset(),
+ * so the stages and their parallel loops share it without locking.
+ *
+ * A frame that needs more than the block gets extra blocks from the heap,
+ * the next reset() grows the block to what that frame used: once the
+ * largest frame went through, frames do not allocate anymore.
+ */
+class FrameArena
+{
+public:
+    explicit FrameArena(size_t capacity = 0);
+
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    // `count` uninitialized values, aligned on a cache line
+    template <typename T>
+    T *allocate(size_t count);
+
+    void *allocate_bytes(size_t size);
+
+    /*
+     * Every allocation since the previous reset is released, must not run
+     * concurrently with allocate
+     */
+    void reset();
+
+    size_t get_capacity();
+    // Bytes used by the last frame reset
+    size_t get_peak();
+
+private:
+    using Block = std::vector<unsigned char, AlignedAllocator<unsigned char>>;
+
+    Block mBlock;
+    std::atomic<size_t> mUsed;
+    size_t mPeak;
+
+    // Allocations that did not fit in mBlock
+    std::mutex mOverflowMutex;
+    std::vector<Block> mOverflow;
+};
+
+#include "frame_arena.hxx"
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <type_traits>
+
+#include "frame_arena.hh"
+
+template <typename T>
+T *FrameArena::allocate(size_t count)
+{
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "FrameArena values are never destroyed");
+    static_assert(alignof(T) <= cache_line_size,
+                  "FrameArena aligns on a cache line");
+
+    return static_cast<T *>(allocate_bytes(count * sizeof(T)));
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <tbb/concurrent_queue.h>
+#include <thread>
+#include <vector>
+
+#include "budget_controller.hh"
+#include "frame_processor.hh"
+#include "frame_reader.hh"
+#include "thread_pool.hh"
+
+#define FRAMES_IN_FLIGHT 3
+
+/*
+ * A frame and everything needed to process it, owned by a single pipeline
+ * stage (or the display) at a time
+ */
+struct Frame
+{
+    // RGBA output
+    std::vector<unsigned char> pixels;
+    // Input as read for YUV formats, the input is read into `pixels`
+    // otherwise
+    std::vector<unsigned char> yuv;
+    // Settings snapshot taken when the frame was read, at the quality level
+    // of the budget controller
+    FrameSettings settings;
+    size_t quality_level = 0;
+    bool invalidate = false;
+    // Palette to generate from this frame before processing, 0 for none
+    size_t palette_size = 0;
+    // Tiles recomputed for this frame
+    size_t updated_tiles = 0;
+    std::chrono::steady_clock::time_point read_time;
+    // Time spent reading and processing the frame
+    double read_ms = 0;
+    double process_ms = 0;
+};
+
+/*
+ * read -> process -> display as a tbb::parallel_pipeline running on its own
+ * thread: frame N + 2 can be read while frame N + 1 is processed and frame N
+ * is displayed by the caller, up to `frames_in_flight` frames at once.
+ * Frames come from a fixed pool and are handed over between stages, never
+ * copied. Processing stays serial, FrameProcessor keeps state between frames.
+ *
+ * The display side (SDL) stays on the caller's thread: next_frame() blocks
+ * until a frame is processed, release() gives it back to the pool.
+ *
+ * With a `pool`, frames are read and handed over in its I/O arena and
+ * processed in its compute arena, several pipelines can then share the same
+ * workers (see StreamEngine). The pipeline must be built inside the compute
+ * arena, the flow graph of the processor attaches to the arena it is created
+ * in. `on_ready` is called from the pipeline thread every time next_frame()
+ * has something to return, the end of the input included.
+ * Palettes are saved to and picked from `palettes`, see FrameProcessor.
+ */
+class FramePipeline
+{
+public:
+    FramePipeline(FrameReader &reader, size_t frames_in_flight,
+                  EffectChain chain = default_effect_chain(),
+                  const FrameSettings &settings = FrameSettings(),
+                  ThreadPool *pool = nullptr,
+                  std::function<void()> on_ready = nullptr,
+                  PaletteLibrary *palettes = nullptr);
+    ~FramePipeline();
+
+    // Settings of the frames read from now on
+    void set_settings(const FrameSettings &settings);
+    // Next frame ignores the dirty tiles of the previous ones
+    void invalidate();
+    void generate_palette(size_t color_count);
+    bool has_palette();
+    // Keep processing the last frame read instead of the input
+    void set_freeze(bool freeze);
+    // Processing time per frame the quality is adapted to, 0 to disable
+    void set_budget(double budget_ms);
+    size_t get_quality_level();
+
+    size_t get_frames_in_flight();
+    size_t get_tile_count();
+
+    // Null once the input is exhausted
+    Frame *next_frame();
+    void release(Frame *frame);
+
+    // Stop reading, the frames already read are dropped
+    void stop();
+    // Same without waiting, the frames still have to be released and stop()
+    // called
+    void request_stop();
+
+private:
+    void run();
+
+    Frame *read_frame(tbb::flow_control &fc);
+    Frame *process_frame(Frame *frame);
+    void process(Frame *frame);
+    void push_ready(Frame *frame);
+
+    FrameReader &mReader;
+    size_t mFramesInFlight;
+    FrameProcessor mProcessor;
+
+    std::vector<Frame> mFrames;
+    tbb::concurrent_bounded_queue<Frame *> mFreeFrames;
+    // Processed frames, a null frame marks the end of the input
+    tbb::concurrent_bounded_queue<Frame *> mReadyFrames;
+
+    // Requests of the caller, applied to the next frame read
+    std::mutex mMutex;
+    FrameSettings mSettings;
+    bool mInvalidate;
+    size_t mPaletteSize;
+    bool mFreeze;
+    BudgetController mBudget;
+    size_t mQualityLevel;
+
+    // Frozen frame, as read
+    std::vector<unsigned char> mSavedFrame;
+    bool mFrameSaved;
+
+    ThreadPool *mPool;
+    std::function<void()> mOnReady;
+
+    std::atomic<bool> mHasPalette;
+    std::atomic<bool> mStopped;
+    bool mFinished;
+    std::thread mThread;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <tbb/flow_graph.h>
+#include <vector>
+
+#include "effect.hh"
+#include "frame_settings.hh"
+#include "tiles.hh"
+
+#define DIRTY_TILE_SIZE 32
+// Mean absolute difference per channel above which a tile is recomputed
+#define DIRTY_TILE_THRESHOLD 4
+// Frames between two full recomputations in incremental mode
+#define INCREMENTAL_REFRESH_PERIOD 60
+
+/*
+ * Runs an effect chain on every frame as a TBB flow graph, built once:
+ * preprocess (dirty tiles) starts every stage whose planes are ready, see
+ * effect_dependencies, and finish waits for all of them. With the default
+ * chain the edge branch (luma, canny, thicken) and the color branch run
+ * concurrently once the luma is extracted, and their own parallel loops
+ * share the workers. Disabled stages return immediately.
+ * Generated palettes are saved to `palettes` when there is one, which must
+ * outlive the processor, and FrameSettings::library_palette picks one of it.
+ */
+class FrameProcessor
+{
+public:
+    explicit FrameProcessor(EffectChain chain = default_effect_chain(),
+                            PaletteLibrary *palettes = nullptr);
+
+    FrameSettings &get_settings();
+    const EffectChain &get_chain();
+
+    // Settings changed, the next frame is fully recomputed
+    void invalidate();
+
+    void generate_palette(unsigned char *raw_buffer, size_t color_count);
+    // Palette generated from the next frame processed
+    void request_palette(size_t color_count);
+    // Applied from the next frame processed
+    void set_palette(std::shared_ptr<const Palette> palette);
+    bool has_palette();
+
+    /*
+     * Process a frame in place, returns the buffer to display: `raw_buffer`
+     * or, in incremental mode, the cached output.
+     * With a YUV frame, `raw_buffer` only receives its RGBA conversion when a
+     * stage needs it.
+     */
+    unsigned char *process(unsigned char *raw_buffer,
+                           const unsigned char *yuv = nullptr,
+                           PixelFormat format = PixelFormat::RGBA);
+
+    // Tiles recomputed by the last frame
+    size_t get_updated_tiles();
+    size_t get_tile_count();
+
+    // Time spent in each stage of the chain since the previous call, in
+    // chain order
+    std::vector<double> take_stage_ms();
+
+private:
+    using Node = tbb::flow::continue_node<tbb::flow::continue_msg>;
+
+    void preprocess();
+    void finish();
+
+    // Whether the YUV input must be converted for this frame
+    bool needs_rgba();
+    // Whether every enabled stage can be restricted to the dirty tiles
+    bool supports_tiles();
+
+    FrameSettings mSettings;
+    EffectChain mChain;
+    EffectFrame mFrame;
+    // Colors of the palette to generate, 0 for none
+    size_t mPaletteRequest;
+    PaletteLibrary *mPalettes;
+    // FrameSettings::library_palette last applied
+    long mLibraryPalette;
+
+    tbb::flow::graph mGraph;
+    Node mPreprocessNode;
+    std::vector<std::unique_ptr<Node>> mStageNodes;
+    // Written by the stage nodes, one slot each
+    std::vector<double> mStageMs;
+    Node mFinishNode;
+
+    bool mUseTiles;
+    DirtyTiles mDirtyTiles;
+    // Last output in incremental mode, clean tiles are never rewritten
+    std::vector<unsigned char> mOutput;
+    size_t mFramesSinceRefresh;
+    size_t mUpdatedTiles;
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "yuv.hh"
+
+// Frames prefetched ahead of the one being read from a mapping
+#define READAHEAD_FRAMES 4
+
+/*
+ * Source of frames
+ */
+class FrameReader
+{
+public:
+    virtual ~FrameReader() = default;
+
+    virtual PixelFormat get_format() = 0;
+
+    // Next frame, get_frame_size(get_format()) bytes, false at the end of the
+    // input
+    virtual bool read(unsigned char *buffer) = 0;
+};
+
+/*
+ * Raw frames from a pipe, usually ffmpeg
+ */
+class PipeReader : public FrameReader
+{
+public:
+    PipeReader(FILE *pipe, PixelFormat format);
+
+    PixelFormat get_format() override;
+    bool read(unsigned char *buffer) override;
+
+private:
+    FILE *mPipe;
+    PixelFormat mFormat;
+};
+
+/*
+ * Uncompressed video file mapped in memory: raw RGBA frames (.rgba, .raw)
+ * or 4:2:0 YUV4MPEG2 (.y4m), at the screen size.
+ * Frames are indexed when the file is opened, get_frame() points straight
+ * into the mapping and the next frames are prefetched as they are read.
+ * Y4M frames are read as YUV420P, without conversion.
+ * Reading loops over the file, the same frames come in the same order on
+ * every run, which makes it a decode-free input for benchmarks.
+ */
+class MappedReader : public FrameReader
+{
+public:
+    // Throws std::runtime_error, `frame_limit` frames are read (0: no limit)
+    explicit MappedReader(const std::string &path, size_t frame_limit = 0);
+    ~MappedReader();
+
+    MappedReader(const MappedReader &) = delete;
+    MappedReader &operator=(const MappedReader &) = delete;
+
+    // Whether the extension is one of a mappable video
+    static bool is_supported(const std::string &path);
+
+    size_t get_frame_count();
+    bool is_y4m();
+
+    /*
+     * Frame `index` in the mapping: RGBA, or the Y plane followed by the U
+     * and V planes for Y4M
+     */
+    const unsigned char *get_frame(size_t index);
+
+    PixelFormat get_format() override;
+    bool read(unsigned char *buffer) override;
+
+private:
+    void index_y4m();
+    void prefetch(size_t index);
+
+    unsigned char *mData;
+    size_t mSize;
+    bool mY4M;
+    size_t mFrameSize;
+    std::vector<size_t> mOffsets;
+
+    size_t mFrameLimit;
+    size_t mFramesRead;
+};
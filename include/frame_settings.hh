@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+
+#include "buffer_utils.hh"
+#include "canny.hh"
+
+/*
+ * Everything the keyboard shortcuts, the effect chain and the budget
+ * controller can change
+ */
+struct FrameSettings
+{
+    bool edges_only = false;
+    bool dark_borders = false;
+    bool border_dilation = true;
+    bool edge_contrast_correction = true;
+
+    bool color_quantization = false;
+    bool color_contrast_correction = false;
+    bool saturation_boost = true;
+    // CLAHE instead of the global equalization, for both contrast stages
+    bool adaptive_contrast = false;
+    // Colors of the generated palettes
+    size_t palette_size = 100;
+    // Palette of the library (see PaletteLibrary) applied instead of a
+    // generated one, from the first frame. -1 for none.
+    long library_palette = -1;
+    // The palette is looked up once per palette_step x palette_step block of
+    // a full frame
+    size_t palette_step = 1;
+
+    bool pixelate = false;
+    PixelShape pixel_shape = PixelShape::SQUARE;
+    size_t pixel_size = 10;
+
+    bool incremental = false;
+
+    Blur blur = Blur::GAUSS;
+    // Of Blur::DOG, close to the gaussian blurs followed by Sobel
+    float gradient_sigma = 1.2;
+    // Canny resolution, see PyramidEdgeDetector
+    size_t pyramid_level = 0;
+    bool refine_edges = false;
+    // Fixed point Canny on an 8 bit luma, for the streamable blurs at full
+    // resolution (the other ones stay on the float Canny)
+    bool integer_canny = false;
+    float low_threshold_ratio = 0.030;
+    float high_threshold_ratio = 0.150;
+    float saturation_value = 1.5;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <tbb/enumerable_thread_specific.h>
+#include <vector>
+
+/*
+ * Histogram of 8-bit values over `bins` bins (value * bins / 256).
+ * Parallel builds count in private bins per thread, merged at the end, so no
+ * cache line is shared while counting.
+ */
+class Histogram
+{
+public:
+    Histogram(size_t bins = 256);
+
+    size_t get_bins() const;
+    const std::vector<size_t> &get_counts() const;
+
+    void clear();
+
+    // Serial accumulation, `value` in [0, 256)
+    void add(size_t value, size_t count = 1);
+
+    /*
+     * Parallel accumulation over `rows` rows of `cols` values,
+     * row_values(y, values) writes the values of row y
+     */
+    template <typename F>
+    void compute(size_t rows, size_t cols, const F &row_values);
+
+    // Running sums of the counts
+    std::vector<size_t> cumulative() const;
+    // Same, into `sums`, which keeps its storage from call to call
+    void cumulative(std::vector<size_t> &sums) const;
+
+private:
+    size_t mBins;
+    std::vector<size_t> mCounts;
+    tbb::enumerable_thread_specific<std::vector<uint32_t>> mLocalCounts;
+    tbb::enumerable_thread_specific<std::vector<uint8_t>> mLocalValues;
+};
+
+/*
+ * max(r, g, b) of `count` RGBA pixels, the V channel of HSV times 255
+ */
+void max_channel_row(const unsigned char *rgba, uint8_t *values,
+                     size_t count);
+
+/*
+ * Histogram of max(r, g, b) of a RGBA frame
+ */
+void lightness_histogram(const unsigned char *raw_buffer, size_t width,
+                         size_t height, Histogram &histogram);
+
+#include "histogram.hxx"
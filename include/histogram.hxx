@@ -0,0 +1,34 @@
+#pragma once
+
+#include <algorithm>
+#include <tbb/parallel_for.h>
+
+#include "histogram.hh"
+
+template <typename F>
+void Histogram::compute(size_t rows, size_t cols, const F &row_values)
+{
+    for (auto &counts : mLocalCounts)
+        std::fill(counts.begin(), counts.end(), 0);
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, rows),
+                      [&](tbb::blocked_range<size_t> r) {
+                          auto &counts = mLocalCounts.local();
+                          auto &values = mLocalValues.local();
+                          counts.resize(256);
+                          values.resize(cols);
+
+                          for (size_t y = r.begin(); y < r.end(); y++)
+                          {
+                              row_values(y, values.data());
+                              for (size_t x = 0; x < cols; x++)
+                                  counts[values[x]]++;
+                          }
+                      });
+
+    // Values are counted at full resolution, bins are merged here
+    mLocalCounts.combine_each([&](std::vector<uint32_t> &counts) {
+        for (size_t i = 0; i < counts.size(); i++)
+            mCounts[i * mBins / 256] += counts[i];
+    });
+}
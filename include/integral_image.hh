@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+
+#include "color.hh"
+#include "matrix.hh"
+
+// Rows of a task of integral_scan
+const size_t integral_band_height = 32;
+
+/*
+ * Accumulator types of IntegralImage, wide enough for a full 1280x720 frame:
+ * 32 bits for 8-bit sums, 64 bits for 16-bit sums and every squared sum,
+ * double for floating point inputs
+ */
+template <typename T>
+struct integral_traits
+{
+    using sum_type = double;
+    using square_type = double;
+};
+
+template <>
+struct integral_traits<uint8_t>
+{
+    using sum_type = uint32_t;
+    using square_type = uint64_t;
+};
+
+template <>
+struct integral_traits<uint16_t>
+{
+    using sum_type = uint64_t;
+    using square_type = uint64_t;
+};
+
+/*
+ * Summed-area table of `Channels` interleaved channels in two parallel passes
+ * over horizontal bands: column sums of each band, then a scan of every band
+ * starting from the sums of the bands above it.
+ * value(i, j, c) reads row i, column j, channel c of the input.
+ * `sums` gets rows + 1 rows of (cols + 1) * Channels entries, entry (x, y)
+ * being the sum over [0, x) x [0, y). `totals` is scratch space of
+ * (rows / integral_band_height + 2) rows of the same width.
+ */
+template <size_t Channels, typename Acc, typename F>
+void integral_scan(size_t rows, size_t cols, const F &value,
+                   Matrix<Acc> &sums, Matrix<Acc> &totals);
+
+/*
+ * Box statistics of a single channel Matrix in constant time: sums, mean and,
+ * when built with squares, variance over any rectangle [x0, x1) x [y0, y1)
+ */
+template <typename T>
+class IntegralImage
+{
+public:
+    using sum_type = typename integral_traits<T>::sum_type;
+    using square_type = typename integral_traits<T>::square_type;
+
+    IntegralImage(size_t rows, size_t cols, bool squares = false);
+
+    size_t get_rows() const;
+    size_t get_cols() const;
+
+    void build(MatrixView<T> input);
+
+    sum_type sum(size_t x0, size_t y0, size_t x1, size_t y1) const;
+    double mean(size_t x0, size_t y0, size_t x1, size_t y1) const;
+
+    // Only with squares
+    square_type square_sum(size_t x0, size_t y0, size_t x1, size_t y1) const;
+    double variance(size_t x0, size_t y0, size_t x1, size_t y1) const;
+
+private:
+    size_t mRows;
+    size_t mCols;
+    bool mSquares;
+    Matrix<sum_type> mSums;
+    Matrix<sum_type> mTotals;
+    Matrix<square_type> mSquareSums;
+    Matrix<square_type> mSquareTotals;
+};
+
+/*
+ * Summed-area table of the RGB channels of a RGBA frame, any rectangle sum
+ * costs 4 lookups per channel
+ */
+class RGBIntegral
+{
+public:
+    RGBIntegral(size_t rows, size_t cols);
+
+    size_t get_rows() const;
+    size_t get_cols() const;
+
+    void build(const unsigned char *raw_buffer);
+
+    // Sums and mean over [x0, x1) x [y0, y1)
+    RGB sum(size_t x0, size_t y0, size_t x1, size_t y1) const;
+    RGB mean(size_t x0, size_t y0, size_t x1, size_t y1) const;
+
+private:
+    size_t mRows;
+    size_t mCols;
+    Matrix<uint32_t> mSums;
+    Matrix<uint32_t> mTotals;
+};
+
+#include "integral_image.hxx"
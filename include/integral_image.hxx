@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+
+#include "integral_image.hh"
+
+template <size_t Channels, typename Acc, typename F>
+void integral_scan(size_t rows, size_t cols, const F &value,
+                   Matrix<Acc> &sums, Matrix<Acc> &totals)
+{
+    static tbb::enumerable_thread_specific<std::vector<Acc>> carry_rows;
+
+    size_t bands = (rows + integral_band_height - 1) / integral_band_height;
+    size_t width = (cols + 1) * Channels;
+
+    // Pass 1, column sums of every band in row band + 1
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, bands, 1),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t band = r.begin(); band < r.end(); band++)
+            {
+                Acc *band_totals = totals.row(band + 1);
+                std::fill(band_totals, band_totals + width, 0);
+
+                size_t y1 = std::min(rows, (band + 1) * integral_band_height);
+                for (size_t i = band * integral_band_height; i < y1; i++)
+                {
+                    for (size_t j = 0; j < cols; j++)
+                    {
+                        for (size_t c = 0; c < Channels; c++)
+                            band_totals[j * Channels + c] += value(i, j, c);
+                    }
+                }
+            }
+        });
+
+    // Column sums of everything above each band
+    std::fill(totals.row(0), totals.row(0) + width, 0);
+    for (size_t band = 1; band < bands; band++)
+    {
+        const Acc *up = totals.row(band);
+        Acc *band_totals = totals.row(band + 1);
+        for (size_t j = 0; j < width; j++)
+            band_totals[j] += up[j];
+    }
+
+    // Pass 2, every band scans its rows from the row above it
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, bands, 1),
+        [&](tbb::blocked_range<size_t> r) {
+            auto &carry = carry_rows.local();
+            carry.resize(width);
+
+            for (size_t band = r.begin(); band < r.end(); band++)
+            {
+                const Acc *band_totals = totals.row(band);
+                Acc acc[Channels] = {};
+                for (size_t j = 0; j <= cols; j++)
+                {
+                    for (size_t c = 0; c < Channels; c++)
+                    {
+                        carry[j * Channels + c] = acc[c];
+                        if (j < cols)
+                            acc[c] += band_totals[j * Channels + c];
+                    }
+                }
+
+                const Acc *up = carry.data();
+                size_t y1 = std::min(rows, (band + 1) * integral_band_height);
+                for (size_t i = band * integral_band_height; i < y1; i++)
+                {
+                    Acc *out = sums.row(i + 1);
+                    Acc row_acc[Channels] = {};
+                    for (size_t c = 0; c < Channels; c++)
+                        out[c] = 0;
+
+                    for (size_t j = 0; j < cols; j++)
+                    {
+                        for (size_t c = 0; c < Channels; c++)
+                        {
+                            row_acc[c] += value(i, j, c);
+                            out[(j + 1) * Channels + c] =
+                                up[(j + 1) * Channels + c] + row_acc[c];
+                        }
+                    }
+                    up = out;
+                }
+            }
+        });
+}
+
+template <typename Acc>
+Acc box_sum(const Matrix<Acc> &sums, size_t x0, size_t y0, size_t x1,
+            size_t y1)
+{
+    const Acc *top = sums.row(y0);
+    const Acc *bottom = sums.row(y1);
+    return bottom[x1] - bottom[x0] - top[x1] + top[x0];
+}
+
+template <typename T>
+IntegralImage<T>::IntegralImage(size_t rows, size_t cols, bool squares)
+    : mRows(rows)
+    , mCols(cols)
+    , mSquares(squares)
+    , mSums(Matrix<sum_type>::make_aligned(rows + 1, cols + 1))
+    , mTotals(Matrix<sum_type>::make_aligned(
+          rows / integral_band_height + 2, cols + 1))
+    , mSquareSums(Matrix<square_type>::make_aligned(
+          squares ? rows + 1 : 0, squares ? cols + 1 : 0))
+    , mSquareTotals(Matrix<square_type>::make_aligned(
+          squares ? rows / integral_band_height + 2 : 0,
+          squares ? cols + 1 : 0))
+{}
+
+template <typename T>
+size_t IntegralImage<T>::get_rows() const
+{
+    return mRows;
+}
+
+template <typename T>
+size_t IntegralImage<T>::get_cols() const
+{
+    return mCols;
+}
+
+template <typename T>
+void IntegralImage<T>::build(MatrixView<T> input)
+{
+    integral_scan<1>(
+        mRows, mCols,
+        [&](size_t i, size_t j, size_t) { return (sum_type)input.row(i)[j]; },
+        mSums, mTotals);
+
+    if (mSquares)
+    {
+        integral_scan<1>(
+            mRows, mCols,
+            [&](size_t i, size_t j, size_t) {
+                square_type value = input.row(i)[j];
+                return value * value;
+            },
+            mSquareSums, mSquareTotals);
+    }
+}
+
+template <typename T>
+typename IntegralImage<T>::sum_type
+IntegralImage<T>::sum(size_t x0, size_t y0, size_t x1, size_t y1) const
+{
+    return box_sum(mSums, x0, y0, x1, y1);
+}
+
+template <typename T>
+double IntegralImage<T>::mean(size_t x0, size_t y0, size_t x1,
+                              size_t y1) const
+{
+    return (double)sum(x0, y0, x1, y1) / ((x1 - x0) * (y1 - y0));
+}
+
+template <typename T>
+typename IntegralImage<T>::square_type
+IntegralImage<T>::square_sum(size_t x0, size_t y0, size_t x1, size_t y1) const
+{
+    return box_sum(mSquareSums, x0, y0, x1, y1);
+}
+
+template <typename T>
+double IntegralImage<T>::variance(size_t x0, size_t y0, size_t x1,
+                                  size_t y1) const
+{
+    double area = (x1 - x0) * (y1 - y0);
+    double mean = sum(x0, y0, x1, y1) / area;
+    double variance = square_sum(x0, y0, x1, y1) / area - mean * mean;
+    return std::max(variance, 0.);
+}
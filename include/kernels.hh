@@ -1,22 +1,85 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
 #include "matrix.hh"
 
-Matrix<float> mgridy(float begin, float end);
+/*
+ * Kernels known at compile time: fixed size arrays built by constexpr
+ * functions, usable as template arguments of the convolutions (see
+ * convolve_rows in filters.hh) which unroll their taps as immediates.
+ */
+template <size_t N>
+using Taps = std::array<float, N>;
+
+template <size_t Rows, size_t Cols>
+using Kernel2D = std::array<std::array<float, Cols>, Rows>;
+
+// std::exp and std::sqrt are not constexpr, within an ulp of them
+constexpr double constexpr_exp(double x);
+constexpr double constexpr_sqrt(double x);
+
+// exp(-x^2 / (2 sigma^2)) at the integer offsets around the center,
+// normalized to a sum of 1
+template <size_t N>
+constexpr Taps<N> gaussian_taps(double sigma);
+
+// Row N - 1 of Pascal's triangle, the smoothing half of Sobel
+template <size_t N>
+constexpr Taps<N> binomial_taps();
+
+// { -1, 0, 1 }, the derivative half of Sobel
+constexpr Taps<3> central_difference_taps();
+
+// Taps with `bits` fractional bits, rounded to the nearest
+template <size_t N>
+constexpr std::array<uint32_t, N> fixed_point_taps(const Taps<N> &taps,
+                                                   unsigned bits);
+
+// column[y] * row[x], the 2D kernel of a separable filter
+template <size_t Rows, size_t Cols>
+constexpr Kernel2D<Rows, Cols> outer_product(const Taps<Rows> &column,
+                                             const Taps<Cols> &row);
 
-Matrix<float> mgridx(float begin, float end);
+// Before the constants, their initializers need the definitions
+#include "kernels.hxx"
 
-Matrix<float> gauss_kernel(float size);
+// sigma of gaussian_blur and of the Canny and pyramid blurs, 2^-1/4
+inline constexpr double GAUSS_SIGMA = 0.8408964152537145;
 
-Matrix<float> derivative_gauss_kernel_x(float size);
+// 5 taps separable gaussian used by gaussian_blur
+inline constexpr Taps<5> GAUSS_1D = gaussian_taps<5>(GAUSS_SIGMA);
+// Same taps with 8 fractional bits, they add up to 256
+inline constexpr std::array<uint32_t, 5> GAUSS_1D_FIXED =
+    fixed_point_taps(GAUSS_1D, 8);
+static_assert(GAUSS_1D_FIXED[0] + GAUSS_1D_FIXED[1] + GAUSS_1D_FIXED[2]
+                      + GAUSS_1D_FIXED[3] + GAUSS_1D_FIXED[4]
+                  == 256,
+              "the fixed point blur keeps the range of its input");
 
-Matrix<float> derivative_gauss_kernel_y(float size);
+inline constexpr Kernel2D<3, 3> SOBEL_X =
+    outer_product(binomial_taps<3>(), central_difference_taps());
+inline constexpr Kernel2D<3, 3> SOBEL_Y =
+    outer_product(central_difference_taps(), binomial_taps<3>());
 
-Matrix<float> derivative_gauss_x(Matrix<float> img, float size);
+/*
+ * Kernels sized at runtime, built on the first call with a set of
+ * parameters and kept for the lifetime of the process: the references stay
+ * valid, and concurrent stages may ask for them.
+ */
+// 1 x (2 radius + 1) taps of the separable derivative of gaussian: the
+// gaussian normalized to a sum of 1, and x times it normalized so that a
+// ramp of slope 1 gives 1 (positive where the values increase, as Sobel)
+const Matrix<float> &gaussian_row(float sigma, size_t radius);
+const Matrix<float> &derivative_gaussian_row(float sigma, size_t radius);
 
-Matrix<float> derivative_gauss_y(Matrix<float> img, float size);
+const Matrix<float> &ellipse_kernel(int height, int width);
+const Matrix<float> &square_kernel(int height, int width);
 
-Matrix<float> ellipse_kernel(int height, int width);
-Matrix<float> square_kernel(int height, int width);
+// exp(-x^2 / (2 delta^2)) for x in [-radius, radius], not normalized
+const Matrix<float> &gaussian_weights(size_t radius, float delta);
 
-Matrix<float> gauss_5();
+// Spatial weights of the bilateral filter, diameter x diameter
+const Matrix<double> &bilateral_spatial_kernel(size_t diameter, double sigma);
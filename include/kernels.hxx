@@ -0,0 +1,110 @@
+#pragma once
+
+#include "kernels.hh"
+
+constexpr double constexpr_exp(double x)
+{
+    // exp(x) = 2^k exp(r) with |r| <= ln(2) / 2, then Taylor series of exp(r)
+    const double ln2 = 0.6931471805599453;
+    long k = static_cast<long>(x / ln2 + (x < 0 ? -0.5 : 0.5));
+    double r = x - k * ln2;
+
+    double sum = 1;
+    double term = 1;
+    for (int n = 1; n < 24; n++)
+    {
+        term *= r / n;
+        sum += term;
+    }
+
+    for (; k > 0; k--)
+        sum *= 2;
+    for (; k < 0; k++)
+        sum /= 2;
+    return sum;
+}
+
+constexpr double constexpr_sqrt(double x)
+{
+    if (x <= 0)
+        return 0;
+
+    // Newton from above the root, decreases until it stops moving
+    double root = x > 1 ? x : 1;
+    double next = (root + x / root) / 2;
+    while (next < root)
+    {
+        root = next;
+        next = (root + x / root) / 2;
+    }
+    return root;
+}
+
+template <size_t N>
+constexpr Taps<N> gaussian_taps(double sigma)
+{
+    static_assert(N % 2 == 1, "kernels have a center tap");
+
+    double values[N] = {};
+    double sum = 0;
+    for (size_t i = 0; i < N; i++)
+    {
+        double x = double(i) - double(N / 2);
+        values[i] = constexpr_exp(-x * x / (2 * sigma * sigma));
+        sum += values[i];
+    }
+
+    Taps<N> taps{};
+    for (size_t i = 0; i < N; i++)
+        taps[i] = values[i] / sum;
+    return taps;
+}
+
+template <size_t N>
+constexpr Taps<N> binomial_taps()
+{
+    Taps<N> taps{};
+    taps[0] = 1;
+    for (size_t row = 1; row < N; row++)
+    {
+        for (size_t i = row; i > 0; i--)
+            taps[i] += taps[i - 1];
+    }
+    return taps;
+}
+
+constexpr Taps<3> central_difference_taps()
+{
+    return { -1, 0, 1 };
+}
+
+template <size_t N>
+constexpr std::array<uint32_t, N> fixed_point_taps(const Taps<N> &taps,
+                                                   unsigned bits)
+{
+    std::array<uint32_t, N> fixed{};
+    for (size_t i = 0; i < N; i++)
+        fixed[i] = static_cast<uint32_t>(taps[i] * (1u << bits) + 0.5);
+    return fixed;
+}
+
+template <size_t Rows, size_t Cols>
+constexpr Kernel2D<Rows, Cols> outer_product(const Taps<Rows> &column,
+                                             const Taps<Cols> &row)
+{
+    Kernel2D<Rows, Cols> kernel{};
+    for (size_t y = 0; y < Rows; y++)
+    {
+        for (size_t x = 0; x < Cols; x++)
+            kernel[y][x] = column[y] * row[x];
+    }
+    return kernel;
+}
+
+// Last column of row `dy` inside the ellipse of radii `r` (rows) and `c`
+// (columns), relative to the center, see ellipse_kernel
+constexpr int ellipse_half_width(int dy, int r, int c)
+{
+    double inv_r2 = r ? 1. / (double(r) * r) : 0;
+    return int(c * constexpr_sqrt((r * r - dy * dy) * inv_r2));
+}
@@ -5,30 +5,78 @@
 #include <numeric>
 #include <vector>
 
+#include "aligned_allocator.hh"
+
+/*
+ * Non-owning window over a Matrix (or any strided buffer), no bounds check
+ */
+template <typename T>
+class MatrixView
+{
+public:
+    MatrixView(T *data, size_t rows, size_t cols, size_t pitch)
+        : mData(data)
+        , mRows(rows)
+        , mCols(cols)
+        , mPitch(pitch)
+    {}
+
+    size_t get_rows() const;
+    size_t get_cols() const;
+    size_t get_pitch() const;
+
+    T *row(size_t y) const;
+
+    T get_value(size_t x, size_t y) const;
+    void set_value(size_t x, size_t y, T val) const;
+
+    bool is_in_bound(size_t x, size_t y) const;
+
+    // Region of interest of this view, (x, y) is the top left corner
+    MatrixView<T> sub(size_t x, size_t y, size_t rows, size_t cols) const;
+
+private:
+    T *mData;
+    size_t mRows;
+    size_t mCols;
+    size_t mPitch;
+};
+
 template <typename T>
 class Matrix
 {
 public:
+    using storage_type = std::vector<T, AlignedAllocator<T>>;
+
     // rows == height
     // cols == width
     Matrix(size_t rows, size_t cols)
         : mRows(rows)
         , mCols(cols)
+        , mPitch(cols)
         , mData(rows * cols)
     {}
 
     Matrix(size_t rows, size_t cols, T val)
         : mRows(rows)
         , mCols(cols)
+        , mPitch(cols)
         , mData(rows * cols, val)
     {}
 
     Matrix(size_t rows, size_t cols, std::vector<T> mData)
         : mRows(rows)
         , mCols(cols)
-        , mData(mData)
+        , mPitch(cols)
+        , mData(mData.begin(), mData.end())
     {}
 
+    /*
+     * Matrix whose rows all start on a cache line boundary
+     * (pitch >= cols, the extra columns are never read by the filters)
+     */
+    static Matrix<T> make_aligned(size_t rows, size_t cols, T val = T{});
+
     void set_values(std::vector<T> &val);
     void fill(T val);
     void swap(Matrix<T> &mat);
@@ -38,29 +86,45 @@ public:
     std::pair<T, T> get_minmax();
 
     void apply(const std::function<T(T, size_t)> &func);
-    void convolve(Matrix<T> &kernel, Matrix<T> &output);
-    void convolve(Matrix<T> &kernel, Matrix<T> &output, size_t padding);
-    void morph(Matrix<T> &kernel, bool is_dilation, Matrix<T> &output);
+    // Runtime kernels, see kernels.hh
+    void convolve(const Matrix<T> &kernel, Matrix<T> &output);
+    void convolve(const Matrix<T> &kernel, Matrix<T> &output, size_t padding);
+    void morph(const Matrix<T> &kernel, bool is_dilation, Matrix<T> &output);
 
     size_t get_rows();
     size_t get_cols();
+    // Distance in elements between two consecutive rows
+    size_t get_pitch();
+
+    // Raw storage, rows are get_pitch() elements apart
+    storage_type &get_data();
+    const storage_type &get_data() const;
 
-    std::vector<T> &get_data();
-    const std::vector<T> &get_data() const;
+    T *row(size_t y);
+    const T *row(size_t y) const;
 
     // No bounds check
-    T get_value(size_t x, size_t y);
+    T get_value(size_t x, size_t y) const;
     void set_value(size_t x, size_t y, T val);
 
     // With bounds check
     T safe_at(size_t x, size_t y);
     void safe_set(size_t x, size_t y, T val);
 
-    Matrix<T> operator+=(const Matrix<T> &rhs);
-    Matrix<T> operator*=(const Matrix<T> &rhs);
+    MatrixView<T> view();
+    // Region of interest, (x, y) is the top left corner
+    MatrixView<T> view(size_t x, size_t y, size_t rows, size_t cols);
+    // Everything but the `padding` wide halo
+    MatrixView<T> interior(size_t padding);
+
+    // In place, no copy of the matrix
+    Matrix<T> &operator+=(const Matrix<T> &rhs);
+    Matrix<T> &operator*=(const Matrix<T> &rhs);
+    // Negates in place
+    Matrix<T> &operator-();
+    // Allocate their result
     Matrix<T> operator*(const Matrix<T> &rhs);
     Matrix<T> operator/(const Matrix<T> &rhs);
-    Matrix<T> operator-();
     Matrix<T> operator+(const Matrix<T> &rhs);
     Matrix<T> operator-(const Matrix<T> &rhs);
 
@@ -69,13 +133,19 @@ public:
     bool is_on_boundary(size_t x, size_t y, size_t sx, size_t sy);
 
     void pad_borders(size_t padding);
-    void to_padded(size_t padding, Matrix<T> &output);
-    void to_unpad(size_t padding, Matrix<T> &output);
 
 private:
+    Matrix(size_t rows, size_t cols, size_t pitch, T val)
+        : mRows(rows)
+        , mCols(cols)
+        , mPitch(pitch)
+        , mData(rows * pitch, val)
+    {}
+
     size_t mRows;
     size_t mCols;
-    std::vector<T> mData;
+    size_t mPitch;
+    storage_type mData;
 };
 
 #include "matrix.hxx"
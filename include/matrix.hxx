@@ -4,6 +4,64 @@
 
 #include "matrix.hh"
 
+template <typename T>
+size_t MatrixView<T>::get_rows() const
+{
+    return mRows;
+}
+
+template <typename T>
+size_t MatrixView<T>::get_cols() const
+{
+    return mCols;
+}
+
+template <typename T>
+size_t MatrixView<T>::get_pitch() const
+{
+    return mPitch;
+}
+
+template <typename T>
+T *MatrixView<T>::row(size_t y) const
+{
+    return mData + y * mPitch;
+}
+
+template <typename T>
+T MatrixView<T>::get_value(size_t x, size_t y) const
+{
+    return mData[y * mPitch + x];
+}
+
+template <typename T>
+void MatrixView<T>::set_value(size_t x, size_t y, T val) const
+{
+    mData[y * mPitch + x] = val;
+}
+
+template <typename T>
+bool MatrixView<T>::is_in_bound(size_t x, size_t y) const
+{
+    return x < mCols && y < mRows;
+}
+
+template <typename T>
+MatrixView<T> MatrixView<T>::sub(size_t x, size_t y, size_t rows,
+                                 size_t cols) const
+{
+    return MatrixView<T>(mData + y * mPitch + x, rows, cols, mPitch);
+}
+
+template <typename T>
+Matrix<T> Matrix<T>::make_aligned(size_t rows, size_t cols, T val)
+{
+    // Smallest amount of elements covering a whole number of cache lines
+    size_t step = cache_line_size / std::gcd(cache_line_size, sizeof(T));
+    size_t pitch = (cols + step - 1) / step * step;
+    return Matrix<T>(rows, cols, pitch, val);
+}
+
 template <typename T>
 void Matrix<T>::set_values(std::vector<T> &val)
 {
@@ -12,7 +70,9 @@ void Matrix<T>::set_values(std::vector<T> &val)
         std::cerr << "Error: vector length != matrix size" << std::endl;
         return;
     }
-    mData = val; // copy, equivalent to std::copy
+    for (size_t i = 0; i < mRows; i++)
+        std::copy(val.begin() + i * mCols, val.begin() + (i + 1) * mCols,
+                  row(i));
 }
 
 template <typename T>
@@ -24,42 +84,61 @@ void Matrix<T>::fill(T val)
 template <typename T>
 void Matrix<T>::swap(Matrix<T> &mat)
 {
-    mData.swap(mat.get_data());
+    mData.swap(mat.mData);
+    std::swap(mPitch, mat.mPitch);
 }
 
 template <typename T>
 T Matrix<T>::get_min()
 {
-    return *std::min_element(mData.begin(), mData.end());
+    return get_minmax().first;
 }
 
 template <typename T>
 T Matrix<T>::get_max()
 {
-    return *std::max_element(mData.begin(), mData.end());
+    return get_minmax().second;
 }
 
 template <typename T>
 std::pair<T, T> Matrix<T>::get_minmax()
 {
-    auto minmax = std::minmax_element(mData.begin(), mData.end());
-    return { *minmax.first, *minmax.second };
+    if (mPitch == mCols)
+    {
+        auto minmax = std::minmax_element(mData.begin(), mData.end());
+        return { *minmax.first, *minmax.second };
+    }
+
+    // Skip the alignment columns
+    std::pair<T, T> res = { get_value(0, 0), get_value(0, 0) };
+    for (size_t i = 0; i < mRows; i++)
+    {
+        auto minmax = std::minmax_element(row(i), row(i) + mCols);
+        res.first = std::min(res.first, *minmax.first);
+        res.second = std::max(res.second, *minmax.second);
+    }
+    return res;
 }
 
 template <typename T>
 void Matrix<T>::apply(const std::function<T(T, size_t)> &func)
 {
-    tbb::parallel_for(tbb::blocked_range<size_t>(0, mRows * mCols),
-                      [&](tbb::blocked_range<size_t> r) {
-                          for (size_t i = r.begin(); i < r.end(); i++)
-                          {
-                              mData[i] = func(mData[i], i);
-                          }
-                      });
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, mRows),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t i = r.begin(); i < r.end(); i++)
+            {
+                for (size_t j = 0; j < mCols; j++)
+                {
+                    mData[i * mPitch + j] =
+                        func(mData[i * mPitch + j], i * mCols + j);
+                }
+            }
+        });
 }
 
 template <typename T>
-void Matrix<T>::convolve(Matrix<T> &kernel, Matrix<T> &output)
+void Matrix<T>::convolve(const Matrix<T> &kernel, Matrix<T> &output)
 {
     int kCenterX = kernel.mCols / 2;
     int kCenterY = kernel.mRows / 2;
@@ -88,20 +167,21 @@ void Matrix<T>::convolve(Matrix<T> &kernel, Matrix<T> &output)
                             // ignore input samples which are out of bound
                             if (ii < mRows && jj < mCols)
                             {
-                                acc += mData[ii * mCols + jj]
-                                    * kernel.mData[m * kernel.mCols + n];
+                                acc += mData[ii * mPitch + jj]
+                                    * kernel.mData[m * kernel.mPitch + n];
                             }
                         }
                     }
 
-                    output.mData[i * mCols + j] = acc;
+                    output.set_value(j, i, acc);
                 }
             }
         });
 }
 
 template <typename T>
-void Matrix<T>::convolve(Matrix<T> &kernel, Matrix<T> &output, size_t padding)
+void Matrix<T>::convolve(const Matrix<T> &kernel, Matrix<T> &output,
+                         size_t padding)
 {
     int kCenterX = kernel.mCols / 2;
     int kCenterY = kernel.mRows / 2;
@@ -127,22 +207,23 @@ void Matrix<T>::convolve(Matrix<T> &kernel, Matrix<T> &output, size_t padding)
                             size_t ii = i + (kCenterY - mm);
                             size_t jj = j + (kCenterX - nn);
 
-                            acc += mData[ii * mCols + jj]
-                                * kernel.mData[m * kernel.mCols + n];
+                            acc += mData[ii * mPitch + jj]
+                                * kernel.mData[m * kernel.mPitch + n];
                         }
                     }
 
-                    output.mData[i * mCols + j] = acc;
+                    output.set_value(j, i, acc);
                 }
             }
         });
 }
 
 template <typename T>
-void Matrix<T>::morph(Matrix<T> &kernel, bool is_dilation, Matrix<T> &output)
+void Matrix<T>::morph(const Matrix<T> &kernel, bool is_dilation,
+                      Matrix<T> &output)
 {
-    size_t krows = kernel.get_rows();
-    size_t kcols = kernel.get_cols();
+    size_t krows = kernel.mRows;
+    size_t kcols = kernel.mCols;
 
     size_t sx = krows / 2 + krows % 2;
     size_t sy = kcols / 2 + kcols % 2;
@@ -192,44 +273,80 @@ size_t Matrix<T>::get_cols()
 }
 
 template <typename T>
-std::vector<T> &Matrix<T>::get_data()
+size_t Matrix<T>::get_pitch()
+{
+    return mPitch;
+}
+
+template <typename T>
+typename Matrix<T>::storage_type &Matrix<T>::get_data()
 {
     return mData;
 }
 
 template <typename T>
-const std::vector<T> &Matrix<T>::get_data() const
+const typename Matrix<T>::storage_type &Matrix<T>::get_data() const
 {
     return mData;
 }
 
 template <typename T>
-T Matrix<T>::get_value(size_t x, size_t y)
+T *Matrix<T>::row(size_t y)
 {
-    return mData[y * mCols + x];
+    return mData.data() + y * mPitch;
+}
+
+template <typename T>
+const T *Matrix<T>::row(size_t y) const
+{
+    return mData.data() + y * mPitch;
+}
+
+template <typename T>
+T Matrix<T>::get_value(size_t x, size_t y) const
+{
+    return mData[y * mPitch + x];
 }
 
 template <typename T>
 void Matrix<T>::set_value(size_t x, size_t y, T val)
 {
-    mData[y * mCols + x] = val;
+    mData[y * mPitch + x] = val;
 }
 
 template <typename T>
 T Matrix<T>::safe_at(size_t x, size_t y)
 {
-    return is_in_bound(x, y) ? mData[y * mCols + x] : T{};
+    return is_in_bound(x, y) ? mData[y * mPitch + x] : T{};
 }
 
 template <typename T>
 void Matrix<T>::safe_set(size_t x, size_t y, T val)
 {
     if (is_in_bound(x, y))
-        mData[y * mCols + x] = val;
+        mData[y * mPitch + x] = val;
+}
+
+template <typename T>
+MatrixView<T> Matrix<T>::view()
+{
+    return MatrixView<T>(mData.data(), mRows, mCols, mPitch);
 }
 
 template <typename T>
-Matrix<T> Matrix<T>::operator+=(const Matrix<T> &rhs)
+MatrixView<T> Matrix<T>::view(size_t x, size_t y, size_t rows, size_t cols)
+{
+    return MatrixView<T>(row(y) + x, rows, cols, mPitch);
+}
+
+template <typename T>
+MatrixView<T> Matrix<T>::interior(size_t padding)
+{
+    return view(padding, padding, mRows - 2 * padding, mCols - 2 * padding);
+}
+
+template <typename T>
+Matrix<T> &Matrix<T>::operator+=(const Matrix<T> &rhs)
 {
     if (mCols != rhs.mCols || rhs.mRows != mRows)
     {
@@ -237,15 +354,16 @@ Matrix<T> Matrix<T>::operator+=(const Matrix<T> &rhs)
                   << std::endl;
         return *this;
     }
-    for (size_t i = 0; i < rhs.mCols * rhs.mRows; i++)
+    for (size_t i = 0; i < mRows; i++)
     {
-        mData[i] += rhs.mData[i];
+        for (size_t j = 0; j < mCols; j++)
+            mData[i * mPitch + j] += rhs.mData[i * rhs.mPitch + j];
     }
     return *this;
 }
 
 template <typename T>
-Matrix<T> Matrix<T>::operator*=(const Matrix<T> &rhs)
+Matrix<T> &Matrix<T>::operator*=(const Matrix<T> &rhs)
 {
     if (mCols != rhs.mCols || rhs.mRows != mRows)
     {
@@ -253,9 +371,10 @@ Matrix<T> Matrix<T>::operator*=(const Matrix<T> &rhs)
                   << std::endl;
         return *this;
     }
-    for (size_t i = 0; i < rhs.mCols * rhs.mRows; i++)
+    for (size_t i = 0; i < mRows; i++)
     {
-        mData[i] *= rhs.mData[i];
+        for (size_t j = 0; j < mCols; j++)
+            mData[i * mPitch + j] *= rhs.mData[i * rhs.mPitch + j];
     }
     return *this;
 }
@@ -270,9 +389,11 @@ Matrix<T> Matrix<T>::operator*(const Matrix<T> &rhs)
                   << std::endl;
         return res;
     }
-    for (size_t i = 0; i < rhs.mCols * rhs.mRows; i++)
+    for (size_t i = 0; i < mRows; i++)
     {
-        res.mData[i] = mData[i] * rhs.mData[i];
+        for (size_t j = 0; j < mCols; j++)
+            res.mData[i * mCols + j] =
+                mData[i * mPitch + j] * rhs.mData[i * rhs.mPitch + j];
     }
     return res;
 }
@@ -287,17 +408,19 @@ Matrix<T> Matrix<T>::operator/(const Matrix<T> &rhs)
                   << std::endl;
         return res;
     }
-    for (size_t i = 0; i < rhs.mCols * rhs.mRows; i++)
+    for (size_t i = 0; i < mRows; i++)
     {
-        res.mData[i] = mData[i] / rhs.mData[i];
+        for (size_t j = 0; j < mCols; j++)
+            res.mData[i * mCols + j] =
+                mData[i * mPitch + j] / rhs.mData[i * rhs.mPitch + j];
     }
     return res;
 }
 
 template <typename T>
-Matrix<T> Matrix<T>::operator-()
+Matrix<T> &Matrix<T>::operator-()
 {
-    for (size_t i = 0; i < mCols * mRows; i++)
+    for (size_t i = 0; i < mData.size(); i++)
     {
         mData[i] *= -1;
     }
@@ -314,9 +437,11 @@ Matrix<T> Matrix<T>::operator+(const Matrix<T> &rhs)
                   << std::endl;
         return res;
     }
-    for (size_t i = 0; i < rhs.mCols * rhs.mRows; i++)
+    for (size_t i = 0; i < mRows; i++)
     {
-        res.mData[i] = mData[i] + rhs.mData[i];
+        for (size_t j = 0; j < mCols; j++)
+            res.mData[i * mCols + j] =
+                mData[i * mPitch + j] + rhs.mData[i * rhs.mPitch + j];
     }
     return res;
 }
@@ -331,9 +456,11 @@ Matrix<T> Matrix<T>::operator-(const Matrix<T> &rhs)
                   << std::endl;
         return res;
     }
-    for (size_t i = 0; i < rhs.mCols * rhs.mRows; i++)
+    for (size_t i = 0; i < mRows; i++)
     {
-        res.mData[i] = mData[i] - rhs.mData[i];
+        for (size_t j = 0; j < mCols; j++)
+            res.mData[i * mCols + j] =
+                mData[i * mPitch + j] - rhs.mData[i * rhs.mPitch + j];
     }
     return res;
 }
@@ -390,37 +517,3 @@ void Matrix<T>::pad_borders(size_t padding)
         }
     }
 }
-
-template <typename T>
-void Matrix<T>::to_padded(size_t padding, Matrix<T> &output)
-{
-    tbb::parallel_for(tbb::blocked_range<size_t>(0, mRows),
-                      [&](tbb::blocked_range<size_t> r) {
-                          for (size_t i = r.begin(); i < r.end(); i++)
-                          {
-                              for (size_t j = 0; j < mCols; j++)
-                              {
-                                  output.set_value(j + padding, i + padding,
-                                                   get_value(j, i));
-                              }
-                          }
-                      });
-
-    output.pad_borders(padding);
-}
-
-template <typename T>
-void Matrix<T>::to_unpad(size_t padding, Matrix<T> &output)
-{
-    tbb::parallel_for(
-        tbb::blocked_range<size_t>(0, output.get_rows()),
-        [&](tbb::blocked_range<size_t> r) {
-            for (size_t i = r.begin(); i < r.end(); i++)
-            {
-                for (size_t j = 0; j < output.get_cols(); j++)
-                {
-                    output.set_value(j, i, get_value(j + padding, i + padding));
-                }
-            }
-        });
-}
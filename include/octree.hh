@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <climits>
 #include <iostream>
 #include <memory>
@@ -8,6 +9,8 @@
 #include "color.hh"
 
 #define MAX_DEPTH 8
+// Nodes allocated at once by the quantizer
+#define OCTREE_NODE_CHUNK 4096
 
 class Quantizer;
 class Node;
@@ -21,7 +24,11 @@ public:
 
     bool is_leaf();
 
-    std::vector<std::shared_ptr<Node>> get_leaves();
+    // Appends the leaves below the node to `leaves`
+    void get_leaves(std::vector<Node *> &leaves);
+
+    // Levels between the node and its deepest leaf
+    size_t get_depth();
 
     void add_color(RGB c, size_t level, Quantizer *parent);
 
@@ -39,7 +46,7 @@ private:
     RGB c_;
     size_t pixel_count_;
     size_t palette_index_;
-    std::vector<std::shared_ptr<Node>> children_;
+    std::array<Node *, 8> children_;
 };
 
 class Quantizer
@@ -47,22 +54,35 @@ class Quantizer
 public:
     Quantizer();
 
+    // Back to an empty tree, the nodes are reused by the next one
+    void clear();
+
     void add_color(RGB c);
 
     std::vector<RGB> make_palette(size_t color_count);
 
-    std::vector<std::shared_ptr<Node>> get_leaf_nodes();
+    const std::vector<Node *> &get_leaf_nodes();
 
-    void add_level_node(size_t level, std::shared_ptr<Node> node);
+    void add_level_node(size_t level, Node *node);
+
+    Node *new_node();
 
     size_t get_palette_index(RGB c);
 
+    // Depth of the deepest leaf, get_palette_index only reads that many high
+    // bits of each channel
+    size_t get_depth();
+
     std::vector<std::pair<HSV, size_t>> get_histogram();
 
     std::vector<size_t> get_lightness_cumulative_histogram();
 
 private:
-    std::vector<std::vector<std::shared_ptr<Node>>> levels_;
-    std::shared_ptr<Node> root_;
+    // Nodes of the tree, OCTREE_NODE_CHUNK at a time
+    std::vector<std::unique_ptr<Node[]>> node_chunks_;
+    size_t node_count_;
+    std::vector<std::vector<Node *>> levels_;
+    Node *root_;
+    std::vector<Node *> leaves_;
     std::vector<std::pair<HSV, size_t>> histogram_;
 };
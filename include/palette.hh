@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "color.hh"
+#include "octree.hh"
+
+#define PALETTE_LIBRARY_PATH "palettes.bin"
+// Bumped whenever the layout of the file changes, other versions are ignored
+#define PALETTE_FILE_VERSION 1
+// Largest inverse lookup table, 2^21 entries. Tables are exact as long as
+// the leaves of the octree are no deeper.
+#define PALETTE_LUT_MAX_BITS 7
+#define PALETTE_HISTOGRAM_BINS 256
+// Indices of the lookup tables are 16 bit
+#define PALETTE_MAX_COLORS 65536
+
+/*
+ * Layout of the palette file: a PaletteFileHeader then `palette_count`
+ * records, each a PaletteRecordHeader followed by the cumulative lightness
+ * histogram (uint64_t[PALETTE_HISTOGRAM_BINS]), the inverse lookup table
+ * (uint16_t[1 << 3 * lut_bits]) and the colors (r, g, b bytes), padded to 8
+ * bytes. Native byte order.
+ */
+struct PaletteFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t palette_count;
+};
+
+struct PaletteRecordHeader
+{
+    // Bytes of the record, header included
+    uint64_t size;
+    uint32_t color_count;
+    uint32_t lut_bits;
+};
+
+/*
+ * Palette of the color quantization, with everything needed to apply it
+ * without the Quantizer that made it: the index of the palette color of
+ * every color, looked up on the `lut_bits` high bits of each channel, and the
+ * cumulative lightness histogram of the colors. The whole palette is a single
+ * record of the palette file, either owned or read in place from a mapping.
+ */
+class Palette
+{
+public:
+    // Palette just made by `q`, see Quantizer::make_palette
+    Palette(Quantizer &q, const std::vector<RGB> &colors);
+    // Record at `data`, which must outlive the palette, of at most `size`
+    // bytes. Throws std::runtime_error when it does not fit.
+    Palette(const unsigned char *data, size_t size);
+
+    Palette(const Palette &) = delete;
+    Palette &operator=(const Palette &) = delete;
+
+    size_t get_color_count() const;
+    RGB get_color(size_t index) const;
+    // Palette color of `c`
+    RGB lookup(RGB c) const;
+
+    // Copied to `cum_histo`, see contrast_correction
+    void get_lightness_histogram(std::vector<size_t> &cum_histo) const;
+
+    const unsigned char *get_record() const;
+    size_t get_record_size() const;
+
+private:
+    void set_pointers(const unsigned char *record);
+
+    // Empty when the record is mapped
+    std::vector<uint64_t> mStorage;
+    const PaletteRecordHeader *mHeader;
+    const uint64_t *mHistogram;
+    const uint16_t *mLut;
+    const uint8_t *mColors;
+};
+
+inline RGB Palette::lookup(RGB c) const
+{
+    unsigned shift = 8 - mHeader->lut_bits;
+    size_t index = ((c.r >> shift) << (2 * mHeader->lut_bits))
+        | ((c.g >> shift) << mHeader->lut_bits) | (c.b >> shift);
+    return get_color(mLut[index]);
+}
+
+inline RGB Palette::get_color(size_t index) const
+{
+    const uint8_t *color = mColors + index * 3;
+    return RGB(color[0], color[1], color[2]);
+}
+
+/*
+ * Palettes saved in a file, shared by every stream. The file is mapped when
+ * the library is opened: its palettes are applied from the mapping, from the
+ * first frame and without their octree. Added palettes are appended to the
+ * file, rewritten next to it and renamed over it so a running instance keeps
+ * its mapping. A file of another version is replaced by the first palette
+ * added.
+ */
+class PaletteLibrary
+{
+public:
+    // An empty library when `path` does not exist or is not a palette file
+    explicit PaletteLibrary(const std::string &path = PALETTE_LIBRARY_PATH);
+    ~PaletteLibrary();
+
+    PaletteLibrary(const PaletteLibrary &) = delete;
+    PaletteLibrary &operator=(const PaletteLibrary &) = delete;
+
+    size_t get_size();
+    std::shared_ptr<const Palette> get(size_t index);
+
+    // Index of the palette, throws std::runtime_error when it cannot be saved
+    size_t add(std::shared_ptr<const Palette> palette);
+
+private:
+    void save();
+
+    std::string mPath;
+    unsigned char *mData;
+    size_t mSize;
+
+    std::mutex mMutex;
+    std::vector<std::shared_ptr<const Palette>> mPalettes;
+};
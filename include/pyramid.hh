@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+
+#include "canny.hh"
+#include "matrix.hh"
+
+/*
+ * Gaussian pyramid, level 0 is the full resolution image and every other
+ * level is the previous one blurred by the 5 taps gaussian of gaussian_blur
+ * then decimated by 2
+ */
+class Pyramid
+{
+public:
+    Pyramid(size_t rows, size_t cols, size_t levels);
+
+    size_t get_levels();
+    Matrix<float> &get_level(size_t level);
+
+    // Rebuild levels [1, last_level] from level 0
+    void build(size_t last_level);
+
+private:
+    std::vector<Matrix<float>> mLevels;
+};
+
+/*
+ * Decimate `input` by 2 after a separable 5 taps gaussian, borders are
+ * mirrored, output has (rows + 1) / 2 rows and (cols + 1) / 2 cols
+ */
+void pyramid_down(Matrix<float> &input, Matrix<float> &output);
+
+/*
+ * Canny on a pyramid level, the edges are brought back to full resolution
+ * either by nearest neighbour upsampling or, in coarse-to-fine mode, by
+ * locating each coarse edge again on every finer level.
+ * Unstreamable blurs are replaced by Blur::GAUSS below level 0.
+ */
+class PyramidEdgeDetector
+{
+public:
+    PyramidEdgeDetector(size_t rows, size_t cols, size_t levels);
+
+    // Full resolution luma goes in get_pyramid().get_level(0)
+    Pyramid &get_pyramid();
+
+    size_t get_level();
+    void set_level(size_t level);
+
+    bool get_refine();
+    void set_refine(bool refine);
+
+    void detect(MatrixView<uint8_t> edges_out,
+                MatrixView<uint8_t> direction_out, Blur blur,
+                float low_threshold_ratio, float high_threshold_ratio);
+
+private:
+    void upsample(size_t level, MatrixView<uint8_t> edges_out,
+                  MatrixView<uint8_t> direction_out);
+    void refine(size_t level, MatrixView<uint8_t> coarse_edges,
+                MatrixView<uint8_t> edges_out,
+                MatrixView<uint8_t> direction_out, uint16_t low_threshold);
+
+    Pyramid mPyramid;
+    std::vector<Matrix<uint8_t>> mEdges;
+    std::vector<Matrix<uint8_t>> mDirections;
+    // Max gradient of the previous frame, per level
+    std::vector<uint16_t> mGradientMax;
+    size_t mLevel;
+    bool mRefine;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "frame_settings.hh"
+
+// Frames of the feed run through every case
+#define REGRESSION_FRAMES 3
+// Timed runs of every case, the fastest one is kept (noise only slows down)
+#define REGRESSION_RUNS 5
+// A stage fails when it gets this much slower than its recorded time, and
+// by more than REGRESSION_MIN_SLOWDOWN_MS per frame (timer noise)
+#define REGRESSION_MAX_SLOWDOWN 1.25
+#define REGRESSION_MIN_SLOWDOWN_MS 1.0
+// Times a case with a slow stage, or that allocated, runs again before it
+// fails
+#define REGRESSION_RETRIES 3
+
+/*
+ * Settings of a regression case, on top of the default FrameSettings
+ */
+struct RegressionCase
+{
+    std::string name;
+    FrameSettings settings;
+};
+
+/*
+ * Every stage of the default chain and every option of each stage, alone
+ * and combined
+ */
+std::vector<RegressionCase> regression_cases();
+
+/*
+ * Golden frame regression: the first REGRESSION_FRAMES frames of `feed`, a
+ * file read by MappedReader, go through every case with the default chain.
+ *
+ * Recording writes the outputs to `golden_dir` as <case>_<frame>.ppm, and
+ * the best time of every enabled stage per frame to timings.txt.
+ * Checking compares the outputs with the golden images, within the
+ * tolerance of the stages the case enables, and fails a stage that got
+ * slower than REGRESSION_MAX_SLOWDOWN times its recorded time, or that has
+ * no recorded time like a missing golden image. Timings are only meaningful
+ * on the machine that recorded them, with the same load.
+ * Once warm, processing a frame must not allocate, see get_allocation_stats.
+ *
+ * Returns the number of failures, throws std::runtime_error on I/O errors.
+ */
+size_t run_regression(const std::string &feed, const std::string &golden_dir,
+                      bool record);
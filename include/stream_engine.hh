@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <tbb/concurrent_queue.h>
+#include <vector>
+
+#include "encoder_sink.hh"
+#include "frame_pipeline.hh"
+#include "thread_pool.hh"
+
+/*
+ * A feed, its pipeline and everything kept between its frames
+ */
+struct Stream
+{
+    std::string feed;
+    // ffmpeg decoding the feed, null for mapped inputs
+    FILE *pipe = nullptr;
+    std::unique_ptr<FrameReader> reader;
+    std::unique_ptr<FramePipeline> pipeline;
+    // Null when the stream is not encoded
+    std::unique_ptr<EncoderSink> encoder;
+
+    // Edited by the caller, given to pipeline->set_settings()
+    FrameSettings settings;
+    bool finished = false;
+
+    // Displayed frames since the last report, kept by the caller
+    size_t frames = 0;
+    double latency = 0;
+    size_t updated_tiles = 0;
+    double read_ms = 0;
+    double process_ms = 0;
+    // Of the last frame displayed, see BudgetController
+    size_t quality_level = 0;
+};
+
+/*
+ * Several feeds processed at once, each with its own pipeline (buffers,
+ * palette, settings and incremental state).
+ * Every pipeline runs in the same arenas of a ThreadPool: the frames of all
+ * the streams share one pool of workers, which steal work from each other,
+ * instead of every stream bringing its own threads. The thread of each
+ * pipeline gets a slot of its own in the arenas, a stream never waits for
+ * another one to finish before it can start, and only runs the filters of
+ * its own pipeline so a stalled feed never blocks another stream.
+ * Frames are handed to the caller in the order they are processed, whatever
+ * their stream. The streams share `palettes` when there is one.
+ */
+class StreamEngine
+{
+public:
+    // Up to `max_streams` streams
+    explicit StreamEngine(size_t max_streams,
+                          const ThreadSettings &threads = ThreadSettings(),
+                          PaletteLibrary *palettes = nullptr);
+    ~StreamEngine();
+
+    StreamEngine(const StreamEngine &) = delete;
+    StreamEngine &operator=(const StreamEngine &) = delete;
+
+    /*
+     * Open `feed` and start processing it. Uncompressed videos are mapped,
+     * anything else is decoded by ffmpeg into `format`. Processed frames are
+     * also encoded to `output` when it is not empty.
+     * Throws std::runtime_error, also past `max_streams` streams.
+     */
+    Stream &add_stream(const std::string &feed, PixelFormat format,
+                       size_t frames_in_flight, EffectChain chain,
+                       const FrameSettings &settings,
+                       const std::string &output = "");
+
+    size_t get_stream_count();
+    Stream &get_stream(size_t index);
+    ThreadPool &get_thread_pool();
+
+    // Next processed frame of any stream and the index of that stream, null
+    // once every stream is finished
+    Frame *next_frame(size_t &stream);
+    // Same without waiting, null when no frame is ready
+    Frame *poll_frame(size_t &stream);
+    void release(size_t stream, Frame *frame);
+
+    // Stop every stream and close their pipes
+    void stop();
+
+private:
+    Frame *pop_frame(size_t &stream, bool wait);
+
+    size_t mMaxStreams;
+    ThreadPool mPool;
+    PaletteLibrary *mPalettes;
+    std::vector<std::unique_ptr<Stream>> mStreams;
+    // One index per frame (or end of input) ready in a pipeline
+    tbb::concurrent_bounded_queue<size_t> mReadyStreams;
+    size_t mFinishedStreams;
+};
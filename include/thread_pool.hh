@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <sched.h>
+#include <string>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+#include <vector>
+
+/*
+ * Threads used to process frames and where they run
+ */
+struct ThreadSettings
+{
+    // Threads of the compute arena, the pipeline threads included, 0 for one
+    // per core. 1 runs every stage on the pipeline thread of a single stream.
+    size_t workers = 0;
+    // Worker threads of the I/O arena, 0 for one per stream
+    size_t io_workers = 0;
+    // CPUs the compute and I/O threads may run on, any CPU when empty
+    std::vector<int> cpus;
+    std::vector<int> io_cpus;
+    // Every compute thread is pinned to a single CPU of `cpus` (every CPU
+    // when empty) instead of moving between them
+    bool pin = false;
+};
+
+/*
+ * "0-3,8,10-11" to the list of CPUs, false when malformed or out of range
+ */
+bool parse_cpu_list(const std::string &list, std::vector<int> &cpus);
+
+/*
+ * Applies the affinity of an arena to the threads that join it and counts
+ * the threads in the arena over time. The affinity a thread had before
+ * joining is restored when it leaves, a thread going from an arena to another
+ * one always runs on the CPUs of the arena it is in.
+ */
+class ArenaObserver : public tbb::task_scheduler_observer
+{
+public:
+    ArenaObserver(tbb::task_arena &arena, const std::vector<int> &cpus,
+                  bool pin);
+    ~ArenaObserver();
+
+    void on_scheduler_entry(bool is_worker) override;
+    void on_scheduler_exit(bool is_worker) override;
+
+    // Time spent in the arena by all its threads since the previous call
+    double take_thread_ms();
+
+private:
+    // Adds the time since the previous call for every thread in the arena
+    void account();
+
+    struct ThreadState
+    {
+        cpu_set_t saved_cpus;
+        bool restore = false;
+        // Index in mCpus of a pinned thread, kept when it comes back
+        long pinned = -1;
+    };
+
+    std::vector<int> mCpus;
+    bool mPin;
+    std::atomic<size_t> mNextCpu;
+    tbb::enumerable_thread_specific<ThreadState> mThreads;
+
+    std::mutex mMutex;
+    size_t mThreadCount;
+    std::chrono::steady_clock::time_point mLastAccount;
+    double mThreadMs;
+};
+
+/*
+ * The two task arenas of the engine:
+ * - compute: every frame processing stage, a thread per core by default
+ * - I/O: reading frames and handing them over, where threads block on
+ *   pipes and queues
+ * A thread blocked on a pipe never holds a compute slot, and compute workers
+ * can be kept away from the CPUs used by ffmpeg or other services.
+ * The total number of TBB workers is capped to what both arenas need.
+ */
+class ThreadPool
+{
+public:
+    // `masters` threads of their own (the pipelines) join both arenas
+    ThreadPool(const ThreadSettings &settings, size_t masters);
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    tbb::task_arena &get_compute_arena();
+    tbb::task_arena &get_io_arena();
+
+    // Threads of the compute arena, masters included
+    size_t get_workers();
+    size_t get_io_workers();
+
+    // Average number of threads in each arena since the previous call
+    double take_compute_threads(double elapsed_ms);
+    double take_io_threads(double elapsed_ms);
+
+private:
+    size_t mWorkers;
+    size_t mIoWorkers;
+    tbb::global_control mControl;
+    tbb::task_arena mComputeArena;
+    tbb::task_arena mIoArena;
+    ArenaObserver mComputeObserver;
+    ArenaObserver mIoObserver;
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Rectangle of pixels, in frame coordinates
+ */
+struct Tile
+{
+    size_t x, y, width, height;
+};
+
+/*
+ * Cheap change detector for mostly static scenes.
+ * The frame is cut in square tiles, a tile is dirty when its mean absolute
+ * difference with the reference frame exceeds a threshold. The reference only
+ * follows dirty tiles, so slow drifts still end up marking them.
+ */
+class DirtyTiles
+{
+public:
+    DirtyTiles(size_t width, size_t height, size_t tile_size,
+               unsigned threshold);
+
+    // Compare a RGBA frame with the reference, dirty tiles are copied into it
+    void update(const unsigned char *raw_buffer);
+
+    // Next update marks every tile dirty (settings changed, periodic refresh)
+    void invalidate();
+
+    size_t get_tile_count();
+    size_t get_dirty_count();
+    bool all_dirty();
+
+    // Dirty tiles and their direct neighbours (halo for neighbourhood
+    // filters), merged in horizontal runs
+    const std::vector<Tile> &get_update_region();
+
+private:
+    bool is_tile_dirty(const unsigned char *raw_buffer, size_t tile_x,
+                       size_t tile_y);
+    Tile get_tile(size_t tile_x, size_t tile_y, size_t tile_count);
+
+    size_t mWidth;
+    size_t mHeight;
+    size_t mTileSize;
+    size_t mTilesX;
+    size_t mTilesY;
+    // Mean absolute difference per channel
+    unsigned mThreshold;
+    bool mInvalid;
+    size_t mDirtyCount;
+    std::vector<unsigned char> mReference;
+    std::vector<uint8_t> mDirty;
+    std::vector<Tile> mUpdateRegion;
+};
+
+/*
+ * Call func(y, x_begin, x_end) on every row of every tile, in parallel
+ */
+template <typename F>
+void for_each_tile_row(const std::vector<Tile> &tiles, const F &func);
+
+#include "tiles.hxx"
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <tbb/parallel_for.h>
+
+#include "tiles.hh"
+
+template <typename F>
+void for_each_tile_row(const std::vector<Tile> &tiles, const F &func)
+{
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, tiles.size()),
+                      [&](tbb::blocked_range<size_t> r) {
+                          for (size_t t = r.begin(); t < r.end(); t++)
+                          {
+                              const Tile &tile = tiles[t];
+                              for (size_t y = tile.y; y < tile.y + tile.height;
+                                   y++)
+                                  func(y, tile.x, tile.x + tile.width);
+                          }
+                      });
+}
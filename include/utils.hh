@@ -7,4 +7,9 @@
 template <typename T, typename G>
 T saturate_cast(G value, T min, T max);
 
+/*
+ * Index `i` mirrored into [0, n), same layout as Matrix::pad_borders
+ */
+inline long mirror_index(long i, long n);
+
 #include "utils.hxx"
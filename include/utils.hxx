@@ -13,3 +13,12 @@ T saturate_cast(G value, T min, T max)
         return max;
     return (T)value;
 }
+
+inline long mirror_index(long i, long n)
+{
+    if (i < 0)
+        return -i - 1;
+    if (i >= n)
+        return 2 * n - i - 1;
+    return i;
+}
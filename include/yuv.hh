@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "histogram.hh"
+#include "matrix.hh"
+#include "tiles.hh"
+
+/*
+ * Layout of the input frames, at the screen size.
+ * YUV formats are 4:2:0: a full resolution Y plane followed by the U then V
+ * planes (YUV420P) or by a single interleaved UV plane (NV12), BT.601
+ * limited range like ffmpeg's default.
+ */
+enum class PixelFormat
+{
+    RGBA,
+    YUV420P,
+    NV12,
+    __LAST_PIXEL_FORMAT,
+};
+
+inline PixelFormat &operator++(PixelFormat &format)
+{
+    return format = static_cast<PixelFormat>(
+               (static_cast<int>(format) + 1)
+               % static_cast<int>(PixelFormat::__LAST_PIXEL_FORMAT));
+}
+
+// Names of ffmpeg's -pix_fmt
+inline std::ostream &operator<<(std::ostream &out, PixelFormat format)
+{
+    switch (format)
+    {
+    case PixelFormat::RGBA:
+        return out << "rgba";
+    case PixelFormat::YUV420P:
+        return out << "yuv420p";
+    case PixelFormat::NV12:
+        return out << "nv12";
+    default:
+        return out << "unknown";
+    }
+}
+
+// From an ffmpeg -pix_fmt name, false if unknown
+bool parse_pixel_format(const std::string &name, PixelFormat &format);
+
+// Bytes of a frame
+size_t get_frame_size(PixelFormat format);
+
+/*
+ * RGBA frame out of a YUV one, 8 pixels at once with SSE2
+ */
+void yuv_to_rgba(const unsigned char *yuv, PixelFormat format,
+                 unsigned char *raw_buffer);
+
+/*
+ * Luma of the edge detection straight from the Y plane, every value goes
+ * through `lut` (see luma_lut and equalized_luma_lut)
+ */
+void y_to_luma(const unsigned char *y_plane, const float *lut,
+               MatrixView<float> output);
+void y_to_luma(const unsigned char *y_plane, const float *lut,
+               MatrixView<float> output, const std::vector<Tile> &tiles);
+// 8 bit luma of the fixed point Canny
+void y_to_luma(const unsigned char *y_plane, const uint8_t *lut,
+               MatrixView<uint8_t> output);
+void y_to_luma(const unsigned char *y_plane, const uint8_t *lut,
+               MatrixView<uint8_t> output, const std::vector<Tile> &tiles);
+
+// Limited range Y to full range luma
+void luma_lut(float *lut);
+
+// Histogram equalization of the Y plane, full range output, `histogram`
+// holds the counts
+void equalized_luma_lut(const unsigned char *y_plane, float *lut,
+                        Histogram &histogram);
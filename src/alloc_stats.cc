@@ -0,0 +1,146 @@
+#include "alloc_stats.hh"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Replacements of the global operator new and delete, counting every
+// allocation. Relaxed: the counters are only read as statistics.
+static std::atomic<size_t> allocation_count(0);
+static std::atomic<size_t> allocation_bytes(0);
+
+static void *count_allocation(size_t size, size_t alignment)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+
+    if (size == 0)
+        size = 1;
+    if (alignment <= alignof(std::max_align_t))
+        return std::malloc(size);
+
+    // aligned_alloc wants a multiple of the alignment
+    return std::aligned_alloc(alignment,
+                              (size + alignment - 1) / alignment * alignment);
+}
+
+static void *allocate_or_throw(size_t size, size_t alignment)
+{
+    void *ptr = count_allocation(size, alignment);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+AllocationStats get_allocation_stats()
+{
+    AllocationStats stats;
+    stats.count = allocation_count.load(std::memory_order_relaxed);
+    stats.bytes = allocation_bytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void *operator new(size_t size)
+{
+    return allocate_or_throw(size, 0);
+}
+
+void *operator new[](size_t size)
+{
+    return allocate_or_throw(size, 0);
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    return allocate_or_throw(size, size_t(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+    return allocate_or_throw(size, size_t(alignment));
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return count_allocation(size, 0);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return count_allocation(size, 0);
+}
+
+void *operator new(size_t size, std::align_val_t alignment,
+                   const std::nothrow_t &) noexcept
+{
+    return count_allocation(size, size_t(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept
+{
+    return count_allocation(size, size_t(alignment));
+}
+
+// Both allocation paths end in malloc, free releases them all
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t,
+                     const std::nothrow_t &) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t,
+                       const std::nothrow_t &) noexcept
+{
+    std::free(ptr);
+}
@@ -0,0 +1,75 @@
+#include "bit_mask.hh"
+
+#include <tbb/parallel_for.h>
+
+BitMask::BitMask(size_t rows, size_t cols)
+    : mRows(rows)
+    , mCols(cols)
+    , mWords((cols + 63) / 64)
+    , mData(rows * mWords, 0)
+{}
+
+size_t BitMask::get_rows() const
+{
+    return mRows;
+}
+
+size_t BitMask::get_cols() const
+{
+    return mCols;
+}
+
+size_t BitMask::get_words_per_row() const
+{
+    return mWords;
+}
+
+uint64_t *BitMask::row(size_t y)
+{
+    return mData.data() + y * mWords;
+}
+
+const uint64_t *BitMask::row(size_t y) const
+{
+    return mData.data() + y * mWords;
+}
+
+bool BitMask::get(size_t x, size_t y) const
+{
+    return (row(y)[x / 64] >> (x % 64)) & 1;
+}
+
+void BitMask::set(size_t x, size_t y, bool val)
+{
+    uint64_t bit = uint64_t(1) << (x % 64);
+    if (val)
+        row(y)[x / 64] |= bit;
+    else
+        row(y)[x / 64] &= ~bit;
+}
+
+void BitMask::clear()
+{
+    std::fill(mData.begin(), mData.end(), 0);
+}
+
+void BitMask::pack(MatrixView<uint8_t> mask)
+{
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, mRows),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t i = r.begin(); i < r.end(); i++)
+            {
+                const uint8_t *in = mask.row(i);
+                uint64_t *out = row(i);
+                for (size_t w = 0; w < mWords; w++)
+                {
+                    size_t count = std::min<size_t>(64, mCols - w * 64);
+                    uint64_t word = 0;
+                    for (size_t b = 0; b < count; b++)
+                        word |= uint64_t(in[w * 64 + b] != 0) << b;
+                    out[w] = word;
+                }
+            }
+        });
+}
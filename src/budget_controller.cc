@@ -0,0 +1,137 @@
+#include "budget_controller.hh"
+
+#include <algorithm>
+
+#include "canny_streaming.hh"
+
+BudgetController::BudgetController(double budget_ms)
+{
+    set_budget(budget_ms);
+}
+
+double BudgetController::get_budget()
+{
+    return mBudgetMs;
+}
+
+void BudgetController::set_budget(double budget_ms)
+{
+    mBudgetMs = budget_ms;
+    mRaiseFrames = BUDGET_RAISE_FRAMES;
+    mRaised = false;
+    mFrameMs = 0;
+    set_level(0);
+}
+
+size_t BudgetController::get_level()
+{
+    return mLevel;
+}
+
+double BudgetController::get_frame_ms()
+{
+    return mFrameMs;
+}
+
+void BudgetController::set_level(size_t level)
+{
+    mLevel = level;
+    mFramesAtLevel = 0;
+}
+
+void BudgetController::update(double frame_ms, const FrameSettings &settings)
+{
+    if (mBudgetMs <= 0)
+        return;
+
+    // The average starts over at every level
+    mFrameMs = mFramesAtLevel
+        ? mFrameMs + BUDGET_SMOOTHING * (frame_ms - mFrameMs)
+        : frame_ms;
+    mFramesAtLevel++;
+    if (mFramesAtLevel < BUDGET_SETTLE_FRAMES)
+        return;
+
+    if (mFrameMs > mBudgetMs)
+    {
+        size_t level = mLevel + 1;
+        while (level < BUDGET_LEVELS && same_quality(settings, level, mLevel))
+            level++;
+        if (level == BUDGET_LEVELS)
+            return;
+
+        // The last raise did not hold, wait longer before the next one
+        if (mRaised && mFramesAtLevel < mRaiseFrames)
+            mRaiseFrames =
+                std::min<size_t>(mRaiseFrames * 2, BUDGET_MAX_RAISE_FRAMES);
+        mRaised = false;
+        set_level(level);
+        return;
+    }
+
+    // The last raise held
+    if (mRaised && mFramesAtLevel >= mRaiseFrames)
+    {
+        mRaised = false;
+        mRaiseFrames = BUDGET_RAISE_FRAMES;
+    }
+
+    if (mLevel > 0 && mFrameMs < mBudgetMs * BUDGET_HEADROOM
+        && mFramesAtLevel >= mRaiseFrames)
+    {
+        size_t level = mLevel - 1;
+        while (level > 0 && same_quality(settings, level - 1, level))
+            level--;
+        mRaised = true;
+        set_level(level);
+    }
+}
+
+FrameSettings BudgetController::apply(const FrameSettings &settings)
+{
+    return lower(settings, mLevel);
+}
+
+FrameSettings BudgetController::lower(const FrameSettings &settings,
+                                      size_t level)
+{
+    FrameSettings lowered = settings;
+    if (level >= 1 && lowered.blur != Blur::NONE
+        && !is_streamable(lowered.blur))
+        lowered.blur = Blur::GAUSS;
+    if (level >= 2)
+        lowered.adaptive_contrast = false;
+    if (level >= 3)
+        lowered.palette_step = std::max<size_t>(lowered.palette_step, 2);
+    if (level >= 4)
+    {
+        lowered.pyramid_level = std::max<size_t>(lowered.pyramid_level, 1);
+        lowered.refine_edges = false;
+    }
+    if (level >= 5)
+        lowered.palette_step = std::max<size_t>(lowered.palette_step, 4);
+    if (level >= 6)
+        lowered.pyramid_level = std::max<size_t>(lowered.pyramid_level, 2);
+    return lowered;
+}
+
+bool BudgetController::same_quality(const FrameSettings &settings, size_t a,
+                                    size_t b)
+{
+    FrameSettings lowered_a = lower(settings, a);
+    FrameSettings lowered_b = lower(settings, b);
+
+    // Only the stages that run matter
+    bool edges = settings.edges_only || settings.dark_borders;
+    bool colors = settings.color_quantization;
+    bool contrast = (edges && settings.edge_contrast_correction)
+        || (colors && settings.color_contrast_correction);
+
+    return (!edges
+            || (lowered_a.blur == lowered_b.blur
+                && lowered_a.pyramid_level == lowered_b.pyramid_level
+                && lowered_a.refine_edges == lowered_b.refine_edges))
+        && (!contrast
+            || lowered_a.adaptive_contrast == lowered_b.adaptive_contrast)
+        && (!colors || lowered_a.palette_step == lowered_b.palette_step);
+}
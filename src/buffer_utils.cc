@@ -1,8 +1,14 @@
 #include "buffer_utils.hh"
 
+#include <algorithm>
 #include <atomic>
+#include <cmath>
+#include <cstring>
 #include <tbb/parallel_for.h>
 
+#include "histogram.hh"
+#include "integral_image.hh"
+
 size_t get_offset(size_t x, size_t y)
 {
     return (y * 4) * screen_width + (x * 4);
@@ -22,60 +28,70 @@ void set_pixel(unsigned char *raw_buffer, size_t offset, RGB &col)
     raw_buffer[offset + 3] = 255;
 }
 
+void copy_tiles(const unsigned char *src, unsigned char *dst,
+                const std::vector<Tile> &tiles)
+{
+    for_each_tile_row(tiles, [&](size_t y, size_t x_begin, size_t x_end) {
+        std::memcpy(dst + get_offset(x_begin, y), src + get_offset(x_begin, y),
+                    (x_end - x_begin) * 4);
+    });
+}
+
 void to_rgb_matrix(unsigned char *raw_buffer, Matrix<RGB> &output)
 {
     tbb::parallel_for(
         tbb::blocked_range<size_t>(0, screen_height * screen_width),
         [&](tbb::blocked_range<size_t> r) {
             for (size_t i = r.begin(); i < r.end(); i++)
-                output.get_data()[i] = get_pixel(raw_buffer, i * 4);
+                output.set_value(i % screen_width, i / screen_width,
+                                 get_pixel(raw_buffer, i * 4));
         });
 }
 
-void saturation_modification(unsigned char *raw_buffer,
-                             const double saturation_factor)
+void saturate_pixel(unsigned char *raw_buffer, size_t offset,
+                    const double saturation_factor)
 {
-    tbb::parallel_for(
-        tbb::blocked_range<size_t>(0, screen_height * screen_width),
-        [&](tbb::blocked_range<size_t> r) {
-            for (size_t i = r.begin(); i < r.end(); i++)
-            {
-                auto color = get_pixel(raw_buffer, i * 4);
-                auto hsv = to_hsv(color);
+    auto color = get_pixel(raw_buffer, offset);
+    auto hsv = to_hsv(color);
 
-                hsv.s *= saturation_factor;
-                if (hsv.s > 1.)
-                    hsv.s = 1.;
+    hsv.s *= saturation_factor;
+    if (hsv.s > 1.)
+        hsv.s = 1.;
 
-                auto new_color = to_rgb(hsv);
-                set_pixel(raw_buffer, i * 4, new_color);
-            }
-        });
+    auto new_color = to_rgb(hsv);
+    set_pixel(raw_buffer, offset, new_color);
 }
 
-std::vector<size_t> compute_lightness_cumul_histogram(unsigned char *raw_buffer)
+void saturation_modification(unsigned char *raw_buffer,
+                             const double saturation_factor)
 {
-    tbb::concurrent_vector<std::atomic<size_t>> histo(256);
     tbb::parallel_for(
         tbb::blocked_range<size_t>(0, screen_height * screen_width),
         [&](tbb::blocked_range<size_t> r) {
             for (size_t i = r.begin(); i < r.end(); i++)
-            {
-                auto color = get_pixel(raw_buffer, i * 4);
-                auto hsv = to_hsv(color);
-                histo[hsv.v * 255].fetch_add(1, std::memory_order_relaxed);
-            }
+                saturate_pixel(raw_buffer, i * 4, saturation_factor);
         });
+}
 
-    std::vector<size_t> res(256);
-    res[0] = histo[0];
-    for (size_t i = 1; i < 256; i++)
-        res[i] = histo[i] + res[i - 1];
-    return res;
+void saturation_modification(unsigned char *raw_buffer,
+                             const double saturation_factor,
+                             const std::vector<Tile> &tiles)
+{
+    for_each_tile_row(tiles, [&](size_t y, size_t x_begin, size_t x_end) {
+        for (size_t x = x_begin; x < x_end; x++)
+            saturate_pixel(raw_buffer, get_offset(x, y), saturation_factor);
+    });
 }
 
-void contrast_correction(unsigned char *raw_buffer,
-                         std::vector<size_t> &cum_histo)
+void compute_lightness_cumul_histogram(unsigned char *raw_buffer,
+                                       Histogram &histogram,
+                                       std::vector<size_t> &cum_histo)
+{
+    lightness_histogram(raw_buffer, screen_width, screen_height, histogram);
+    histogram.cumulative(cum_histo);
+}
+
+size_t get_cdf_min(std::vector<size_t> &cum_histo)
 {
     auto cdf_min = cum_histo[0];
     for (size_t i = 0; i < cum_histo.size(); i++)
@@ -86,55 +102,180 @@ void contrast_correction(unsigned char *raw_buffer,
             break;
         }
     }
+    return cdf_min;
+}
+
+void equalize_pixel(unsigned char *raw_buffer, size_t offset,
+                    std::vector<size_t> &cum_histo, size_t cdf_min)
+{
+    auto color = get_pixel(raw_buffer, offset);
+    auto hsv = to_hsv(color);
+
+    hsv.v = (float)(cum_histo[hsv.v * 255] - cdf_min)
+        / (screen_height * screen_width - cdf_min);
+
+    auto new_color = to_rgb(hsv);
+    set_pixel(raw_buffer, offset, new_color);
+}
+
+void contrast_correction(unsigned char *raw_buffer,
+                         std::vector<size_t> &cum_histo)
+{
+    auto cdf_min = get_cdf_min(cum_histo);
 
     tbb::parallel_for(
         tbb::blocked_range<size_t>(0, screen_height * screen_width),
         [&](tbb::blocked_range<size_t> r) {
             for (size_t i = r.begin(); i < r.end(); i++)
-            {
-                auto color = get_pixel(raw_buffer, i * 4);
-                auto hsv = to_hsv(color);
+                equalize_pixel(raw_buffer, i * 4, cum_histo, cdf_min);
+        });
+}
 
-                hsv.v = (float)(cum_histo[hsv.v * 255] - cdf_min)
-                    / (screen_height * screen_width - cdf_min);
+void contrast_correction(unsigned char *raw_buffer,
+                         std::vector<size_t> &cum_histo,
+                         const std::vector<Tile> &tiles)
+{
+    auto cdf_min = get_cdf_min(cum_histo);
 
-                auto new_color = to_rgb(hsv);
-                set_pixel(raw_buffer, i * 4, new_color);
-            }
-        });
+    for_each_tile_row(tiles, [&](size_t y, size_t x_begin, size_t x_end) {
+        for (size_t x = x_begin; x < x_end; x++)
+            equalize_pixel(raw_buffer, get_offset(x, y), cum_histo, cdf_min);
+    });
+}
+
+/*
+ * new V / V of contrast_correction for every V
+ */
+void equalization_ratios(std::vector<size_t> &cum_histo, float *ratios)
+{
+    auto cdf_min = get_cdf_min(cum_histo);
+
+    ratios[0] = 0;
+    for (size_t v = 1; v < 256; v++)
+    {
+        float new_v = 255.f * (cum_histo[v] - cdf_min)
+            / (screen_height * screen_width - cdf_min);
+        ratios[v] = new_v / v;
+    }
+}
+
+void equalized_grayscale_row(unsigned char *raw_buffer, float *output,
+                             const float *ratios, size_t y, size_t x_begin,
+                             size_t x_end)
+{
+    const unsigned char *row = raw_buffer + get_offset(0, y);
+    for (size_t x = x_begin; x < x_end; x++)
+    {
+        const unsigned char *p = row + x * 4;
+        float luma = p[0] * 0.299f + p[1] * 0.587f + p[2] * 0.114f;
+        output[x] = luma * ratios[std::max({ p[0], p[1], p[2] })];
+    }
+}
+
+void to_equalized_grayscale(unsigned char *raw_buffer,
+                            std::vector<size_t> &cum_histo,
+                            MatrixView<float> output)
+{
+    float ratios[256];
+    equalization_ratios(cum_histo, ratios);
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, screen_height),
+                      [&](tbb::blocked_range<size_t> r) {
+                          for (size_t i = r.begin(); i < r.end(); i++)
+                              equalized_grayscale_row(raw_buffer,
+                                                      output.row(i), ratios, i,
+                                                      0, screen_width);
+                      });
+}
+
+void to_equalized_grayscale(unsigned char *raw_buffer,
+                            std::vector<size_t> &cum_histo,
+                            MatrixView<float> output,
+                            const std::vector<Tile> &tiles)
+{
+    float ratios[256];
+    equalization_ratios(cum_histo, ratios);
+
+    for_each_tile_row(tiles, [&](size_t y, size_t x_begin, size_t x_end) {
+        equalized_grayscale_row(raw_buffer, output.row(y), ratios, y, x_begin,
+                                x_end);
+    });
 }
 
 void fill_buffer(unsigned char *raw_buffer, Matrix<RGB> &mat)
 {
     tbb::parallel_for(
-        tbb::blocked_range<size_t>(0, screen_height * screen_width),
+        tbb::blocked_range<size_t>(0, screen_height),
         [&](tbb::blocked_range<size_t> r) {
             for (size_t i = r.begin(); i < r.end(); i++)
             {
-                RGB value = mat.get_data()[i];
-                set_pixel(raw_buffer, i * 4, value);
+                for (size_t j = 0; j < screen_width; j++)
+                {
+                    RGB value = mat.get_value(j, i);
+                    set_pixel(raw_buffer, get_offset(j, i), value);
+                }
             }
         });
 }
 
-void apply_palette(unsigned char *raw_buffer, Quantizer &q,
-                   std::vector<RGB> &palette)
+void apply_palette(unsigned char *raw_buffer, const Palette &palette,
+                   size_t step)
 {
+    if (step > 1)
+    {
+        size_t block_rows = (screen_height + step - 1) / step;
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0, block_rows),
+            [&](tbb::blocked_range<size_t> r) {
+                for (size_t i = r.begin(); i < r.end(); i++)
+                {
+                    size_t y_begin = i * step;
+                    size_t y_end = std::min(y_begin + step, screen_height);
+                    for (size_t x = 0; x < screen_width; x += step)
+                    {
+                        RGB color =
+                            get_pixel(raw_buffer, get_offset(x, y_begin));
+                        RGB new_color = palette.lookup(color);
+                        size_t x_end = std::min(x + step, screen_width);
+                        for (size_t y = y_begin; y < y_end; y++)
+                        {
+                            for (size_t j = x; j < x_end; j++)
+                                set_pixel(raw_buffer, get_offset(j, y),
+                                          new_color);
+                        }
+                    }
+                }
+            });
+        return;
+    }
+
     tbb::parallel_for(
         tbb::blocked_range<size_t>(0, screen_height * screen_width),
         [&](tbb::blocked_range<size_t> r) {
             for (size_t i = r.begin(); i < r.end(); i++)
             {
                 RGB color = get_pixel(raw_buffer, i * 4);
-                size_t index = q.get_palette_index(color);
-                RGB new_color = palette[index];
+                RGB new_color = palette.lookup(color);
                 set_pixel(raw_buffer, i * 4, new_color);
             }
         });
 }
 
-void apply_palette_debug(unsigned char *raw_buffer, Quantizer &q,
-                         std::vector<RGB> &palette, size_t x_limit)
+void apply_palette(unsigned char *raw_buffer, const Palette &palette,
+                   const std::vector<Tile> &tiles)
+{
+    for_each_tile_row(tiles, [&](size_t y, size_t x_begin, size_t x_end) {
+        for (size_t x = x_begin; x < x_end; x++)
+        {
+            RGB color = get_pixel(raw_buffer, get_offset(x, y));
+            RGB new_color = palette.lookup(color);
+            set_pixel(raw_buffer, get_offset(x, y), new_color);
+        }
+    });
+}
+
+void apply_palette_debug(unsigned char *raw_buffer, const Palette &palette,
+                         size_t x_limit)
 {
     tbb::parallel_for(
         tbb::blocked_range<size_t>(0, screen_height * screen_width),
@@ -142,49 +283,297 @@ void apply_palette_debug(unsigned char *raw_buffer, Quantizer &q,
             for (size_t i = r.begin(); i < r.end(); i++)
             {
                 RGB color = get_pixel(raw_buffer, i * 4);
-                size_t index = q.get_palette_index(color);
-                RGB new_color =
-                    (i % screen_width > x_limit) ? palette[index] : color;
+                RGB new_color = (i % screen_width > x_limit)
+                    ? palette.lookup(color)
+                    : color;
                 set_pixel(raw_buffer, i * 4, new_color);
             }
         });
 }
 
-void pixelate_buffer(unsigned char *raw_buffer, size_t pixel_size)
+void set_dark_borders(unsigned char *raw_buffer, const BitMask &border_mask)
 {
-    for (size_t i = 0; i < screen_height; i += pixel_size)
+    auto border_color = RGB(0, 0, 0);
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, border_mask.get_rows()),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t i = r.begin(); i < r.end(); i++)
+            {
+                const uint64_t *row = border_mask.row(i);
+                for (size_t w = 0; w < border_mask.get_words_per_row(); w++)
+                {
+                    for (uint64_t word = row[w]; word; word &= word - 1)
+                    {
+                        size_t j = w * 64 + __builtin_ctzll(word);
+                        set_pixel(raw_buffer, get_offset(j, i), border_color);
+                    }
+                }
+            }
+        });
+}
+
+PixelateBuffers::PixelateBuffers(size_t rows, size_t cols)
+    : integral(rows, cols)
+    , cells(Matrix<uint32_t>::make_aligned(rows, cols))
+    , cells_size(0)
+{}
+
+void fill_block(unsigned char *raw_buffer, size_t x0, size_t y0, size_t x1,
+                size_t y1, RGB &color)
+{
+    for (size_t i = y0; i < y1; i++)
     {
-        for (size_t j = 0; j < screen_width; j += pixel_size)
-        {
-            size_t offset = get_offset(j, i);
-            size_t red = 0;
-            size_t blue = 0;
-            size_t green = 0;
-            for (size_t ii = 0; ii < pixel_size; ii++)
+        for (size_t j = x0; j < x1; j++)
+            set_pixel(raw_buffer, get_offset(j, i), color);
+    }
+}
+
+void pixelate_buffer(unsigned char *raw_buffer, PixelateBuffers &buffers,
+                     size_t pixel_size)
+{
+    pixelate_buffer(raw_buffer, buffers, pixel_size, pixel_size);
+}
+
+void pixelate_buffer(unsigned char *raw_buffer, PixelateBuffers &buffers,
+                     size_t block_width, size_t block_height)
+{
+    auto &integral = buffers.integral;
+    integral.build(raw_buffer);
+
+    size_t block_rows = (screen_height + block_height - 1) / block_height;
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, block_rows),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t b = r.begin(); b < r.end(); b++)
+            {
+                size_t i = b * block_height;
+                size_t i_end = std::min(i + block_height, screen_height);
+                for (size_t j = 0; j < screen_width; j += block_width)
+                {
+                    size_t j_end = std::min(j + block_width, screen_width);
+                    RGB color = integral.mean(j, i, j_end, i_end);
+                    fill_block(raw_buffer, j, i, j_end, i_end, color);
+                }
+            }
+        });
+}
+
+/*
+ * Mean of a pointy top hexagon, approximated by a full width rectangle
+ * between two half width ones (same area)
+ */
+RGB hex_mean(const RGBIntegral &integral, float center_x, float center_y,
+             float size)
+{
+    float half_width = std::sqrt(3.f) * size / 2;
+    const float rects[3][4] = {
+        { -half_width, -size / 2, half_width, size / 2 },
+        { -half_width / 2, -size, half_width / 2, -size / 2 },
+        { -half_width / 2, size / 2, half_width / 2, size },
+    };
+
+    auto clip = [](float value, size_t limit) {
+        return (size_t)std::clamp(std::lround(value), 0L, (long)limit);
+    };
+
+    RGB sum;
+    size_t area = 0;
+    for (auto &rect : rects)
+    {
+        size_t x0 = clip(center_x + rect[0], screen_width);
+        size_t y0 = clip(center_y + rect[1], screen_height);
+        size_t x1 = clip(center_x + rect[2], screen_width);
+        size_t y1 = clip(center_y + rect[3], screen_height);
+        if (x0 >= x1 || y0 >= y1)
+            continue;
+
+        RGB part = integral.sum(x0, y0, x1, y1);
+        sum.r += part.r;
+        sum.g += part.g;
+        sum.b += part.b;
+        area += (x1 - x0) * (y1 - y0);
+    }
+
+    // Cell mostly outside of the frame, nearest pixel
+    if (area == 0)
+    {
+        size_t x = std::min(clip(center_x, screen_width), screen_width - 1);
+        size_t y = std::min(clip(center_y, screen_height), screen_height - 1);
+        return integral.sum(x, y, x + 1, y + 1);
+    }
+    return sum.normalized(area);
+}
+
+/*
+ * Cell of every pixel, odd rows of cells are shifted by half a cell and
+ * column -1 is stored at 0
+ */
+void hex_cell_map(Matrix<uint32_t> &cells, float size, size_t cell_cols)
+{
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, screen_height),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t i = r.begin(); i < r.end(); i++)
             {
-                for (size_t jj = 0; jj < pixel_size; jj++)
+                uint32_t *row_cells = cells.row(i);
+                for (size_t j = 0; j < screen_width; j++)
                 {
-                    size_t offset_bis = get_offset(j + jj, i + ii);
-                    RGB next_pixel = get_pixel(raw_buffer, offset_bis);
-                    red += next_pixel.r;
-                    blue += next_pixel.b;
-                    green += next_pixel.g;
+                    // Axial coordinates, rounded in cube coordinates
+                    float q = (std::sqrt(3.f) / 3 * j - i / 3.f) / size;
+                    float s = (2.f / 3 * i) / size;
+                    float t = -q - s;
+                    float round_q = std::round(q);
+                    float round_s = std::round(s);
+                    float round_t = std::round(t);
+                    float diff_q = std::abs(round_q - q);
+                    float diff_s = std::abs(round_s - s);
+                    float diff_t = std::abs(round_t - t);
+                    if (diff_q > diff_s && diff_q > diff_t)
+                        round_q = -round_s - round_t;
+                    else if (diff_s > diff_t)
+                        round_s = -round_q - round_t;
+
+                    long row = round_s;
+                    long col = round_q + (row - (row & 1)) / 2 + 1;
+                    row_cells[j] = row * cell_cols + col;
                 }
             }
-            red /= (pixel_size * pixel_size);
-            blue /= (pixel_size * pixel_size);
-            green /= (pixel_size * pixel_size);
+        });
+}
+
+void pixelate_buffer_hex(unsigned char *raw_buffer, PixelateBuffers &buffers,
+                         size_t pixel_size)
+{
+    auto &integral = buffers.integral;
+    auto &cells = buffers.cells;
+    auto &cell_colors = buffers.cell_colors;
+    integral.build(raw_buffer);
+
+    float size = pixel_size;
+    float cell_width = std::sqrt(3.f) * size;
+    float cell_height = 1.5f * size;
+    size_t cell_cols = screen_width / cell_width + 4;
+    size_t cell_rows = screen_height / cell_height + 2;
+    cell_colors.resize(cell_rows * cell_cols);
+
+    if (buffers.cells_size != pixel_size)
+    {
+        hex_cell_map(cells, size, cell_cols);
+        buffers.cells_size = pixel_size;
+    }
 
-            auto color = RGB(red, green, blue);
-            set_pixel(raw_buffer, offset, color);
-            for (size_t ii = 0; ii < pixel_size; ii++)
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, cell_rows),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t row = r.begin(); row < r.end(); row++)
             {
-                for (size_t jj = 0; jj < pixel_size; jj++)
+                for (size_t col = 0; col < cell_cols; col++)
                 {
-                    size_t offset_bis = get_offset(j + jj, i + ii);
-                    set_pixel(raw_buffer, offset_bis, color);
+                    float center_x =
+                        cell_width * (col - 1.f + 0.5f * (row & 1));
+                    float center_y = cell_height * row;
+                    cell_colors[row * cell_cols + col] =
+                        hex_mean(integral, center_x, center_y, size);
                 }
             }
+        });
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, screen_height),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t i = r.begin(); i < r.end(); i++)
+            {
+                const uint32_t *row_cells = cells.row(i);
+                for (size_t j = 0; j < screen_width; j++)
+                    set_pixel(raw_buffer, get_offset(j, i),
+                              cell_colors[row_cells[j]]);
+            }
+        });
+}
+
+void pixelate_block(unsigned char *raw_buffer, const RGBIntegral &integral,
+                    size_t x0, size_t y0, size_t x1, size_t y1,
+                    size_t min_size, unsigned threshold)
+{
+    RGB color = integral.mean(x0, y0, x1, y1);
+
+    if (x1 - x0 >= min_size * 2 && y1 - y0 >= min_size * 2)
+    {
+        size_t x_mid = (x0 + x1) / 2;
+        size_t y_mid = (y0 + y1) / 2;
+        const size_t quarters[4][4] = { { x0, y0, x_mid, y_mid },
+                                        { x_mid, y0, x1, y_mid },
+                                        { x0, y_mid, x_mid, y1 },
+                                        { x_mid, y_mid, x1, y1 } };
+
+        auto distance = [](size_t a, size_t b) {
+            return (unsigned)std::abs((long)a - (long)b);
+        };
+
+        bool split = false;
+        for (auto &quarter : quarters)
+        {
+            RGB mean = integral.mean(quarter[0], quarter[1], quarter[2],
+                                     quarter[3]);
+            split = split || distance(mean.r, color.r) > threshold
+                || distance(mean.g, color.g) > threshold
+                || distance(mean.b, color.b) > threshold;
+        }
+
+        if (split)
+        {
+            for (auto &quarter : quarters)
+                pixelate_block(raw_buffer, integral, quarter[0], quarter[1],
+                               quarter[2], quarter[3], min_size, threshold);
+            return;
         }
     }
+
+    fill_block(raw_buffer, x0, y0, x1, y1, color);
+}
+
+void pixelate_buffer_adaptive(unsigned char *raw_buffer,
+                              PixelateBuffers &buffers, size_t min_size,
+                              size_t max_size, unsigned threshold)
+{
+    auto &integral = buffers.integral;
+    integral.build(raw_buffer);
+
+    size_t block_rows = (screen_height + max_size - 1) / max_size;
+    size_t block_cols = (screen_width + max_size - 1) / max_size;
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, block_rows * block_cols),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t b = r.begin(); b < r.end(); b++)
+            {
+                size_t i = b / block_cols * max_size;
+                size_t j = b % block_cols * max_size;
+                pixelate_block(raw_buffer, integral, j, i,
+                               std::min(j + max_size, screen_width),
+                               std::min(i + max_size, screen_height), min_size,
+                               threshold);
+            }
+        });
+}
+
+void pixelate_buffer(unsigned char *raw_buffer, PixelateBuffers &buffers,
+                     PixelShape shape, size_t pixel_size)
+{
+    switch (shape)
+    {
+    case PixelShape::HEX:
+        pixelate_buffer_hex(raw_buffer, buffers, pixel_size);
+        break;
+    case PixelShape::ADAPTIVE:
+        pixelate_buffer_adaptive(raw_buffer, buffers,
+                                 std::max<size_t>(pixel_size / 2, 1),
+                                 pixel_size * 4, 16);
+        break;
+    default:
+        pixelate_buffer(raw_buffer, buffers, pixel_size);
+        break;
+    }
 }
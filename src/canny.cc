@@ -1,52 +1,127 @@
 #include "canny.hh"
 
+#include <algorithm>
+#include <functional>
 #include <iostream>
 #include <math.h>
+#include <tbb/combinable.h>
 #include <tbb/parallel_for.h>
 
 #include "filters.hh"
 
-const float SOBEL_X[] = { -1, 0, 1, -2, 0, 2, -1, 0, 1 };
-const float SOBEL_Y[] = { -1, -2, -1, 0, 0, 0, 1, 2, 1 };
+const float TAN_22_5 = 0.41421356;
+const float TAN_67_5 = 2.41421356;
+
+EdgeBuffers::EdgeBuffers(size_t rows, size_t cols, size_t padding)
+    : padding(padding)
+    , blur(2,
+           Matrix<float>::make_aligned(rows + padding * 2, cols + padding * 2))
+    , gradient(Matrix<uint16_t>::make_aligned(rows + padding * 2,
+                                              cols + padding * 2))
+    , suppressed(Matrix<uint16_t>::make_aligned(rows + padding * 2,
+                                                cols + padding * 2))
+    , direction(Matrix<uint8_t>::make_aligned(rows + padding * 2,
+                                              cols + padding * 2))
+    , state(Matrix<uint8_t>::make_aligned(rows + padding * 2,
+                                          cols + padding * 2))
+    , edges(Matrix<uint8_t>::make_aligned(rows + padding * 2,
+                                          cols + padding * 2))
+    , thick_edges(Matrix<uint8_t>::make_aligned(rows + padding * 2,
+                                                cols + padding * 2))
+    , box_integral(rows, cols)
+{}
+
+EdgeDirection quantize_direction(float g_x, float g_y)
+{
+    // Same sectors as atan2(g_y, g_x) in [0°, 180°), without the atan2
+    float a_x = std::abs(g_x);
+    float a_y = std::abs(g_y);
+
+    if (a_y <= TAN_22_5 * a_x)
+        return DEG_0;
+    if (a_y >= TAN_67_5 * a_x)
+        return DEG_90;
+    return (g_x > 0) == (g_y > 0) ? DEG_45 : DEG_135;
+}
+
+uint16_t to_gradient(float magnitude)
+{
+    return magnitude * gradient_scale + 0.5f;
+}
+
+void hysteresis_thresholds(uint16_t gradient_max, float low_threshold_ratio,
+                           float high_threshold_ratio, uint16_t &low,
+                           uint16_t &high)
+{
+    // Integer values: value >= t <=> value >= ceil(t)
+    float high_threshold =
+        std::ceil(gradient_max * std::clamp(high_threshold_ratio, 0.f, 1.f));
+    float low_threshold =
+        std::ceil(high_threshold * std::clamp(low_threshold_ratio, 0.f, 1.f));
+    high = high_threshold;
+    low = low_threshold;
+}
 
-void intensity_gradients(Matrix<float> &input, Matrix<float> &gradient_out,
-                         Matrix<float> &angle_out, size_t padding)
+void intensity_gradients(Matrix<float> &input, Matrix<uint16_t> &gradient_out,
+                         Matrix<uint8_t> &direction_out, size_t padding)
 {
     auto m_rows = input.get_rows();
     auto m_cols = input.get_cols();
+    size_t pitch = input.get_pitch();
 
     tbb::parallel_for(
         tbb::blocked_range<size_t>(padding, m_rows - padding),
         [&](tbb::blocked_range<size_t> r) {
             for (size_t i = r.begin(); i < r.end(); i++)
             {
+                // Top left tap of the Sobel kernels
+                const float *in = input.row(i - 1) - 1;
                 for (size_t j = padding; j < m_cols - padding; j++)
                 {
-                    float g_x = 0;
-                    float g_y = 0;
-                    for (size_t m = 0; m < 3; m++)
-                    {
-                        for (size_t n = 0; n < 3; n++)
-                        {
-                            size_t ii = i + (-1 + m);
-                            size_t jj = j + (-1 + n);
-
-                            g_x += input.get_value(jj, ii) * SOBEL_X[m * 3 + n];
-                            g_y += input.get_value(jj, ii) * SOBEL_Y[m * 3 + n];
-                        }
-                    }
+                    float g_x = apply_kernel<SOBEL_X>(in + j, pitch);
+                    float g_y = apply_kernel<SOBEL_Y>(in + j, pitch);
 
                     // Approximation: sqrt(Gx² + Gy²) => |Gx| + |Gy|
-                    gradient_out.set_value(j, i, std::abs(g_x) + std::abs(g_y));
-                    angle_out.set_value(j, i, std::atan2(g_y, g_x));
+                    gradient_out.set_value(
+                        j, i, to_gradient(std::abs(g_x) + std::abs(g_y)));
+                    direction_out.set_value(j, i, quantize_direction(g_x, g_y));
                 }
             }
         });
 }
 
-void non_maximum_suppression(Matrix<float> &gradient_in,
-                             Matrix<float> &angle_in, Matrix<float> &output,
-                             size_t padding)
+// Sobel on a ramp of slope 1, the gradients of derivative_gauss_gradients
+// stay in the units of intensity_gradients
+const float SOBEL_GAIN = 8;
+
+/*
+ * Blur, Sobel and gradients in a single pass over `input`
+ */
+void derivative_gauss_gradients(Matrix<float> &input,
+                                Matrix<uint16_t> &gradient_out,
+                                Matrix<uint8_t> &direction_out, float sigma,
+                                size_t padding, FrameArena &arena)
+{
+    size_t m_cols = input.get_cols();
+
+    derivative_gauss(
+        input, sigma, padding, arena,
+        [&](size_t i, const float *g_x, const float *g_y) {
+            uint16_t *gradient = gradient_out.row(i);
+            uint8_t *direction = direction_out.row(i);
+            for (size_t j = padding; j < m_cols - padding; j++)
+            {
+                float x = g_x[j] * SOBEL_GAIN;
+                float y = g_y[j] * SOBEL_GAIN;
+                gradient[j] = to_gradient(std::abs(x) + std::abs(y));
+                direction[j] = quantize_direction(x, y);
+            }
+        });
+}
+
+void non_maximum_suppression(Matrix<uint16_t> &gradient_in,
+                             Matrix<uint8_t> &direction_in,
+                             Matrix<uint16_t> &output, size_t padding)
 {
     tbb::parallel_for(
         tbb::blocked_range<size_t>(padding, gradient_in.get_rows() - padding),
@@ -56,39 +131,29 @@ void non_maximum_suppression(Matrix<float> &gradient_in,
                 for (size_t j = padding; j < gradient_in.get_cols() - padding;
                      j++)
                 {
-                    float angle = angle_in.get_value(j, i) * 180 / M_PI;
-
-                    if (angle < 0)
-                        angle += 180;
+                    uint16_t q = 0, r = 0;
 
-                    float q = 256, r = 256;
-
-                    // 0°
-                    if (angle < 22.5 || angle >= 157.5)
+                    switch (direction_in.get_value(j, i))
                     {
+                    case DEG_0:
                         r = gradient_in.get_value(j - 1, i);
                         q = gradient_in.get_value(j + 1, i);
-                    }
-                    // 45°
-                    else if (angle >= 22.5 && angle < 67.5)
-                    {
+                        break;
+                    case DEG_45:
                         q = gradient_in.get_value(j - 1, i - 1);
                         r = gradient_in.get_value(j + 1, i + 1);
-                    }
-                    // 90°
-                    else if (angle >= 67.5 && angle < 112.5)
-                    {
+                        break;
+                    case DEG_90:
                         r = gradient_in.get_value(j, i - 1);
                         q = gradient_in.get_value(j, i + 1);
-                    }
-                    // 135°
-                    else if (angle >= 112.5 && angle < 157.5)
-                    {
+                        break;
+                    default: // DEG_135
                         q = gradient_in.get_value(j - 1, i + 1);
                         r = gradient_in.get_value(j + 1, i - 1);
+                        break;
                     }
 
-                    float value = gradient_in.get_value(j, i);
+                    uint16_t value = gradient_in.get_value(j, i);
                     if (value >= q && value >= r)
                         output.set_value(j, i, value);
                     else
@@ -98,13 +163,12 @@ void non_maximum_suppression(Matrix<float> &gradient_in,
         });
 }
 
-void weak_strong_edges_thresholding(Matrix<float> &input, Matrix<float> &output,
-                                    float lo, float hi, size_t padding)
+void weak_strong_edges_thresholding(Matrix<uint16_t> &input,
+                                    Matrix<uint8_t> &output, float lo,
+                                    float hi, size_t padding)
 {
-    float high_threshold = input.get_max() * hi;
-    float low_threshold = high_threshold * lo;
-
-    // std::cout << low_threshold << " " << high_threshold << "\n";
+    uint16_t high, low;
+    hysteresis_thresholds(input.get_max(), lo, hi, low, high);
 
     tbb::parallel_for(
         tbb::blocked_range<size_t>(padding, input.get_rows() - padding),
@@ -113,11 +177,11 @@ void weak_strong_edges_thresholding(Matrix<float> &input, Matrix<float> &output,
             {
                 for (size_t j = padding; j < input.get_cols() - padding; j++)
                 {
-                    float value = input.get_value(j, i);
+                    uint16_t value = input.get_value(j, i);
 
-                    if (value >= high_threshold)
+                    if (value >= high)
                         output.set_value(j, i, STRONG);
-                    else if (value < low_threshold)
+                    else if (value < low)
                         output.set_value(j, i, NONE);
                     else
                         output.set_value(j, i, WEAK);
@@ -131,7 +195,7 @@ const std::pair<int8_t, int8_t> NEIGHBOURS[] = {
     { 1, 0 },   { -1, 1 }, { 0, 1 },  { 1, 1 },
 };
 
-void weak_edges_removal(Matrix<float> &input, Matrix<float> &output,
+void weak_edges_removal(Matrix<uint8_t> &input, Matrix<uint8_t> &output,
                         size_t padding)
 {
     tbb::parallel_for(
@@ -165,49 +229,124 @@ void weak_edges_removal(Matrix<float> &input, Matrix<float> &output,
         });
 }
 
-void edge_detection(std::vector<Matrix<float>> &buffers, size_t padding,
-                    Blur blur, float low_threshold_ratio,
-                    float hight_threshold_ratio)
+void edge_detection(EdgeBuffers &buffers, Blur blur, float sigma,
+                    float low_threshold_ratio, float hight_threshold_ratio,
+                    FrameArena &arena)
 {
+    size_t padding = buffers.padding;
+
     switch (blur)
     {
     case Blur::NONE:
         break;
     case Blur::GAUSS:
-        gaussian_blur(buffers[0], buffers[1], padding);
-        gaussian_blur(buffers[1], buffers[0], padding);
-        buffers[1].swap(buffers[0]);
+        gaussian_blur(buffers.blur[0], buffers.blur[1], padding);
+        gaussian_blur(buffers.blur[1], buffers.blur[0], padding);
+        buffers.blur[1].swap(buffers.blur[0]);
         break;
     case Blur::MEDIAN:
-        median_filter(buffers[0], buffers[1], 5);
-        buffers[1].swap(buffers[0]);
+        median_filter(buffers.blur[0], buffers.blur[1], 5, arena);
+        buffers.blur[1].swap(buffers.blur[0]);
         break;
     case Blur::BILATERAL:
-        bilateral_filter(buffers[0], buffers[1], padding * 2 + 1, 12, 16);
-        buffers[1].swap(buffers[0]);
+        bilateral_filter(buffers.blur[0], buffers.blur[1], padding * 2 + 1, 12,
+                         16);
+        buffers.blur[1].swap(buffers.blur[0]);
+        break;
+    case Blur::BOX:
+        // Three 3x3 box passes, close to a gaussian of sigma sqrt(2)
+        box_blur(buffers.blur[0].interior(padding),
+                 buffers.blur[1].interior(padding), 1, buffers.box_integral);
+        box_blur(buffers.blur[1].interior(padding),
+                 buffers.blur[0].interior(padding), 1, buffers.box_integral);
+        box_blur(buffers.blur[0].interior(padding),
+                 buffers.blur[1].interior(padding), 1, buffers.box_integral);
+        buffers.blur[1].swap(buffers.blur[0]);
         break;
     default:
         break;
     }
-    buffers[0].pad_borders(padding);
+    buffers.blur[0].pad_borders(padding);
 
-    intensity_gradients(buffers[0], buffers[1], buffers[2], padding);
-    buffers[1].pad_borders(padding);
-    buffers[2].pad_borders(padding);
+    if (blur == Blur::DOG)
+    {
+        derivative_gauss_gradients(buffers.blur[0], buffers.gradient,
+                                   buffers.direction, sigma, padding, arena);
+    }
+    else
+    {
+        intensity_gradients(buffers.blur[0], buffers.gradient,
+                            buffers.direction, padding);
+    }
+    buffers.gradient.pad_borders(padding);
+    buffers.direction.pad_borders(padding);
 
-    non_maximum_suppression(buffers[1], buffers[2], buffers[0], padding);
-    buffers[0].pad_borders(padding);
+    non_maximum_suppression(buffers.gradient, buffers.direction,
+                            buffers.suppressed, padding);
+    buffers.suppressed.pad_borders(padding);
 
-    weak_strong_edges_thresholding(buffers[0], buffers[1], low_threshold_ratio,
-                                   hight_threshold_ratio, padding);
-    buffers[1].pad_borders(padding);
+    weak_strong_edges_thresholding(buffers.suppressed, buffers.state,
+                                   low_threshold_ratio, hight_threshold_ratio,
+                                   padding);
+    buffers.state.pad_borders(padding);
 
-    weak_edges_removal(buffers[1], buffers[0], padding);
-    buffers[0].pad_borders(padding);
+    weak_edges_removal(buffers.state, buffers.edges, padding);
+    buffers.edges.pad_borders(padding);
 }
 
-void thicken_edges(Matrix<float> &edges_in, Matrix<float> &angle_in,
-                   Matrix<float> &edges_out, size_t padding)
+float edge_mismatch(MatrixView<uint8_t> a, MatrixView<uint8_t> b,
+                    size_t radius)
+{
+    long rows = a.get_rows();
+    long cols = a.get_cols();
+    long r = radius;
+
+    // Whether `other` has an edge around (x, y)
+    auto near_edge = [&](MatrixView<uint8_t> &other, long x, long y) {
+        for (long i = std::max(0L, y - r); i <= std::min(rows - 1, y + r); i++)
+        {
+            const uint8_t *row = other.row(i);
+            for (long j = std::max(0L, x - r); j <= std::min(cols - 1, x + r);
+                 j++)
+            {
+                if (row[j])
+                    return true;
+            }
+        }
+        return false;
+    };
+
+    tbb::combinable<size_t> edge_count(0);
+    tbb::combinable<size_t> mismatch_count(0);
+    tbb::parallel_for(
+        tbb::blocked_range<long>(0, rows), [&](tbb::blocked_range<long> range) {
+            size_t &edges = edge_count.local();
+            size_t &mismatches = mismatch_count.local();
+            for (long y = range.begin(); y < range.end(); y++)
+            {
+                for (long x = 0; x < cols; x++)
+                {
+                    if (a.row(y)[x])
+                    {
+                        edges++;
+                        mismatches += !near_edge(b, x, y);
+                    }
+                    if (b.row(y)[x])
+                    {
+                        edges++;
+                        mismatches += !near_edge(a, x, y);
+                    }
+                }
+            }
+        });
+
+    size_t edges = edge_count.combine(std::plus<size_t>());
+    return edges ? (float)mismatch_count.combine(std::plus<size_t>()) / edges
+                 : 0;
+}
+
+void thicken_edges(Matrix<uint8_t> &edges_in, Matrix<uint8_t> &direction_in,
+                   Matrix<uint8_t> &edges_out, size_t padding)
 {
     edges_out.fill(0);
 
@@ -218,17 +357,14 @@ void thicken_edges(Matrix<float> &edges_in, Matrix<float> &angle_in,
             {
                 for (size_t j = padding; j < edges_in.get_cols() - padding; j++)
                 {
-                    float value = edges_in.get_value(j, i);
+                    uint8_t value = edges_in.get_value(j, i);
 
-                    if (value > 0.5)
+                    if (value != NONE)
                     {
-                        float angle = angle_in.get_value(j, i) * 180 / M_PI;
-
-                        if (angle < 0)
-                            angle += 180;
+                        uint8_t direction = direction_in.get_value(j, i);
 
                         // 0°
-                        if (angle < 22.5 || angle >= 157.5)
+                        if (direction == DEG_0)
                         {
                             // Simple box
                             // 1st row
@@ -259,7 +395,7 @@ void thicken_edges(Matrix<float> &edges_in, Matrix<float> &angle_in,
                             // edges_out.safe_set(j + t, i + 1, STRONG);
                         }
                         // 45°
-                        else if (angle >= 22.5 && angle < 67.5)
+                        else if (direction == DEG_45)
                         {
                             // Simple box
                             // 1st row
@@ -293,7 +429,7 @@ void thicken_edges(Matrix<float> &edges_in, Matrix<float> &angle_in,
                             // edges_out.safe_set(j + t, i + t - 1, STRONG);
                         }
                         // 90°
-                        else if (angle >= 67.5 && angle < 112.5)
+                        else if (direction == DEG_90)
                         {
                             // Simple box
                             // 1st row
@@ -324,7 +460,7 @@ void thicken_edges(Matrix<float> &edges_in, Matrix<float> &angle_in,
                             // edges_out.safe_set(j + 1, i + t, STRONG);
                         }
                         // 135°
-                        else if (angle >= 112.5 && angle < 157.5)
+                        else if (direction == DEG_135)
                         {
                             // Simple box
                             // 1st row
@@ -365,3 +501,48 @@ void thicken_edges(Matrix<float> &edges_in, Matrix<float> &angle_in,
             }
         });
 }
+
+void thicken_edges(Matrix<uint8_t> &edges_in, Matrix<uint8_t> &direction_in,
+                   Matrix<uint8_t> &edges_out, size_t padding,
+                   const std::vector<Tile> &tiles)
+{
+    long rows = edges_in.get_rows() - padding * 2;
+    long cols = edges_in.get_cols() - padding * 2;
+
+    // Gather version of the boxes above: a pixel is set when one of its
+    // neighbours is an edge whose box covers it
+    for_each_tile_row(tiles, [&](size_t y, size_t x_begin, size_t x_end) {
+        for (size_t x = x_begin; x < x_end; x++)
+        {
+            uint8_t value = edges_in.get_value(x + padding, y + padding);
+
+            for (long dy = -1; dy <= 1 && value == NONE; dy++)
+            {
+                long n_y = y + dy;
+                if (n_y < 0 || n_y >= rows)
+                    continue;
+
+                for (long dx = -1; dx <= 1; dx++)
+                {
+                    long n_x = x + dx;
+                    if (n_x < 0 || n_x >= cols
+                        || edges_in.get_value(n_x + padding, n_y + padding)
+                            == NONE)
+                        continue;
+
+                    // 45° and 135° boxes miss two opposite corners
+                    uint8_t direction =
+                        direction_in.get_value(n_x + padding, n_y + padding);
+                    if ((direction == DEG_45 && dx * dy == -1)
+                        || (direction == DEG_135 && dx * dy == 1))
+                        continue;
+
+                    value = STRONG;
+                    break;
+                }
+            }
+
+            edges_out.set_value(x + padding, y + padding, value);
+        }
+    });
+}
@@ -0,0 +1,590 @@
+#include "canny_streaming.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <tbb/combinable.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+
+#include "filters.hh"
+#include "utils.hh"
+
+/*
+ * Blur::GAUSS in edge_detection blurs the rows twice and the columns once
+ * (the second gaussian_blur runs on the horizontal pass of the first one),
+ * the stages below reproduce the same output
+ */
+enum Stage
+{
+    STAGE_HBLUR, // both horizontal gaussian passes
+    STAGE_BLUR, // vertical gaussian pass
+    STAGE_GRADIENT,
+    STAGE_NMS, // non maximum suppression and thresholding
+    STAGE_HYSTERESIS,
+};
+
+// tan(22.5°) and tan(67.5°) with 13 fractional bits, see quantize_direction
+const int TAN_22_5_FIXED = 3393;
+const int TAN_67_5_FIXED = 19777;
+
+// Delay in rows between the input and the output of each stage
+const long GAUSS_LAGS[] = { 0, 2, 3, 4, 5 };
+const long NO_BLUR_LAGS[] = { 0, 0, 1, 2, 3 };
+
+/*
+ * Last rows of a stage, indexed by their row number in the frame
+ */
+template <typename T>
+class RowRing
+{
+public:
+    RowRing(size_t rows)
+        : mRows(rows)
+        , mCols(0)
+    {}
+
+    void resize(size_t cols)
+    {
+        mCols = cols;
+        mData.resize(mRows * cols);
+    }
+
+    T *row(long y)
+    {
+        return mData.data() + (size_t)y % mRows * mCols;
+    }
+
+private:
+    size_t mRows;
+    size_t mCols;
+    std::vector<T> mData;
+};
+
+/*
+ * Rows of a band, Pixel is the type of the blurred luma: float, or uint16
+ * fixed point with 4 fractional bits (see gradient_scale) for the 8 bit luma
+ */
+template <typename Pixel>
+struct StreamingRows
+{
+    StreamingRows()
+        : hblur(5)
+        , blurred(3)
+        , gradient(3)
+        , direction(3)
+        , state(3)
+    {}
+
+    void resize(size_t cols)
+    {
+        hblur.resize(cols);
+        blurred.resize(cols);
+        gradient.resize(cols);
+        direction.resize(cols);
+        state.resize(cols);
+        tmp.resize(cols);
+    }
+
+    RowRing<Pixel> hblur;
+    RowRing<Pixel> blurred;
+    RowRing<uint16_t> gradient;
+    RowRing<uint8_t> direction;
+    RowRing<uint8_t> state;
+    std::vector<Pixel> tmp;
+};
+
+void gauss_row(const float *in, float *out, long cols)
+{
+    for (long j = 0; j < std::min(2L, cols); j++)
+    {
+        float acc = 0;
+        for (long n = 0; n < 5; n++)
+            acc += in[mirror_index(j + n - 2, cols)] * GAUSS_1D[n];
+        out[j] = acc;
+    }
+    for (long j = 2; j < cols - 2; j++)
+    {
+        out[j] = in[j - 2] * GAUSS_1D[0] + in[j - 1] * GAUSS_1D[1]
+            + in[j] * GAUSS_1D[2] + in[j + 1] * GAUSS_1D[3]
+            + in[j + 2] * GAUSS_1D[4];
+    }
+    for (long j = std::max(2L, cols - 2); j < cols; j++)
+    {
+        float acc = 0;
+        for (long n = 0; n < 5; n++)
+            acc += in[mirror_index(j + n - 2, cols)] * GAUSS_1D[n];
+        out[j] = acc;
+    }
+}
+
+/*
+ * Fixed point horizontal passes, both keep 8 fractional bits: the first one
+ * reads the 8 bit luma (at most 255 * 256), the second one rounds away the
+ * 8 bits its taps add
+ */
+template <typename T>
+void gauss_row_fixed(const T *in, uint16_t *out, long cols, unsigned shift)
+{
+    uint32_t round = shift ? 1 << (shift - 1) : 0;
+    for (long j = 0; j < std::min(2L, cols); j++)
+    {
+        uint32_t acc = round;
+        for (long n = 0; n < 5; n++)
+            acc += in[mirror_index(j + n - 2, cols)] * GAUSS_1D_FIXED[n];
+        out[j] = acc >> shift;
+    }
+    for (long j = 2; j < cols - 2; j++)
+    {
+        uint32_t acc = round + in[j - 2] * GAUSS_1D_FIXED[0]
+            + in[j - 1] * GAUSS_1D_FIXED[1] + in[j] * GAUSS_1D_FIXED[2]
+            + in[j + 1] * GAUSS_1D_FIXED[3] + in[j + 2] * GAUSS_1D_FIXED[4];
+        out[j] = acc >> shift;
+    }
+    for (long j = std::max(2L, cols - 2); j < cols; j++)
+    {
+        uint32_t acc = round;
+        for (long n = 0; n < 5; n++)
+            acc += in[mirror_index(j + n - 2, cols)] * GAUSS_1D_FIXED[n];
+        out[j] = acc >> shift;
+    }
+}
+
+void gauss_row(const uint8_t *in, uint16_t *out, long cols)
+{
+    gauss_row_fixed(in, out, cols, 0);
+}
+
+void gauss_row(const uint16_t *in, uint16_t *out, long cols)
+{
+    gauss_row_fixed(in, out, cols, 8);
+}
+
+void gauss_column(RowRing<float> &ring, long y, long rows, float *out,
+                  long cols)
+{
+    const float *r0 = ring.row(mirror_index(y - 2, rows));
+    const float *r1 = ring.row(mirror_index(y - 1, rows));
+    const float *r2 = ring.row(y);
+    const float *r3 = ring.row(mirror_index(y + 1, rows));
+    const float *r4 = ring.row(mirror_index(y + 2, rows));
+
+    for (long j = 0; j < cols; j++)
+    {
+        out[j] = r0[j] * GAUSS_1D[0] + r1[j] * GAUSS_1D[1]
+            + r2[j] * GAUSS_1D[2] + r3[j] * GAUSS_1D[3] + r4[j] * GAUSS_1D[4];
+    }
+}
+
+// From 8 + 8 fractional bits down to the 4 of the gradient
+void gauss_column(RowRing<uint16_t> &ring, long y, long rows, uint16_t *out,
+                  long cols)
+{
+    const uint16_t *r0 = ring.row(mirror_index(y - 2, rows));
+    const uint16_t *r1 = ring.row(mirror_index(y - 1, rows));
+    const uint16_t *r2 = ring.row(y);
+    const uint16_t *r3 = ring.row(mirror_index(y + 1, rows));
+    const uint16_t *r4 = ring.row(mirror_index(y + 2, rows));
+
+    for (long j = 0; j < cols; j++)
+    {
+        uint32_t acc = (1 << 11) + r0[j] * GAUSS_1D_FIXED[0]
+            + r1[j] * GAUSS_1D_FIXED[1] + r2[j] * GAUSS_1D_FIXED[2]
+            + r3[j] * GAUSS_1D_FIXED[3] + r4[j] * GAUSS_1D_FIXED[4];
+        out[j] = acc >> 12;
+    }
+}
+
+// Without blur, the luma as the gradient stage reads it
+void unblurred_row(const float *in, float *out, long cols)
+{
+    std::copy(in, in + cols, out);
+}
+
+void unblurred_row(const uint8_t *in, uint16_t *out, long cols)
+{
+    for (long j = 0; j < cols; j++)
+        out[j] = in[j] << 4;
+}
+
+void gradient_row(const float *a, const float *b, const float *c,
+                  uint16_t *gradient_out, uint8_t *direction_out, long cols,
+                  uint16_t &max_gradient)
+{
+    for (long j = 0; j < cols; j++)
+    {
+        long l = mirror_index(j - 1, cols);
+        long r = mirror_index(j + 1, cols);
+
+        // Sobel, same accumulation order as intensity_gradients
+        float g_x = -a[l] + a[r] - 2 * b[l] + 2 * b[r] - c[l] + c[r];
+        float g_y = -a[l] - 2 * a[j] - a[r] + c[l] + 2 * c[j] + c[r];
+
+        uint16_t value = to_gradient(std::abs(g_x) + std::abs(g_y));
+        gradient_out[j] = value;
+        direction_out[j] = quantize_direction(g_x, g_y);
+        max_gradient = std::max(max_gradient, value);
+    }
+}
+
+// Sobel of 4 fractional bits values is already in gradient_scale units,
+// |g_x| + |g_y| stays below 8 * 4080
+void gradient_pixel(const uint16_t *a, const uint16_t *b, const uint16_t *c,
+                    long l, long j, long r, uint16_t &gradient_out,
+                    uint8_t &direction_out)
+{
+    int g_x = -a[l] + a[r] - 2 * b[l] + 2 * b[r] - c[l] + c[r];
+    int g_y = -a[l] - 2 * a[j] - a[r] + c[l] + 2 * c[j] + c[r];
+    int a_x = std::abs(g_x);
+    int a_y = std::abs(g_y);
+    gradient_out = a_x + a_y;
+
+    // Same sectors as quantize_direction
+    if (a_y * 8192 <= TAN_22_5_FIXED * a_x)
+        direction_out = DEG_0;
+    else if (a_y * 8192 >= TAN_67_5_FIXED * a_x)
+        direction_out = DEG_90;
+    else
+        direction_out = (g_x > 0) == (g_y > 0) ? DEG_45 : DEG_135;
+}
+
+void gradient_row(const uint16_t *a, const uint16_t *b, const uint16_t *c,
+                  uint16_t *gradient_out, uint8_t *direction_out, long cols,
+                  uint16_t &max_gradient)
+{
+    for (long j : { 0L, cols - 1 })
+    {
+        gradient_pixel(a, b, c, mirror_index(j - 1, cols), j,
+                       mirror_index(j + 1, cols), gradient_out[j],
+                       direction_out[j]);
+    }
+    // No mirroring inside, the compiler can vectorize it
+    for (long j = 1; j < cols - 1; j++)
+        gradient_pixel(a, b, c, j - 1, j, j + 1, gradient_out[j],
+                       direction_out[j]);
+
+    for (long j = 0; j < cols; j++)
+        max_gradient = std::max(max_gradient, gradient_out[j]);
+}
+
+void nms_row(RowRing<uint16_t> &gradient, RowRing<uint8_t> &direction,
+             long y, long rows, uint8_t *state_out, long cols,
+             uint16_t low_threshold, uint16_t high_threshold)
+{
+    const uint16_t *up = gradient.row(mirror_index(y - 1, rows));
+    const uint16_t *mid = gradient.row(y);
+    const uint16_t *down = gradient.row(mirror_index(y + 1, rows));
+    const uint8_t *dir = direction.row(y);
+
+    for (long j = 0; j < cols; j++)
+    {
+        long l = mirror_index(j - 1, cols);
+        long r = mirror_index(j + 1, cols);
+
+        uint16_t p = 0, q = 0;
+        switch (dir[j])
+        {
+        case DEG_0:
+            p = mid[l];
+            q = mid[r];
+            break;
+        case DEG_45:
+            p = up[l];
+            q = down[r];
+            break;
+        case DEG_90:
+            p = up[j];
+            q = down[j];
+            break;
+        default:
+            p = down[l];
+            q = up[r];
+            break;
+        }
+
+        uint16_t value = mid[j];
+        if (value < p || value < q)
+            value = 0;
+
+        if (value >= high_threshold)
+            state_out[j] = STRONG;
+        else if (value < low_threshold)
+            state_out[j] = NONE;
+        else
+            state_out[j] = WEAK;
+    }
+}
+
+void hysteresis_row(RowRing<uint8_t> &state, long y, long rows,
+                    uint8_t *edges_out, long cols, long x0, long x1)
+{
+    const uint8_t *neighbours[] = { state.row(mirror_index(y - 1, rows)),
+                                    state.row(y),
+                                    state.row(mirror_index(y + 1, rows)) };
+
+    for (long j = x0; j < x1; j++)
+    {
+        uint8_t value = neighbours[1][j];
+        if (value == WEAK)
+        {
+            value = NONE;
+            // If weak edge connected to strong edge
+            for (auto row : neighbours)
+            {
+                if (row[mirror_index(j - 1, cols)] == STRONG || row[j] == STRONG
+                    || row[mirror_index(j + 1, cols)] == STRONG)
+                {
+                    value = STRONG;
+                    break;
+                }
+            }
+        }
+        edges_out[j] = value;
+    }
+}
+
+/*
+ * Stream rows [y0, y1) through every stage up to `last_stage`, outputs are
+ * only written on columns [x0, x1)
+ */
+template <typename Input, typename Pixel>
+void stream_band(MatrixView<Input> &input, MatrixView<uint8_t> &edges_out,
+                 MatrixView<uint8_t> &direction_out, StreamingRows<Pixel> &rows,
+                 bool blur, long y0, long y1, long x0, long x1, int last_stage,
+                 uint16_t low_threshold, uint16_t high_threshold,
+                 uint16_t &max_gradient)
+{
+    long height = input.get_rows();
+    long width = input.get_cols();
+
+    const long *lags = blur ? GAUSS_LAGS : NO_BLUR_LAGS;
+    int first_stage = blur ? STAGE_HBLUR : STAGE_BLUR;
+
+    for (long s = y0 - lags[last_stage]; s < y1 + lags[last_stage]; s++)
+    {
+        for (int stage = first_stage; stage <= last_stage; stage++)
+        {
+            long y = s - lags[stage];
+            long halo = lags[last_stage] - lags[stage];
+            if (y < std::max(0L, y0 - halo) || y >= std::min(height, y1 + halo))
+                continue;
+
+            switch (stage)
+            {
+            case STAGE_HBLUR:
+                gauss_row(input.row(y), rows.tmp.data(), width);
+                gauss_row(rows.tmp.data(), rows.hblur.row(y), width);
+                break;
+            case STAGE_BLUR:
+                if (blur)
+                    gauss_column(rows.hblur, y, height, rows.blurred.row(y),
+                                 width);
+                else
+                    unblurred_row(input.row(y), rows.blurred.row(y), width);
+                break;
+            case STAGE_GRADIENT:
+                gradient_row(rows.blurred.row(mirror_index(y - 1, height)),
+                             rows.blurred.row(y),
+                             rows.blurred.row(mirror_index(y + 1, height)),
+                             rows.gradient.row(y), rows.direction.row(y), width,
+                             max_gradient);
+                break;
+            case STAGE_NMS:
+                nms_row(rows.gradient, rows.direction, y, height,
+                        rows.state.row(y), width, low_threshold,
+                        high_threshold);
+                break;
+            case STAGE_HYSTERESIS:
+            {
+                hysteresis_row(rows.state, y, height, edges_out.row(y), width,
+                               x0, x1);
+                const uint8_t *direction = rows.direction.row(y);
+                std::copy(direction + x0, direction + x1,
+                          direction_out.row(y) + x0);
+                break;
+            }
+            default:
+                break;
+            }
+        }
+    }
+}
+
+bool is_streamable(Blur blur)
+{
+    return blur == Blur::NONE || blur == Blur::GAUSS;
+}
+
+template <typename Input, typename Pixel>
+uint16_t stream_frame(MatrixView<Input> input, MatrixView<uint8_t> edges_out,
+                      MatrixView<uint8_t> direction_out, Blur blur,
+                      float low_threshold_ratio, float high_threshold_ratio,
+                      uint16_t gradient_max)
+{
+    // Ring buffers are kept across frames
+    static tbb::enumerable_thread_specific<StreamingRows<Pixel>> scratch;
+
+    bool use_blur = blur == Blur::GAUSS;
+    size_t height = input.get_rows();
+    size_t band_count =
+        (height + streaming_band_height - 1) / streaming_band_height;
+
+    auto run = [&](int last_stage, uint16_t low, uint16_t high) {
+        tbb::combinable<uint16_t> max_gradient(0);
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0, band_count, 1),
+            [&](tbb::blocked_range<size_t> r) {
+                auto &rows = scratch.local();
+                rows.resize(input.get_cols());
+                for (size_t band = r.begin(); band < r.end(); band++)
+                {
+                    long y0 = band * streaming_band_height;
+                    long y1 = std::min<long>(height,
+                                             y0 + streaming_band_height);
+                    stream_band(input, edges_out, direction_out, rows,
+                                use_blur, y0, y1, 0, input.get_cols(),
+                                last_stage, low, high, max_gradient.local());
+                }
+            });
+        return max_gradient.combine(
+            [](uint16_t a, uint16_t b) { return std::max(a, b); });
+    };
+
+    // First frame, gradient-only pass to get the thresholds
+    if (gradient_max == 0)
+        gradient_max = run(STAGE_GRADIENT, 0, 0);
+
+    uint16_t low_threshold, high_threshold;
+    hysteresis_thresholds(gradient_max, low_threshold_ratio,
+                          high_threshold_ratio, low_threshold, high_threshold);
+    return run(STAGE_HYSTERESIS, low_threshold, high_threshold);
+}
+
+template <typename Input, typename Pixel>
+void stream_tiles(MatrixView<Input> input, MatrixView<uint8_t> edges_out,
+                  MatrixView<uint8_t> direction_out,
+                  const std::vector<Tile> &tiles, Blur blur,
+                  float low_threshold_ratio, float high_threshold_ratio,
+                  uint16_t gradient_max)
+{
+    static tbb::enumerable_thread_specific<StreamingRows<Pixel>> scratch;
+
+    bool use_blur = blur == Blur::GAUSS;
+    long halo = streaming_halo;
+    long height = input.get_rows();
+    long width = input.get_cols();
+
+    uint16_t low_threshold, high_threshold;
+    hysteresis_thresholds(gradient_max, low_threshold_ratio,
+                          high_threshold_ratio, low_threshold, high_threshold);
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, tiles.size(), 1),
+        [&](tbb::blocked_range<size_t> r) {
+            auto &rows = scratch.local();
+            uint16_t max_gradient = 0;
+
+            for (size_t t = r.begin(); t < r.end(); t++)
+            {
+                const Tile &tile = tiles[t];
+
+                // Stream a window grown by the halo, borders are only mirrored
+                // where the window touches the frame borders
+                long left = std::max(0L, (long)tile.x - halo);
+                long top = std::max(0L, (long)tile.y - halo);
+                long right =
+                    std::min(width, (long)(tile.x + tile.width) + halo);
+                long bottom =
+                    std::min(height, (long)(tile.y + tile.height) + halo);
+
+                auto input_window =
+                    input.sub(left, top, bottom - top, right - left);
+                auto edges_window =
+                    edges_out.sub(left, top, bottom - top, right - left);
+                auto direction_window =
+                    direction_out.sub(left, top, bottom - top, right - left);
+
+                rows.resize(right - left);
+                long y0 = tile.y - top;
+                long x0 = tile.x - left;
+                stream_band(input_window, edges_window, direction_window, rows,
+                            use_blur, y0, y0 + tile.height, x0,
+                            x0 + tile.width, STAGE_HYSTERESIS, low_threshold,
+                            high_threshold, max_gradient);
+            }
+        });
+}
+
+uint16_t edge_detection_streaming(MatrixView<float> input,
+                                  MatrixView<uint8_t> edges_out,
+                                  MatrixView<uint8_t> direction_out, Blur blur,
+                                  float low_threshold_ratio,
+                                  float high_threshold_ratio,
+                                  uint16_t gradient_max)
+{
+    return stream_frame<float, float>(input, edges_out, direction_out, blur,
+                                      low_threshold_ratio,
+                                      high_threshold_ratio, gradient_max);
+}
+
+void edge_detection_streaming(MatrixView<float> input,
+                              MatrixView<uint8_t> edges_out,
+                              MatrixView<uint8_t> direction_out,
+                              const std::vector<Tile> &tiles, Blur blur,
+                              float low_threshold_ratio,
+                              float high_threshold_ratio,
+                              uint16_t gradient_max)
+{
+    stream_tiles<float, float>(input, edges_out, direction_out, tiles, blur,
+                               low_threshold_ratio, high_threshold_ratio,
+                               gradient_max);
+}
+
+uint16_t edge_detection_streaming(MatrixView<uint8_t> input,
+                                  MatrixView<uint8_t> edges_out,
+                                  MatrixView<uint8_t> direction_out, Blur blur,
+                                  float low_threshold_ratio,
+                                  float high_threshold_ratio,
+                                  uint16_t gradient_max)
+{
+    return stream_frame<uint8_t, uint16_t>(input, edges_out, direction_out,
+                                           blur, low_threshold_ratio,
+                                           high_threshold_ratio, gradient_max);
+}
+
+void edge_detection_streaming(MatrixView<uint8_t> input,
+                              MatrixView<uint8_t> edges_out,
+                              MatrixView<uint8_t> direction_out,
+                              const std::vector<Tile> &tiles, Blur blur,
+                              float low_threshold_ratio,
+                              float high_threshold_ratio,
+                              uint16_t gradient_max)
+{
+    stream_tiles<uint8_t, uint16_t>(input, edges_out, direction_out, tiles,
+                                    blur, low_threshold_ratio,
+                                    high_threshold_ratio, gradient_max);
+}
+
+static void quantize_luma_row(const float *in, uint8_t *out, size_t x_begin,
+                              size_t x_end)
+{
+    for (size_t x = x_begin; x < x_end; x++)
+        out[x] = std::min(255.f, std::max(0.f, in[x] + 0.5f));
+}
+
+void quantize_luma(MatrixView<float> input, MatrixView<uint8_t> output)
+{
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, input.get_rows()),
+                      [&](tbb::blocked_range<size_t> r) {
+                          for (size_t y = r.begin(); y < r.end(); y++)
+                              quantize_luma_row(input.row(y), output.row(y), 0,
+                                                input.get_cols());
+                      });
+}
+
+void quantize_luma(MatrixView<float> input, MatrixView<uint8_t> output,
+                   const std::vector<Tile> &tiles)
+{
+    for_each_tile_row(tiles, [&](size_t y, size_t x_begin, size_t x_end) {
+        quantize_luma_row(input.row(y), output.row(y), x_begin, x_end);
+    });
+}
@@ -0,0 +1,270 @@
+#include "clahe.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+
+#include "histogram.hh"
+
+/*
+ * Tile centers around `position` along an axis of `count` tiles of `size`
+ */
+void tile_neighbours(size_t position, size_t size, size_t count,
+                     size_t &first, float &second_weight)
+{
+    float t = (position + 0.5f) / size - 0.5f;
+    if (t <= 0)
+    {
+        first = 0;
+        second_weight = 0;
+    }
+    else if (t >= count - 1)
+    {
+        first = count - 1;
+        second_weight = 0;
+    }
+    else
+    {
+        first = t;
+        second_weight = t - first;
+    }
+}
+
+Clahe::Clahe(size_t width, size_t height, size_t tiles_x, size_t tiles_y,
+             float clip_limit)
+    : mWidth(width)
+    , mHeight(height)
+    , mTilesX(tiles_x)
+    , mTilesY(tiles_y)
+    , mClipLimit(clip_limit)
+    , mRatios(tiles_x * tiles_y * 256)
+    , mLeft(width)
+    , mRight(width)
+    , mRightWeight(width)
+    , mSpanStart(tiles_x + 1)
+    , mTop(height)
+    , mBottom(height)
+    , mBottomWeight(height)
+{
+    size_t tile_width = (width + tiles_x - 1) / tiles_x;
+    size_t tile_height = (height + tiles_y - 1) / tiles_y;
+
+    for (size_t x = 0; x < width; x++)
+    {
+        tile_neighbours(x, tile_width, tiles_x, mLeft[x], mRightWeight[x]);
+        mRight[x] = std::min(mLeft[x] + 1, tiles_x - 1);
+    }
+    for (size_t y = 0; y < height; y++)
+    {
+        tile_neighbours(y, tile_height, tiles_y, mTop[y], mBottomWeight[y]);
+        mBottom[y] = std::min(mTop[y] + 1, tiles_y - 1);
+    }
+    for (size_t tile = 0; tile <= tiles_x; tile++)
+    {
+        mSpanStart[tile] =
+            std::lower_bound(mLeft.begin(), mLeft.end(), tile) - mLeft.begin();
+    }
+}
+
+float Clahe::get_clip_limit()
+{
+    return mClipLimit;
+}
+
+void Clahe::set_clip_limit(float clip_limit)
+{
+    mClipLimit = clip_limit;
+}
+
+void Clahe::compute(const unsigned char *raw_buffer)
+{
+    static tbb::enumerable_thread_specific<std::vector<uint8_t>> row_values;
+
+    size_t tile_width = (mWidth + mTilesX - 1) / mTilesX;
+    size_t tile_height = (mHeight + mTilesY - 1) / mTilesY;
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, mTilesX * mTilesY, 1),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t tile = r.begin(); tile < r.end(); tile++)
+            {
+                size_t x0 = tile % mTilesX * tile_width;
+                size_t y0 = tile / mTilesX * tile_height;
+                size_t x1 = std::min(x0 + tile_width, mWidth);
+                size_t y1 = std::min(y0 + tile_height, mHeight);
+
+                auto &values = row_values.local();
+                values.resize(tile_width);
+
+                size_t histo[256] = {};
+                for (size_t y = y0; y < y1; y++)
+                {
+                    max_channel_row(raw_buffer + (y * mWidth + x0) * 4,
+                                    values.data(), x1 - x0);
+                    for (size_t x = 0; x < x1 - x0; x++)
+                        histo[values[x]]++;
+                }
+
+                // Clip, then spread the excess evenly over every bin
+                size_t pixels = (x1 - x0) * (y1 - y0);
+                size_t limit =
+                    std::max<size_t>(1, mClipLimit * pixels / 256);
+                size_t excess = 0;
+                for (auto &bin : histo)
+                {
+                    if (bin > limit)
+                    {
+                        excess += bin - limit;
+                        bin = limit;
+                    }
+                }
+                for (size_t i = 0; i < 256; i++)
+                    histo[i] += excess / 256 + (i < excess % 256);
+
+                // Divided by V here, the blend of the tables is the ratio
+                float *ratios = mRatios.data() + tile * 256;
+                size_t cumul = histo[0];
+                ratios[0] = 0;
+                for (size_t i = 1; i < 256; i++)
+                {
+                    cumul += histo[i];
+                    ratios[i] = 255.f * cumul / pixels / i;
+                }
+            }
+        });
+}
+
+/*
+ * Per thread scratch of a row
+ */
+struct ClaheRow
+{
+    // Tables of the tiles blended between the two rows of tiles of the row
+    std::vector<float> ratios;
+    std::vector<uint8_t> values;
+};
+
+/*
+ * left[v] + (right[v] - left[v]) * weight for every pixel of a span, `ratios`
+ * never overlaps the tables so the lookups are vectorized as gathers
+ */
+static void blend_span(const float *left, const float *right,
+                       const uint8_t *values, const float *right_weights,
+                       float *__restrict ratios, size_t x_begin, size_t x_end)
+{
+    for (size_t x = x_begin; x < x_end; x++)
+    {
+        float value = left[values[x]];
+        ratios[x] = value + (right[values[x]] - value) * right_weights[x];
+    }
+}
+
+void Clahe::row_ratios(const unsigned char *row, size_t y, size_t x_begin,
+                       size_t x_end, float *ratios)
+{
+    static tbb::enumerable_thread_specific<ClaheRow> scratch;
+
+    auto &local = scratch.local();
+    local.ratios.resize(mTilesX * 256);
+    local.values.resize(mWidth);
+    float *row_ratios = local.ratios.data();
+    uint8_t *values = local.values.data();
+
+    // Vertical blend once for the whole row, over the tiles the pixels read
+    size_t first = mLeft[x_begin];
+    size_t last = mLeft[x_end - 1];
+    const float *top = mRatios.data() + mTop[y] * mTilesX * 256;
+    const float *bottom = mRatios.data() + mBottom[y] * mTilesX * 256;
+    float bottom_weight = mBottomWeight[y];
+    for (size_t i = first * 256; i < (mRight[x_end - 1] + 1) * 256; i++)
+        row_ratios[i] = top[i] + (bottom[i] - top[i]) * bottom_weight;
+
+    max_channel_row(row + x_begin * 4, values + x_begin, x_end - x_begin);
+
+    // Horizontal blend, the two tables are the same over the span of
+    // columns between two tile centers
+    for (size_t tile = first; tile <= last; tile++)
+    {
+        size_t span_begin = std::max(x_begin, mSpanStart[tile]);
+        size_t span_end = std::min(x_end, mSpanStart[tile + 1]);
+        if (span_begin >= span_end)
+            continue;
+
+        blend_span(row_ratios + tile * 256,
+                   row_ratios + mRight[span_begin] * 256, values,
+                   mRightWeight.data(), ratios, span_begin, span_end);
+    }
+}
+
+void Clahe::apply_row(unsigned char *raw_buffer, size_t y, size_t x_begin,
+                      size_t x_end)
+{
+    static tbb::enumerable_thread_specific<std::vector<float>> row_scales;
+
+    auto &scales = row_scales.local();
+    scales.resize(mWidth);
+    unsigned char *row = raw_buffer + y * mWidth * 4;
+    row_ratios(row, y, x_begin, x_end, scales.data());
+
+    for (size_t x = x_begin; x < x_end; x++)
+    {
+        unsigned char *p = row + x * 4;
+        float scale = scales[x];
+
+        // Channels <= v, the result stays in range
+        p[0] = p[0] * scale + 0.5f;
+        p[1] = p[1] * scale + 0.5f;
+        p[2] = p[2] * scale + 0.5f;
+    }
+}
+
+void Clahe::grayscale_row(const unsigned char *raw_buffer, float *output,
+                          size_t y, size_t x_begin, size_t x_end)
+{
+    const unsigned char *row = raw_buffer + y * mWidth * 4;
+    row_ratios(row, y, x_begin, x_end, output);
+
+    for (size_t x = x_begin; x < x_end; x++)
+    {
+        const unsigned char *p = row + x * 4;
+        float luma = p[0] * 0.299f + p[1] * 0.587f + p[2] * 0.114f;
+        output[x] *= luma;
+    }
+}
+
+void Clahe::apply(unsigned char *raw_buffer)
+{
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, mHeight),
+                      [&](tbb::blocked_range<size_t> r) {
+                          for (size_t y = r.begin(); y < r.end(); y++)
+                              apply_row(raw_buffer, y, 0, mWidth);
+                      });
+}
+
+void Clahe::apply(unsigned char *raw_buffer, const std::vector<Tile> &tiles)
+{
+    for_each_tile_row(tiles, [&](size_t y, size_t x_begin, size_t x_end) {
+        apply_row(raw_buffer, y, x_begin, x_end);
+    });
+}
+
+void Clahe::apply_grayscale(const unsigned char *raw_buffer,
+                            MatrixView<float> output)
+{
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, mHeight),
+                      [&](tbb::blocked_range<size_t> r) {
+                          for (size_t y = r.begin(); y < r.end(); y++)
+                              grayscale_row(raw_buffer, output.row(y), y, 0,
+                                            mWidth);
+                      });
+}
+
+void Clahe::apply_grayscale(const unsigned char *raw_buffer,
+                            MatrixView<float> output,
+                            const std::vector<Tile> &tiles)
+{
+    for_each_tile_row(tiles, [&](size_t y, size_t x_begin, size_t x_end) {
+        grayscale_row(raw_buffer, output.row(y), y, x_begin, x_end);
+    });
+}
@@ -0,0 +1,207 @@
+#include "effect.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include "canny_streaming.hh"
+#include "effects.hh"
+
+void EffectFrame::allocate(unsigned planes)
+{
+    if (!(planes & (PLANE_LUMA | PLANE_EDGES)) || edges)
+        return;
+
+    edges = std::make_unique<EdgeBuffers>(screen_height, screen_width,
+                                          edge_padding);
+    pyramid = std::make_unique<PyramidEdgeDetector>(
+        screen_height, screen_width, PYRAMID_LEVELS);
+    luma8 = std::make_unique<Matrix<uint8_t>>(
+        Matrix<uint8_t>::make_aligned(screen_height, screen_width));
+}
+
+MatrixView<float> EffectFrame::get_luma()
+{
+    // The pyramid has its own full resolution level
+    return pyramid->get_level() > 0 && !region
+        ? pyramid->get_pyramid().get_level(0).view()
+        : edges->blur[0].interior(edge_padding);
+}
+
+bool EffectFrame::uses_luma8(const FrameSettings &settings)
+{
+    return settings.integer_canny && is_streamable(settings.blur)
+        && (pyramid->get_level() == 0 || region);
+}
+
+bool Effect::supports_tiles(const FrameSettings &) const
+{
+    return true;
+}
+
+bool Effect::needs_rgba(const EffectFrame &, const FrameSettings &) const
+{
+    return get_inputs() & PLANE_RGBA;
+}
+
+bool Effect::overwrites_rgba(const FrameSettings &) const
+{
+    return false;
+}
+
+std::vector<std::string> Effect::get_parameters() const
+{
+    return {};
+}
+
+bool Effect::set_parameter(FrameSettings &, const std::string &,
+                           const std::string &)
+{
+    return false;
+}
+
+static std::map<std::string, EffectFactory> &get_registry()
+{
+    static std::map<std::string, EffectFactory> registry = {
+        { "luma", [] { return std::make_unique<LumaEffect>(); } },
+        { "canny", [] { return std::make_unique<CannyEffect>(); } },
+        { "thicken", [] { return std::make_unique<ThickenEffect>(); } },
+        { "colors", [] { return std::make_unique<ColorsEffect>(); } },
+        { "borders", [] { return std::make_unique<BordersEffect>(); } },
+        { "pixelate", [] { return std::make_unique<PixelateEffect>(); } },
+    };
+    return registry;
+}
+
+void register_effect(const std::string &name, EffectFactory factory)
+{
+    get_registry()[name] = factory;
+}
+
+std::vector<std::string> get_effect_names()
+{
+    std::vector<std::string> names;
+    for (auto &entry : get_registry())
+        names.push_back(entry.first);
+    return names;
+}
+
+std::unique_ptr<Effect> make_effect(const std::string &name)
+{
+    auto &registry = get_registry();
+    auto it = registry.find(name);
+    return it == registry.end() ? nullptr : it->second();
+}
+
+EffectChain default_effect_chain()
+{
+    EffectChain chain;
+    for (auto name :
+         { "luma", "canny", "thicken", "colors", "borders", "pixelate" })
+        chain.push_back(make_effect(name));
+    return chain;
+}
+
+static std::string join(const std::vector<std::string> &names)
+{
+    std::string joined;
+    for (auto &name : names)
+        joined += (joined.empty() ? "" : ", ") + name;
+    return joined;
+}
+
+EffectChain load_effect_chain(const std::string &path,
+                              FrameSettings &settings)
+{
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error(path + ": cannot open effect chain");
+
+    EffectChain chain;
+    std::string line;
+    for (size_t line_number = 1; std::getline(file, line); line_number++)
+    {
+        auto location = path + ":" + std::to_string(line_number) + ": ";
+
+        line = line.substr(0, line.find('#'));
+        std::istringstream tokens(line);
+        std::string name;
+        if (!(tokens >> name))
+            continue;
+
+        auto effect = make_effect(name);
+        if (!effect)
+        {
+            throw std::runtime_error(location + "unknown stage '" + name
+                                     + "', expected one of "
+                                     + join(get_effect_names()));
+        }
+
+        std::string parameter;
+        while (tokens >> parameter)
+        {
+            auto equal = parameter.find('=');
+            auto key = parameter.substr(0, equal);
+            auto value =
+                equal == std::string::npos ? "" : parameter.substr(equal + 1);
+
+            if (!effect->set_parameter(settings, key, value))
+            {
+                throw std::runtime_error(location + "invalid parameter '"
+                                         + parameter + "' of " + name
+                                         + ", expected one of "
+                                         + join(effect->get_parameters()));
+            }
+        }
+
+        chain.push_back(std::move(effect));
+    }
+
+    return chain;
+}
+
+std::vector<std::vector<size_t>> effect_dependencies(const EffectChain &chain)
+{
+    const unsigned planes[] = { PLANE_RGBA, PLANE_LUMA, PLANE_EDGES };
+
+    std::vector<std::vector<size_t>> dependencies(chain.size());
+    std::map<unsigned, size_t> last_writer;
+    std::map<unsigned, std::vector<size_t>> readers;
+
+    for (size_t i = 0; i < chain.size(); i++)
+    {
+        unsigned inputs = chain[i]->get_inputs();
+        unsigned outputs = chain[i]->get_outputs();
+        auto &deps = dependencies[i];
+
+        for (auto plane : planes)
+        {
+            if ((inputs | outputs) & plane && last_writer.count(plane))
+                deps.push_back(last_writer[plane]);
+            // Readers before this write
+            if (outputs & plane)
+                deps.insert(deps.end(), readers[plane].begin(),
+                            readers[plane].end());
+        }
+
+        for (auto plane : planes)
+        {
+            if (outputs & plane)
+            {
+                last_writer[plane] = i;
+                readers[plane].clear();
+            }
+            else if (inputs & plane)
+            {
+                readers[plane].push_back(i);
+            }
+        }
+
+        std::sort(deps.begin(), deps.end());
+        deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+    }
+
+    return dependencies;
+}
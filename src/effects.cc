@@ -0,0 +1,619 @@
+#include "effects.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <type_traits>
+
+#include "canny_streaming.hh"
+
+/*
+ * Parameter values
+ */
+static bool parse_value(const std::string &value, bool &out)
+{
+    if (value == "on" || value == "true" || value == "1")
+        out = true;
+    else if (value == "off" || value == "false" || value == "0")
+        out = false;
+    else
+        return false;
+    return true;
+}
+
+template <typename T>
+static bool parse_value(const std::string &value, T &out)
+{
+    // Streams wrap negative values around for unsigned types
+    if (std::is_unsigned_v<T> && value.find('-') != std::string::npos)
+        return false;
+
+    std::istringstream stream(value);
+    T parsed;
+    if (!(stream >> parsed) || !stream.eof())
+        return false;
+    out = parsed;
+    return true;
+}
+
+// Case insensitive match against the operator<< names of an enum
+template <typename Enum>
+static bool parse_enum(const std::string &value, Enum &out)
+{
+    Enum e{};
+    do
+    {
+        std::ostringstream name;
+        name << e;
+        auto expected = name.str();
+        if (expected.size() == value.size()
+            && std::equal(expected.begin(), expected.end(), value.begin(),
+                          [](char a, char b) {
+                              return std::tolower(a) == std::tolower(b);
+                          }))
+        {
+            out = e;
+            return true;
+        }
+    } while (++e != Enum{});
+    return false;
+}
+
+/*
+ * Luma
+ */
+LumaEffect::LumaEffect()
+    : mClahe(screen_width, screen_height, CLAHE_TILES, CLAHE_TILES,
+             CLAHE_CLIP_LIMIT)
+{
+    luma_lut(mLut);
+}
+
+const char *LumaEffect::get_name() const
+{
+    return "luma";
+}
+
+unsigned LumaEffect::get_inputs() const
+{
+    return PLANE_RGBA;
+}
+
+unsigned LumaEffect::get_outputs() const
+{
+    return PLANE_LUMA;
+}
+
+size_t LumaEffect::get_radius(const FrameSettings &) const
+{
+    return 0;
+}
+
+std::vector<std::string> LumaEffect::get_parameters() const
+{
+    return { "contrast", "adaptive" };
+}
+
+bool LumaEffect::set_parameter(FrameSettings &settings,
+                               const std::string &name,
+                               const std::string &value)
+{
+    if (name == "contrast")
+        return parse_value(value, settings.edge_contrast_correction);
+    if (name == "adaptive")
+        return parse_value(value, settings.adaptive_contrast);
+    return false;
+}
+
+bool LumaEffect::needs_rgba(const EffectFrame &frame,
+                            const FrameSettings &settings) const
+{
+    return !frame.yuv
+        || (settings.edge_contrast_correction && settings.adaptive_contrast);
+}
+
+bool LumaEffect::is_enabled(const FrameSettings &settings) const
+{
+    return settings.dark_borders || settings.edges_only;
+}
+
+void LumaEffect::apply(EffectFrame &frame, const FrameSettings &settings)
+{
+    // The frame is never converted: the contrast correction goes straight
+    // into the luma
+    auto luma = frame.get_luma();
+    auto *raw = frame.raw;
+    auto *region = frame.region;
+
+    if (!needs_rgba(frame, settings))
+    {
+        if (!settings.edge_contrast_correction)
+            luma_lut(mLut);
+        else if (!region)
+            equalized_luma_lut(frame.yuv, mLut, mHistogram);
+
+        if (frame.uses_luma8(settings))
+        {
+            // Rounded once in the table, the Y plane goes straight to 8 bits
+            for (size_t i = 0; i < 256; i++)
+                mLut8[i] = std::min(255.f, std::max(0.f, mLut[i] + 0.5f));
+            if (region)
+                y_to_luma(frame.yuv, mLut8, frame.luma8->view(), *region);
+            else
+                y_to_luma(frame.yuv, mLut8, frame.luma8->view());
+        }
+        else if (region)
+            y_to_luma(frame.yuv, mLut, luma, *region);
+        else
+            y_to_luma(frame.yuv, mLut, luma);
+        return;
+    }
+
+    if (settings.edge_contrast_correction && !region)
+    {
+        if (settings.adaptive_contrast)
+            mClahe.compute(raw);
+        else
+            compute_lightness_cumul_histogram(raw, mHistogram, mHisto);
+    }
+
+    if (!settings.edge_contrast_correction && region)
+        to_grayscale(raw, luma, *region);
+    else if (!settings.edge_contrast_correction)
+        to_grayscale(raw, luma);
+    else if (settings.adaptive_contrast && region)
+        mClahe.apply_grayscale(raw, luma, *region);
+    else if (settings.adaptive_contrast)
+        mClahe.apply_grayscale(raw, luma);
+    else if (region)
+        to_equalized_grayscale(raw, mHisto, luma, *region);
+    else
+        to_equalized_grayscale(raw, mHisto, luma);
+
+    if (frame.uses_luma8(settings) && region)
+        quantize_luma(luma, frame.luma8->view(), *region);
+    else if (frame.uses_luma8(settings))
+        quantize_luma(luma, frame.luma8->view());
+}
+
+/*
+ * Canny
+ */
+CannyEffect::CannyEffect()
+    : mGradientMax(0)
+{}
+
+const char *CannyEffect::get_name() const
+{
+    return "canny";
+}
+
+unsigned CannyEffect::get_inputs() const
+{
+    return PLANE_LUMA;
+}
+
+unsigned CannyEffect::get_outputs() const
+{
+    return PLANE_EDGES;
+}
+
+size_t CannyEffect::get_radius(const FrameSettings &) const
+{
+    return streaming_halo;
+}
+
+bool CannyEffect::supports_tiles(const FrameSettings &settings) const
+{
+    // Frame-wide filters: pyramid, median and bilateral blurs
+    return is_streamable(settings.blur) && settings.pyramid_level == 0;
+}
+
+std::vector<std::string> CannyEffect::get_parameters() const
+{
+    return { "blur", "sigma", "low", "high", "level", "refine", "integer" };
+}
+
+bool CannyEffect::set_parameter(FrameSettings &settings,
+                                const std::string &name,
+                                const std::string &value)
+{
+    if (name == "blur")
+        return parse_enum(value, settings.blur);
+    if (name == "sigma")
+    {
+        return parse_value(value, settings.gradient_sigma)
+            && settings.gradient_sigma > 0;
+    }
+    if (name == "low")
+    {
+        return parse_value(value, settings.low_threshold_ratio)
+            && settings.low_threshold_ratio >= 0
+            && settings.low_threshold_ratio <= 1;
+    }
+    if (name == "high")
+    {
+        return parse_value(value, settings.high_threshold_ratio)
+            && settings.high_threshold_ratio >= 0
+            && settings.high_threshold_ratio <= 1;
+    }
+    if (name == "level")
+    {
+        return parse_value(value, settings.pyramid_level)
+            && settings.pyramid_level < PYRAMID_LEVELS;
+    }
+    if (name == "refine")
+        return parse_value(value, settings.refine_edges);
+    if (name == "integer")
+        return parse_value(value, settings.integer_canny);
+    return false;
+}
+
+bool CannyEffect::is_enabled(const FrameSettings &settings) const
+{
+    return settings.dark_borders || settings.edges_only;
+}
+
+void CannyEffect::apply(EffectFrame &frame, const FrameSettings &settings)
+{
+    auto &buffers = *frame.edges;
+    auto edges = buffers.edges.interior(edge_padding);
+    auto direction = buffers.direction.interior(edge_padding);
+    float low = settings.low_threshold_ratio;
+    float high = settings.high_threshold_ratio;
+
+    if (frame.uses_luma8(settings) && frame.region)
+    {
+        edge_detection_streaming(frame.luma8->view(), edges, direction,
+                                 *frame.region, settings.blur, low, high,
+                                 mGradientMax);
+    }
+    else if (frame.uses_luma8(settings))
+    {
+        // Same gradient units as the float Canny, mGradientMax carries over
+        mGradientMax = edge_detection_streaming(frame.luma8->view(), edges,
+                                                direction, settings.blur, low,
+                                                high, mGradientMax);
+    }
+    else if (frame.region)
+    {
+        // Luma and edges of the clean tiles are still valid
+        edge_detection_streaming(frame.get_luma(), edges, direction,
+                                 *frame.region, settings.blur, low, high,
+                                 mGradientMax);
+    }
+    else if (frame.pyramid->get_level() > 0)
+    {
+        frame.pyramid->detect(edges, direction, settings.blur, low, high);
+    }
+    else if (is_streamable(settings.blur))
+    {
+        mGradientMax = edge_detection_streaming(frame.get_luma(), edges,
+                                                direction, settings.blur, low,
+                                                high, mGradientMax);
+    }
+    else
+    {
+        buffers.blur[0].pad_borders(edge_padding);
+        edge_detection(buffers, settings.blur, settings.gradient_sigma, low,
+                       high, frame.arena);
+    }
+    // remap_to_rgb(canny_edge_buffers[0]);
+}
+
+/*
+ * Edge thickening
+ */
+const char *ThickenEffect::get_name() const
+{
+    return "thicken";
+}
+
+unsigned ThickenEffect::get_inputs() const
+{
+    return PLANE_EDGES;
+}
+
+unsigned ThickenEffect::get_outputs() const
+{
+    return PLANE_EDGES;
+}
+
+size_t ThickenEffect::get_radius(const FrameSettings &) const
+{
+    return 1;
+}
+
+std::vector<std::string> ThickenEffect::get_parameters() const
+{
+    return { "enabled" };
+}
+
+bool ThickenEffect::set_parameter(FrameSettings &settings,
+                                  const std::string &name,
+                                  const std::string &value)
+{
+    if (name == "enabled")
+        return parse_value(value, settings.border_dilation);
+    return false;
+}
+
+bool ThickenEffect::is_enabled(const FrameSettings &settings) const
+{
+    return settings.border_dilation
+        && (settings.dark_borders || settings.edges_only);
+}
+
+void ThickenEffect::apply(EffectFrame &frame, const FrameSettings &)
+{
+    auto &buffers = *frame.edges;
+
+    if (frame.region)
+    {
+        thicken_edges(buffers.edges, buffers.direction, buffers.thick_edges,
+                      edge_padding, *frame.region);
+    }
+    else
+    {
+        thicken_edges(buffers.edges, buffers.direction, buffers.thick_edges,
+                      edge_padding);
+    }
+}
+
+/*
+ * Colors
+ */
+ColorsEffect::ColorsEffect()
+    : mClahe(screen_width, screen_height, CLAHE_TILES, CLAHE_TILES,
+             CLAHE_CLIP_LIMIT)
+{}
+
+const char *ColorsEffect::get_name() const
+{
+    return "colors";
+}
+
+unsigned ColorsEffect::get_inputs() const
+{
+    return PLANE_RGBA;
+}
+
+unsigned ColorsEffect::get_outputs() const
+{
+    return PLANE_RGBA;
+}
+
+size_t ColorsEffect::get_radius(const FrameSettings &) const
+{
+    return 0;
+}
+
+std::vector<std::string> ColorsEffect::get_parameters() const
+{
+    return { "enabled", "palette", "library", "contrast", "adaptive",
+             "saturation", "boost" };
+}
+
+bool ColorsEffect::set_parameter(FrameSettings &settings,
+                                 const std::string &name,
+                                 const std::string &value)
+{
+    if (name == "enabled")
+        return parse_value(value, settings.color_quantization);
+    if (name == "palette")
+    {
+        return parse_value(value, settings.palette_size)
+            && settings.palette_size > 0
+            && settings.palette_size <= PALETTE_MAX_COLORS;
+    }
+    if (name == "library")
+    {
+        return parse_value(value, settings.library_palette)
+            && settings.library_palette >= -1;
+    }
+    if (name == "contrast")
+        return parse_value(value, settings.color_contrast_correction);
+    if (name == "adaptive")
+        return parse_value(value, settings.adaptive_contrast);
+    if (name == "saturation")
+        return parse_value(value, settings.saturation_value);
+    if (name == "boost")
+        return parse_value(value, settings.saturation_boost);
+    return false;
+}
+
+bool ColorsEffect::is_enabled(const FrameSettings &settings) const
+{
+    return settings.color_quantization;
+}
+
+void ColorsEffect::apply(EffectFrame &frame, const FrameSettings &settings)
+{
+    auto *rgba = frame.rgba;
+
+    if (frame.region)
+    {
+        auto &region = *frame.region;
+        apply_palette(rgba, *frame.palette, region);
+
+        if (settings.color_contrast_correction && settings.adaptive_contrast)
+            mClahe.apply(rgba, region);
+        else if (settings.color_contrast_correction) // From palette
+            contrast_correction(rgba, frame.palette_histo, region);
+
+        if (settings.saturation_boost)
+            saturation_modification(rgba, settings.saturation_value, region);
+        return;
+    }
+
+    apply_palette(rgba, *frame.palette, settings.palette_step);
+
+    if (settings.color_contrast_correction && settings.adaptive_contrast)
+    {
+        mClahe.compute(rgba);
+        mClahe.apply(rgba);
+    }
+    else if (settings.color_contrast_correction) // From palette
+    {
+        contrast_correction(rgba, frame.palette_histo);
+    }
+
+    if (settings.saturation_boost)
+        saturation_modification(rgba, settings.saturation_value);
+
+    //  apply_palette_debug(raw_buffer, *frame.palette, screen_width / 2);
+}
+
+/*
+ * Borders
+ */
+BordersEffect::BordersEffect()
+    : mMask(screen_height, screen_width)
+{}
+
+const char *BordersEffect::get_name() const
+{
+    return "borders";
+}
+
+unsigned BordersEffect::get_inputs() const
+{
+    return PLANE_RGBA | PLANE_EDGES;
+}
+
+unsigned BordersEffect::get_outputs() const
+{
+    return PLANE_RGBA;
+}
+
+size_t BordersEffect::get_radius(const FrameSettings &) const
+{
+    return 0;
+}
+
+std::vector<std::string> BordersEffect::get_parameters() const
+{
+    return { "mode" };
+}
+
+bool BordersEffect::set_parameter(FrameSettings &settings,
+                                  const std::string &name,
+                                  const std::string &value)
+{
+    if (name != "mode")
+        return false;
+
+    if (value != "off" && value != "dark" && value != "edges")
+        return false;
+    settings.dark_borders = value == "dark";
+    settings.edges_only = value == "edges";
+    return true;
+}
+
+bool BordersEffect::needs_rgba(const EffectFrame &,
+                               const FrameSettings &settings) const
+{
+    return settings.dark_borders;
+}
+
+bool BordersEffect::overwrites_rgba(const FrameSettings &settings) const
+{
+    return !settings.dark_borders;
+}
+
+bool BordersEffect::is_enabled(const FrameSettings &settings) const
+{
+    return settings.dark_borders || settings.edges_only;
+}
+
+void BordersEffect::apply(EffectFrame &frame, const FrameSettings &settings)
+{
+    auto *rgba = frame.rgba;
+    auto *region = frame.region;
+
+    auto &edges = settings.border_dilation ? frame.edges->thick_edges
+                                           : frame.edges->edges;
+    auto interior = edges.interior(edge_padding);
+
+    if (settings.dark_borders && region)
+    {
+        set_dark_borders(rgba, interior, *region);
+    }
+    else if (settings.dark_borders)
+    {
+        mMask.pack(interior);
+        set_dark_borders(rgba, mMask);
+    }
+    else if (region)
+    {
+        fill_buffer(rgba, interior, *region);
+    }
+    else
+    {
+        fill_buffer(rgba, interior);
+    }
+}
+
+/*
+ * Pixelation
+ */
+const char *PixelateEffect::get_name() const
+{
+    return "pixelate";
+}
+
+unsigned PixelateEffect::get_inputs() const
+{
+    return PLANE_RGBA;
+}
+
+unsigned PixelateEffect::get_outputs() const
+{
+    return PLANE_RGBA;
+}
+
+size_t PixelateEffect::get_radius(const FrameSettings &settings) const
+{
+    return settings.pixel_size;
+}
+
+bool PixelateEffect::supports_tiles(const FrameSettings &) const
+{
+    return false;
+}
+
+std::vector<std::string> PixelateEffect::get_parameters() const
+{
+    return { "enabled", "shape", "size" };
+}
+
+bool PixelateEffect::set_parameter(FrameSettings &settings,
+                                   const std::string &name,
+                                   const std::string &value)
+{
+    if (name == "enabled")
+        return parse_value(value, settings.pixelate);
+    if (name == "shape")
+        return parse_enum(value, settings.pixel_shape);
+    if (name == "size")
+    {
+        return parse_value(value, settings.pixel_size)
+            && settings.pixel_size > 0
+            && settings.pixel_size <= PIXELATE_MAX_SIZE;
+    }
+    return false;
+}
+
+bool PixelateEffect::is_enabled(const FrameSettings &settings) const
+{
+    return settings.pixelate;
+}
+
+void PixelateEffect::apply(EffectFrame &frame, const FrameSettings &settings)
+{
+    if (!mBuffers)
+        mBuffers =
+            std::make_unique<PixelateBuffers>(screen_height, screen_width);
+    pixelate_buffer(frame.rgba, *mBuffers, settings.pixel_shape,
+                    settings.pixel_size);
+}
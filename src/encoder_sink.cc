@@ -0,0 +1,115 @@
+#include "encoder_sink.hh"
+
+#include <chrono>
+#include <csignal>
+#include <cstring>
+
+#include "buffer_utils.hh"
+
+EncoderSink::EncoderSink(const std::string &output, size_t buffer_count)
+    : mBuffers(std::max<size_t>(buffer_count, 1))
+    , mFramesWritten(0)
+    , mBlockedMs(0)
+    , mFailed(false)
+{
+    // A dead encoder must fail the writes, not kill the process
+    std::signal(SIGPIPE, SIG_IGN);
+
+    auto command = std::string("ffmpeg -loglevel error -y "
+                               "-f rawvideo "
+                               "-pix_fmt rgba -r 30 "
+                               "-s 1280x720 -i - ");
+    command.append(output);
+    mPipe = popen(command.c_str(), "w");
+    if (!mPipe)
+        return;
+
+    for (auto &buffer : mBuffers)
+    {
+        buffer.resize(screen_width * screen_height * 4);
+        mFreeBuffers.push(buffer.data());
+    }
+
+    mThread = std::thread(&EncoderSink::run, this);
+}
+
+EncoderSink::~EncoderSink()
+{
+    close();
+}
+
+bool EncoderSink::is_open()
+{
+    return mPipe != nullptr;
+}
+
+void EncoderSink::write(const unsigned char *raw_buffer)
+{
+    if (!mThread.joinable())
+        return;
+
+    unsigned char *buffer = nullptr;
+    if (!mFreeBuffers.try_pop(buffer))
+    {
+        // Backpressure, wait for the encoder
+        auto start = std::chrono::steady_clock::now();
+        mFreeBuffers.pop(buffer);
+        mBlockedMs = mBlockedMs
+            + std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    }
+
+    std::memcpy(buffer, raw_buffer, screen_width * screen_height * 4);
+    mPendingBuffers.push(buffer);
+}
+
+void EncoderSink::close()
+{
+    if (!mThread.joinable())
+        return;
+
+    mPendingBuffers.push(nullptr);
+    mThread.join();
+
+    fflush(mPipe);
+    pclose(mPipe);
+}
+
+size_t EncoderSink::get_frames_written()
+{
+    return mFramesWritten;
+}
+
+size_t EncoderSink::get_queue_depth()
+{
+    return std::max<std::ptrdiff_t>(mPendingBuffers.size(), 0);
+}
+
+double EncoderSink::get_blocked_ms()
+{
+    return mBlockedMs;
+}
+
+bool EncoderSink::has_failed()
+{
+    return mFailed;
+}
+
+void EncoderSink::run()
+{
+    const size_t size = screen_width * screen_height * 4;
+
+    unsigned char *buffer = nullptr;
+    while (mPendingBuffers.pop(buffer), buffer)
+    {
+        // Keep recycling the buffers after a failure, write() never blocks
+        // forever
+        if (!mFailed && fwrite(buffer, 1, size, mPipe) != size)
+            mFailed = true;
+        else if (!mFailed)
+            mFramesWritten++;
+
+        mFreeBuffers.push(buffer);
+    }
+}
@@ -1,25 +1,43 @@
 #include "filters.hh"
 
+#include <algorithm>
 #include <iostream>
 #include <math.h>
 #include <tbb/parallel_for.h>
 
-auto GAUSS_X = Matrix<float>(
-    1, 5, { 0.02808743, 0.23430939, 0.47520637, 0.23430939, 0.02808743 });
-auto GAUSS_Y = Matrix<float>(
-    5, 1, { 0.02808743, 0.23430939, 0.47520637, 0.23430939, 0.02808743 });
-
-float cGaussian[64];
-
 void gaussian_blur(Matrix<float> &mat, Matrix<float> &tmp_buffer,
                    size_t padding)
 {
-    mat.convolve(GAUSS_X, tmp_buffer, padding);
+    convolve_rows<GAUSS_1D>(mat, tmp_buffer, padding);
     tmp_buffer.pad_borders(padding);
-    tmp_buffer.convolve(GAUSS_Y, mat, padding);
+    convolve_columns<GAUSS_1D>(tmp_buffer, mat, padding);
     mat.pad_borders(padding);
 }
 
+void box_blur(MatrixView<float> input, MatrixView<float> output,
+              size_t radius, IntegralImage<float> &integral)
+{
+    size_t rows = input.get_rows();
+    size_t cols = input.get_cols();
+    integral.build(input);
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, rows), [&](tbb::blocked_range<size_t> r) {
+            for (size_t i = r.begin(); i < r.end(); i++)
+            {
+                size_t y0 = i > radius ? i - radius : 0;
+                size_t y1 = std::min(i + radius + 1, rows);
+                float *out = output.row(i);
+                for (size_t j = 0; j < cols; j++)
+                {
+                    size_t x0 = j > radius ? j - radius : 0;
+                    size_t x1 = std::min(j + radius + 1, cols);
+                    out[j] = integral.mean(x0, y0, x1, y1);
+                }
+            }
+        });
+}
+
 float euclideanLen(RGB a, RGB b, float d)
 {
     float mod = (b.r - a.r) * (b.r - a.r) + (b.g - a.g) * (b.g - a.g)
@@ -28,28 +46,45 @@ float euclideanLen(RGB a, RGB b, float d)
     return exp(-mod / (2.f * d * d));
 }
 
-float distance(int x, int y, int i, int j)
+double gaussian(float x, double sigma)
 {
-    return float(sqrt(pow(x - i, 2) + pow(y - j, 2)));
+    return exp(-(pow(x, 2)) / (2 * pow(sigma, 2))) / (2 * M_PI * pow(sigma, 2));
 }
 
-double gaussian(float x, double sigma)
+size_t derivative_gauss_radius(float sigma)
 {
-    return exp(-(pow(x, 2)) / (2 * pow(sigma, 2))) / (2 * M_PI * pow(sigma, 2));
+    size_t radius = std::ceil(3 * sigma);
+    return std::clamp<size_t>(radius, 1, DERIVATIVE_GAUSS_MAX_RADIUS);
 }
 
-void updateGaussian(float delta, int radius)
+// g_x or g_y of derivative_gauss over the whole of `img`
+static Matrix<float> derivative_gauss(Matrix<float> &img, float sigma,
+                                      bool vertical)
 {
-    for (int i = 0; i < 2 * radius + 1; ++i)
-    {
-        float x = i - radius;
-        cGaussian[i] = expf(-(x * x) / (2 * delta * delta));
-    }
+    Matrix<float> output(img.get_rows(), img.get_cols());
+    FrameArena arena;
+    derivative_gauss(img, sigma, 0, arena,
+                     [&](size_t i, const float *g_x, const float *g_y) {
+                         std::copy(vertical ? g_y : g_x,
+                                   (vertical ? g_y : g_x) + img.get_cols(),
+                                   output.row(i));
+                     });
+    return output;
+}
+
+Matrix<float> derivative_gauss_x(Matrix<float> img, float sigma)
+{
+    return derivative_gauss(img, sigma, false);
+}
+
+Matrix<float> derivative_gauss_y(Matrix<float> img, float sigma)
+{
+    return derivative_gauss(img, sigma, true);
 }
 
 void apply_bilateral_filter(Matrix<float> &input, Matrix<float> &output,
                             size_t x, size_t y, size_t diameter, double sigmaI,
-                            double sigmaS)
+                            const Matrix<double> &spatial)
 {
     double iFiltered = 0;
     double wP = 0;
@@ -66,8 +101,7 @@ void apply_bilateral_filter(Matrix<float> &input, Matrix<float> &output,
             double gi = gaussian(input.safe_at(neighbor_x, neighbor_y)
                                      - input.safe_at(x, y),
                                  sigmaI);
-            double gs =
-                gaussian(distance(x, y, neighbor_x, neighbor_y), sigmaS);
+            double gs = spatial.get_value(i, j);
             double w = gi * gs;
             iFiltered = iFiltered + input.safe_at(neighbor_x, neighbor_y) * w;
             wP = wP + w;
@@ -78,7 +112,7 @@ void apply_bilateral_filter(Matrix<float> &input, Matrix<float> &output,
 }
 
 void apply_bilateral_filter(Matrix<RGB> &input, Matrix<RGB> &output, size_t x,
-                            size_t y, int radius)
+                            size_t y, int radius, const Matrix<float> &weights)
 {
     float sum = 0.0f;
     float factor;
@@ -90,7 +124,8 @@ void apply_bilateral_filter(Matrix<RGB> &input, Matrix<RGB> &output, size_t x,
         for (int j = -radius; j <= radius; j++)
         {
             RGB curPix = input.safe_at(x + j, y + i);
-            factor = cGaussian[i + radius] * cGaussian[j + radius]
+            factor = weights.get_value(i + radius, 0)
+                * weights.get_value(j + radius, 0)
                 * // domain factor
                 euclideanLen(curPix, center, 0.1f); // range factor
 
@@ -110,6 +145,8 @@ void bilateral_filter(Matrix<float> &input, Matrix<float> &output, int diameter,
     size_t height = input.get_rows();
 
     auto radius = diameter / 2;
+    // The distance term only depends on the offset
+    const auto &spatial = bilateral_spatial_kernel(diameter, sigmaS);
 
     tbb::parallel_for(tbb::blocked_range<size_t>(radius, height - radius),
                       [&](tbb::blocked_range<size_t> r) {
@@ -119,7 +156,7 @@ void bilateral_filter(Matrix<float> &input, Matrix<float> &output, int diameter,
                               {
                                   apply_bilateral_filter(input, output, j, i,
                                                          diameter, sigmaI,
-                                                         sigmaS);
+                                                         spatial);
                               }
                           }
                       });
@@ -131,7 +168,7 @@ void bilateral_filter(Matrix<RGB> &input, Matrix<RGB> &output, size_t radius,
     size_t width = input.get_cols();
     size_t height = input.get_rows();
 
-    updateGaussian(delta, radius);
+    const auto &weights = gaussian_weights(radius, delta);
 
     tbb::parallel_for(tbb::blocked_range<size_t>(radius, height - radius),
                       [&](tbb::blocked_range<size_t> r) {
@@ -140,7 +177,7 @@ void bilateral_filter(Matrix<RGB> &input, Matrix<RGB> &output, size_t radius,
                               for (size_t j = radius; j < width - radius; j++)
                               {
                                   apply_bilateral_filter(input, output, j, i,
-                                                         radius);
+                                                         radius, weights);
                               }
                           }
                       });
@@ -0,0 +1,44 @@
+#include "frame_arena.hh"
+
+FrameArena::FrameArena(size_t capacity)
+    : mBlock(capacity)
+    , mUsed(0)
+    , mPeak(0)
+{}
+
+void *FrameArena::allocate_bytes(size_t size)
+{
+    // Every allocation starts on its own cache line, concurrent writers
+    // never share one
+    size = (size + cache_line_size - 1) / cache_line_size * cache_line_size;
+
+    size_t offset = mUsed.fetch_add(size, std::memory_order_relaxed);
+    if (offset + size <= mBlock.size())
+        return mBlock.data() + offset;
+
+    std::lock_guard<std::mutex> lock(mOverflowMutex);
+    mOverflow.emplace_back(size);
+    return mOverflow.back().data();
+}
+
+void FrameArena::reset()
+{
+    mPeak = mUsed.load(std::memory_order_relaxed);
+    mUsed.store(0, std::memory_order_relaxed);
+    if (mOverflow.empty())
+        return;
+
+    // Whatever overflowed fits in the block from now on
+    mOverflow.clear();
+    mBlock = Block(mPeak);
+}
+
+size_t FrameArena::get_capacity()
+{
+    return mBlock.size();
+}
+
+size_t FrameArena::get_peak()
+{
+    return mPeak;
+}
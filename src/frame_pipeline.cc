@@ -0,0 +1,259 @@
+#include "frame_pipeline.hh"
+
+#include <cstring>
+#include <tbb/parallel_pipeline.h>
+#include <tbb/task_arena.h>
+
+FramePipeline::FramePipeline(FrameReader &reader, size_t frames_in_flight,
+                             EffectChain chain, const FrameSettings &settings,
+                             ThreadPool *pool,
+                             std::function<void()> on_ready,
+                             PaletteLibrary *palettes)
+    : mReader(reader)
+    , mFramesInFlight(std::max<size_t>(frames_in_flight, 1))
+    , mProcessor(std::move(chain), palettes)
+    // One more frame than the pipeline holds, for the display
+    , mFrames(mFramesInFlight + 1)
+    , mSettings(settings)
+    , mInvalidate(false)
+    , mPaletteSize(0)
+    , mFreeze(false)
+    , mQualityLevel(0)
+    , mSavedFrame(get_frame_size(reader.get_format()))
+    , mFrameSaved(false)
+    , mPool(pool)
+    , mOnReady(std::move(on_ready))
+    , mHasPalette(false)
+    , mStopped(false)
+    , mFinished(false)
+{
+    for (auto &frame : mFrames)
+    {
+        frame.pixels.resize(screen_width * screen_height * 4);
+        if (reader.get_format() != PixelFormat::RGBA)
+            frame.yuv.resize(get_frame_size(reader.get_format()));
+        mFreeFrames.push(&frame);
+    }
+
+    mThread = std::thread(&FramePipeline::run, this);
+}
+
+FramePipeline::~FramePipeline()
+{
+    stop();
+}
+
+void FramePipeline::set_settings(const FrameSettings &settings)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mSettings = settings;
+}
+
+void FramePipeline::invalidate()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mInvalidate = true;
+}
+
+void FramePipeline::generate_palette(size_t color_count)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPaletteSize = color_count;
+}
+
+bool FramePipeline::has_palette()
+{
+    return mHasPalette;
+}
+
+void FramePipeline::set_freeze(bool freeze)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFreeze = freeze;
+}
+
+void FramePipeline::set_budget(double budget_ms)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mBudget.set_budget(budget_ms);
+}
+
+size_t FramePipeline::get_quality_level()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mBudget.get_level();
+}
+
+size_t FramePipeline::get_frames_in_flight()
+{
+    return mFramesInFlight;
+}
+
+size_t FramePipeline::get_tile_count()
+{
+    return mProcessor.get_tile_count();
+}
+
+Frame *FramePipeline::next_frame()
+{
+    if (mFinished)
+        return nullptr;
+
+    Frame *frame = nullptr;
+    mReadyFrames.pop(frame);
+    mFinished = frame == nullptr;
+    return frame;
+}
+
+void FramePipeline::release(Frame *frame)
+{
+    mFreeFrames.push(frame);
+}
+
+void FramePipeline::stop()
+{
+    if (!mThread.joinable())
+        return;
+
+    request_stop();
+    // The reader may be waiting for a free frame
+    while (Frame *frame = next_frame())
+        release(frame);
+    mThread.join();
+}
+
+void FramePipeline::request_stop()
+{
+    mStopped = true;
+}
+
+void FramePipeline::run()
+{
+    auto pipeline = [this]() {
+        tbb::parallel_pipeline(
+            mFramesInFlight,
+            tbb::make_filter<void, Frame *>(
+                tbb::filter_mode::serial_in_order,
+                [this](tbb::flow_control &fc) { return read_frame(fc); })
+                & tbb::make_filter<Frame *, Frame *>(
+                    tbb::filter_mode::serial_in_order,
+                    [this](Frame *frame) { return process_frame(frame); })
+                & tbb::make_filter<Frame *, void>(
+                    tbb::filter_mode::serial_in_order,
+                    [this](Frame *frame) { push_ready(frame); }));
+    };
+
+    // Isolated, a thread waiting for its pipeline never takes the blocking
+    // filters of another stream
+    if (mPool)
+    {
+        mPool->get_io_arena().execute(
+            [&]() { tbb::this_task_arena::isolate(pipeline); });
+    }
+    else
+    {
+        pipeline();
+    }
+
+    push_ready(nullptr);
+}
+
+void FramePipeline::push_ready(Frame *frame)
+{
+    mReadyFrames.push(frame);
+    if (mOnReady)
+        mOnReady();
+}
+
+Frame *FramePipeline::read_frame(tbb::flow_control &fc)
+{
+    Frame *frame = nullptr;
+    mFreeFrames.pop(frame);
+
+    bool freeze = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        frame->settings = mBudget.apply(mSettings);
+        frame->quality_level = mBudget.get_level();
+        // Tiles computed at another quality are stale
+        frame->invalidate =
+            mInvalidate || frame->quality_level != mQualityLevel;
+        mQualityLevel = frame->quality_level;
+        frame->palette_size = mPaletteSize;
+        freeze = mFreeze;
+        mInvalidate = false;
+        mPaletteSize = 0;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto &input = frame->yuv.empty() ? frame->pixels : frame->yuv;
+    bool read = true;
+    if (!freeze)
+    {
+        mFrameSaved = false;
+        read = mReader.read(input.data());
+    }
+    else
+    {
+        if (!mFrameSaved)
+        {
+            read = mReader.read(mSavedFrame.data());
+            mFrameSaved = true;
+        }
+        std::memcpy(input.data(), mSavedFrame.data(), input.size());
+    }
+
+    // If we didn't get a frame of video, we're probably at the end
+    if (!read || mStopped)
+    {
+        mFreeFrames.push(frame);
+        fc.stop();
+        return nullptr;
+    }
+
+    frame->read_time = std::chrono::steady_clock::now();
+    frame->read_ms =
+        std::chrono::duration<double, std::milli>(frame->read_time - start)
+            .count();
+    return frame;
+}
+
+Frame *FramePipeline::process_frame(Frame *frame)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (mPool)
+        mPool->get_compute_arena().execute([&]() { process(frame); });
+    else
+        process(frame);
+    frame->process_ms = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+
+    {
+        // Frames read before the last quality change do not count
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (frame->quality_level == mBudget.get_level())
+            mBudget.update(frame->process_ms, mSettings);
+    }
+    return frame;
+}
+
+void FramePipeline::process(Frame *frame)
+{
+    if (frame->palette_size)
+        mProcessor.request_palette(frame->palette_size);
+    if (frame->invalidate)
+        mProcessor.invalidate();
+
+    mProcessor.get_settings() = frame->settings;
+    unsigned char *output =
+        mProcessor.process(frame->pixels.data(), frame->yuv.data(),
+                           mReader.get_format());
+    frame->updated_tiles = mProcessor.get_updated_tiles();
+    mHasPalette = mProcessor.has_palette();
+
+    // The incremental output cache is shared by every frame, a frame in
+    // flight needs its own copy
+    if (output != frame->pixels.data())
+        std::memcpy(frame->pixels.data(), output, frame->pixels.size());
+}
@@ -0,0 +1,251 @@
+#include "frame_processor.hh"
+
+#include <cstring>
+
+FrameProcessor::FrameProcessor(EffectChain chain, PaletteLibrary *palettes)
+    : mChain(std::move(chain))
+    , mPaletteRequest(0)
+    , mPalettes(palettes)
+    , mLibraryPalette(-1)
+    , mPreprocessNode(mGraph,
+                      [this](const tbb::flow::continue_msg &) { preprocess(); })
+    , mFinishNode(mGraph,
+                  [this](const tbb::flow::continue_msg &) { finish(); })
+    , mUseTiles(false)
+    , mDirtyTiles(screen_width, screen_height, DIRTY_TILE_SIZE,
+                  DIRTY_TILE_THRESHOLD)
+    , mOutput(screen_width * screen_height * 4)
+    , mFramesSinceRefresh(0)
+    , mUpdatedTiles(0)
+{
+    // Only the planes of the stages in the chain are allocated
+    unsigned planes = 0;
+    for (auto &effect : mChain)
+        planes |= effect->get_inputs() | effect->get_outputs();
+    mFrame.allocate(planes);
+
+    auto dependencies = effect_dependencies(mChain);
+    mStageMs.resize(mChain.size());
+    for (size_t i = 0; i < mChain.size(); i++)
+    {
+        auto *effect = mChain[i].get();
+        mStageNodes.push_back(std::make_unique<Node>(
+            mGraph, [this, effect, i](const tbb::flow::continue_msg &) {
+                if (!effect->is_enabled(mSettings))
+                    return;
+                auto start = std::chrono::steady_clock::now();
+                effect->apply(mFrame, mSettings);
+                mStageMs[i] += std::chrono::duration<double, std::milli>(
+                                   std::chrono::steady_clock::now() - start)
+                                   .count();
+            }));
+
+        if (dependencies[i].empty())
+            tbb::flow::make_edge(mPreprocessNode, *mStageNodes[i]);
+        for (auto dependency : dependencies[i])
+            tbb::flow::make_edge(*mStageNodes[dependency], *mStageNodes[i]);
+        tbb::flow::make_edge(*mStageNodes[i], mFinishNode);
+    }
+
+    if (mChain.empty())
+        tbb::flow::make_edge(mPreprocessNode, mFinishNode);
+}
+
+FrameSettings &FrameProcessor::get_settings()
+{
+    return mSettings;
+}
+
+const EffectChain &FrameProcessor::get_chain()
+{
+    return mChain;
+}
+
+void FrameProcessor::invalidate()
+{
+    mDirtyTiles.invalidate();
+}
+
+void FrameProcessor::generate_palette(unsigned char *raw_buffer,
+                                      size_t color_count)
+{
+    auto &q = mFrame.quantizer;
+    q.clear();
+
+    std::cout << "generating new color palette" << std::endl;
+
+    for (size_t i = 0; i < screen_height * screen_width; i++)
+    {
+        auto color = get_pixel(raw_buffer, i * 4);
+        q.add_color(color);
+    }
+
+    auto colors = q.make_palette(color_count);
+    std::cout << "color palette: " << colors.size() << std::endl;
+    auto palette = std::make_shared<const Palette>(q, colors);
+    set_palette(palette);
+
+    if (!mPalettes)
+        return;
+    try
+    {
+        std::cout << "saved as palette " << mPalettes->add(palette)
+                  << std::endl;
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cerr << "error: " << e.what() << std::endl;
+    }
+}
+
+void FrameProcessor::set_palette(std::shared_ptr<const Palette> palette)
+{
+    mFrame.palette = std::move(palette);
+    mFrame.palette->get_lightness_histogram(mFrame.palette_histo);
+    invalidate();
+}
+
+void FrameProcessor::request_palette(size_t color_count)
+{
+    mPaletteRequest = color_count;
+}
+
+bool FrameProcessor::has_palette()
+{
+    return mFrame.palette != nullptr;
+}
+
+size_t FrameProcessor::get_updated_tiles()
+{
+    return mUpdatedTiles;
+}
+
+size_t FrameProcessor::get_tile_count()
+{
+    return mDirtyTiles.get_tile_count();
+}
+
+std::vector<double> FrameProcessor::take_stage_ms()
+{
+    std::vector<double> stage_ms(mStageMs.size());
+    stage_ms.swap(mStageMs);
+    return stage_ms;
+}
+
+unsigned char *FrameProcessor::process(unsigned char *raw_buffer,
+                                       const unsigned char *yuv,
+                                       PixelFormat format)
+{
+    // Palette of the library picked since the previous frame
+    if (mPalettes && mSettings.library_palette != mLibraryPalette)
+    {
+        mLibraryPalette = mSettings.library_palette;
+        if (auto palette = mPalettes->get(mLibraryPalette))
+            set_palette(std::move(palette));
+    }
+
+    // Quantization enabled from the chain description, before any palette
+    if (mSettings.color_quantization && !has_palette() && !mPaletteRequest)
+        mPaletteRequest = mSettings.palette_size;
+
+    mFrame.raw = raw_buffer;
+    mFrame.yuv = format == PixelFormat::RGBA ? nullptr : yuv;
+    mFrame.format = format;
+    mPreprocessNode.try_put(tbb::flow::continue_msg());
+    mGraph.wait_for_all();
+    return mFrame.rgba;
+}
+
+bool FrameProcessor::needs_rgba()
+{
+    // Palettes and dirty tiles come from RGBA frames
+    if (mPaletteRequest || mUseTiles)
+        return true;
+
+    bool overwritten = false;
+    for (auto &effect : mChain)
+    {
+        if (!effect->is_enabled(mSettings))
+            continue;
+        if (!overwritten && effect->needs_rgba(mFrame, mSettings))
+            return true;
+        overwritten = overwritten || effect->overwrites_rgba(mSettings);
+    }
+    // Otherwise the input is displayed
+    return !overwritten;
+}
+
+bool FrameProcessor::supports_tiles()
+{
+    for (auto &effect : mChain)
+    {
+        if (!effect->is_enabled(mSettings))
+            continue;
+
+        // Dirty tiles are grown by a tile, larger neighbourhoods could
+        // change clean tiles
+        if (!effect->supports_tiles(mSettings)
+            || effect->get_radius(mSettings) > DIRTY_TILE_SIZE)
+            return false;
+    }
+    return true;
+}
+
+void FrameProcessor::preprocess()
+{
+    if (mFrame.pyramid)
+    {
+        mFrame.pyramid->set_level(mSettings.pyramid_level);
+        mFrame.pyramid->set_refine(mSettings.refine_edges);
+    }
+
+    // Incremental mode only recomputes the tiles that changed and their
+    // neighbours, the other ones keep their output in mOutput
+    mUseTiles = mSettings.incremental && supports_tiles();
+    mFrame.region = nullptr;
+    mFrame.rgba = mFrame.raw;
+    mUpdatedTiles = mDirtyTiles.get_tile_count();
+
+    // YUV input is only converted when a stage uses the colors, edges only
+    // read the Y plane
+    if (mFrame.yuv && needs_rgba())
+        yuv_to_rgba(mFrame.yuv, mFrame.format, mFrame.raw);
+
+    if (mPaletteRequest)
+    {
+        generate_palette(mFrame.raw, mPaletteRequest);
+        mPaletteRequest = 0;
+    }
+
+    if (!mUseTiles)
+    {
+        mDirtyTiles.invalidate();
+        return;
+    }
+
+    // Global statistics (histograms, gradient max) are only updated on full
+    // frames, refresh them from time to time
+    if (++mFramesSinceRefresh >= INCREMENTAL_REFRESH_PERIOD)
+    {
+        mDirtyTiles.invalidate();
+        mFramesSinceRefresh = 0;
+    }
+
+    mDirtyTiles.update(mFrame.raw);
+    mUpdatedTiles = mDirtyTiles.get_dirty_count();
+    if (!mDirtyTiles.all_dirty())
+    {
+        mFrame.region = &mDirtyTiles.get_update_region();
+        copy_tiles(mFrame.raw, mOutput.data(), *mFrame.region);
+        mFrame.rgba = mOutput.data();
+    }
+}
+
+void FrameProcessor::finish()
+{
+    // Full frame in incremental mode, cache every tile
+    if (mUseTiles && !mFrame.region)
+        std::memcpy(mOutput.data(), mFrame.raw, mOutput.size());
+
+    mFrame.arena.reset();
+}
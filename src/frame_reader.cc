@@ -0,0 +1,208 @@
+#include "frame_reader.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "buffer_utils.hh"
+
+PipeReader::PipeReader(FILE *pipe, PixelFormat format)
+    : mPipe(pipe)
+    , mFormat(format)
+{}
+
+PixelFormat PipeReader::get_format()
+{
+    return mFormat;
+}
+
+bool PipeReader::read(unsigned char *buffer)
+{
+    size_t size = get_frame_size(mFormat);
+    return fread(buffer, 1, size, mPipe) == size;
+}
+
+static bool ends_with(const std::string &str, const std::string &suffix)
+{
+    return str.size() >= suffix.size()
+        && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool MappedReader::is_supported(const std::string &path)
+{
+    return ends_with(path, ".rgba") || ends_with(path, ".raw")
+        || ends_with(path, ".y4m");
+}
+
+MappedReader::MappedReader(const std::string &path, size_t frame_limit)
+    : mData(nullptr)
+    , mSize(0)
+    , mY4M(false)
+    , mFrameSize(screen_width * screen_height * 4)
+    , mFrameLimit(frame_limit)
+    , mFramesRead(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        if (fd >= 0)
+            ::close(fd);
+        throw std::runtime_error(path + ": cannot open");
+    }
+
+    mSize = st.st_size;
+    void *data =
+        mSize ? mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    ::close(fd);
+    if (data == MAP_FAILED || !data)
+        throw std::runtime_error(path + ": cannot map");
+    mData = static_cast<unsigned char *>(data);
+
+    // Read front to back, the kernel can read ahead aggressively
+    madvise(mData, mSize, MADV_SEQUENTIAL);
+
+    try
+    {
+        const std::string signature = "YUV4MPEG2 ";
+        mY4M = mSize >= signature.size()
+            && std::equal(signature.begin(), signature.end(), mData);
+        if (mY4M)
+        {
+            index_y4m();
+        }
+        else
+        {
+            for (size_t offset = 0; offset + mFrameSize <= mSize;
+                 offset += mFrameSize)
+                mOffsets.push_back(offset);
+            if (mSize % mFrameSize)
+            {
+                throw std::runtime_error(
+                    "size is not a whole number of 1280x720 RGBA frames");
+            }
+        }
+
+        if (mOffsets.empty())
+            throw std::runtime_error("no frame");
+    }
+    catch (const std::runtime_error &e)
+    {
+        munmap(mData, mSize);
+        throw std::runtime_error(path + ": " + e.what());
+    }
+}
+
+MappedReader::~MappedReader()
+{
+    munmap(mData, mSize);
+}
+
+// Decimal value of a header token, without its letter
+static size_t parse_header_value(const std::string &token)
+{
+    const char *digits = token.c_str() + 1;
+    char *digits_end = nullptr;
+    errno = 0;
+    unsigned long value = std::strtoul(digits, &digits_end, 10);
+    if (digits_end == digits || *digits_end || errno || *digits == '-')
+        throw std::runtime_error("invalid header");
+    return value;
+}
+
+void MappedReader::index_y4m()
+{
+    auto *end = mData + mSize;
+    auto *line_end = std::find(mData, end, '\n');
+    if (line_end == end)
+        throw std::runtime_error("truncated header");
+
+    // Stream header: "YUV4MPEG2 W1280 H720 F30:1 C420jpeg ..."
+    size_t width = 0, height = 0;
+    std::string colorspace = "420jpeg";
+    std::string header(mData, line_end);
+    size_t pos = 0;
+    while (pos < header.size())
+    {
+        size_t next = std::min(header.find(' ', pos), header.size());
+        auto token = header.substr(pos, next - pos);
+        if (token.size() > 1 && token[0] == 'W')
+            width = parse_header_value(token);
+        else if (token.size() > 1 && token[0] == 'H')
+            height = parse_header_value(token);
+        else if (token.size() > 1 && token[0] == 'C')
+            colorspace = token.substr(1);
+        pos = next + 1;
+    }
+
+    if (width != screen_width || height != screen_height)
+        throw std::runtime_error("frames are not 1280x720");
+    if (colorspace.compare(0, 3, "420") != 0)
+        throw std::runtime_error("only 4:2:0 chroma is supported");
+
+    mFrameSize = get_frame_size(PixelFormat::YUV420P);
+
+    // Every frame has its own "FRAME ..." line
+    auto *frame = line_end + 1;
+    while (frame < end)
+    {
+        auto *frame_end = std::find(frame, end, '\n');
+        if (frame_end == end || frame_end - frame < 5
+            || std::string(frame, frame + 5) != "FRAME")
+            throw std::runtime_error("invalid frame header");
+        if (static_cast<size_t>(end - frame_end - 1) < mFrameSize)
+            break;
+        mOffsets.push_back(frame_end + 1 - mData);
+        frame = frame_end + 1 + mFrameSize;
+    }
+}
+
+size_t MappedReader::get_frame_count()
+{
+    return mOffsets.size();
+}
+
+bool MappedReader::is_y4m()
+{
+    return mY4M;
+}
+
+const unsigned char *MappedReader::get_frame(size_t index)
+{
+    return mData + mOffsets[index];
+}
+
+void MappedReader::prefetch(size_t index)
+{
+    // Page aligned range of the next frames, wrapping is left to the
+    // sequential hint
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = mOffsets[index] / page * page;
+    size_t last = std::min(index + READAHEAD_FRAMES, mOffsets.size() - 1);
+    size_t end = std::min(mOffsets[last] + mFrameSize, mSize);
+    madvise(mData + begin, end - begin, MADV_WILLNEED);
+}
+
+PixelFormat MappedReader::get_format()
+{
+    return mY4M ? PixelFormat::YUV420P : PixelFormat::RGBA;
+}
+
+bool MappedReader::read(unsigned char *buffer)
+{
+    if (mFrameLimit && mFramesRead >= mFrameLimit)
+        return false;
+
+    size_t index = mFramesRead++ % mOffsets.size();
+    prefetch((index + 1) % mOffsets.size());
+
+    // Frames are processed in place, the mapping itself stays untouched
+    const unsigned char *frame = get_frame(index);
+    std::copy(frame, frame + mFrameSize, buffer);
+    return true;
+}
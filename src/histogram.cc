@@ -0,0 +1,92 @@
+#include "histogram.hh"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+Histogram::Histogram(size_t bins)
+    : mBins(bins)
+    , mCounts(bins, 0)
+{}
+
+size_t Histogram::get_bins() const
+{
+    return mBins;
+}
+
+const std::vector<size_t> &Histogram::get_counts() const
+{
+    return mCounts;
+}
+
+void Histogram::clear()
+{
+    std::fill(mCounts.begin(), mCounts.end(), 0);
+}
+
+void Histogram::add(size_t value, size_t count)
+{
+    mCounts[value * mBins / 256] += count;
+}
+
+std::vector<size_t> Histogram::cumulative() const
+{
+    std::vector<size_t> res;
+    cumulative(res);
+    return res;
+}
+
+void Histogram::cumulative(std::vector<size_t> &sums) const
+{
+    sums.resize(mBins);
+    size_t sum = 0;
+    for (size_t i = 0; i < mBins; i++)
+    {
+        sum += mCounts[i];
+        sums[i] = sum;
+    }
+}
+
+void max_channel_row(const unsigned char *rgba, uint8_t *values, size_t count)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // 16 pixels per iteration: max of the 4 bytes of every 32 bit lane (alpha
+    // masked out), then the lanes are packed down to bytes
+    const __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i low_byte = _mm_set1_epi32(0xFF);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i lanes[4];
+        for (size_t k = 0; k < 4; k++)
+        {
+            __m128i p = _mm_and_si128(
+                _mm_loadu_si128((const __m128i *)(rgba + (i + k * 4) * 4)),
+                rgb_mask);
+            p = _mm_max_epu8(p, _mm_srli_epi32(p, 8));
+            p = _mm_max_epu8(p, _mm_srli_epi32(p, 16));
+            lanes[k] = _mm_and_si128(p, low_byte);
+        }
+        __m128i low = _mm_packs_epi32(lanes[0], lanes[1]);
+        __m128i high = _mm_packs_epi32(lanes[2], lanes[3]);
+        _mm_storeu_si128((__m128i *)(values + i),
+                         _mm_packus_epi16(low, high));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        const unsigned char *p = rgba + i * 4;
+        values[i] = std::max(p[0], std::max(p[1], p[2]));
+    }
+}
+
+void lightness_histogram(const unsigned char *raw_buffer, size_t width,
+                         size_t height, Histogram &histogram)
+{
+    histogram.clear();
+    histogram.compute(height, width, [&](size_t y, uint8_t *values) {
+        max_channel_row(raw_buffer + y * width * 4, values, width);
+    });
+}
@@ -0,0 +1,46 @@
+#include "integral_image.hh"
+
+RGBIntegral::RGBIntegral(size_t rows, size_t cols)
+    : mRows(rows)
+    , mCols(cols)
+    , mSums(Matrix<uint32_t>::make_aligned(rows + 1, (cols + 1) * 3))
+    , mTotals(Matrix<uint32_t>::make_aligned(rows / integral_band_height + 2,
+                                             (cols + 1) * 3))
+{}
+
+size_t RGBIntegral::get_rows() const
+{
+    return mRows;
+}
+
+size_t RGBIntegral::get_cols() const
+{
+    return mCols;
+}
+
+void RGBIntegral::build(const unsigned char *raw_buffer)
+{
+    integral_scan<3>(
+        mRows, mCols,
+        [&](size_t i, size_t j, size_t c) {
+            return (uint32_t)raw_buffer[(i * mCols + j) * 4 + c];
+        },
+        mSums, mTotals);
+}
+
+RGB RGBIntegral::sum(size_t x0, size_t y0, size_t x1, size_t y1) const
+{
+    const uint32_t *top = mSums.row(y0);
+    const uint32_t *bottom = mSums.row(y1);
+    x0 *= 3;
+    x1 *= 3;
+
+    return RGB(bottom[x1] - bottom[x0] - top[x1] + top[x0],
+               bottom[x1 + 1] - bottom[x0 + 1] - top[x1 + 1] + top[x0 + 1],
+               bottom[x1 + 2] - bottom[x0 + 2] - top[x1 + 2] + top[x0 + 2]);
+}
+
+RGB RGBIntegral::mean(size_t x0, size_t y0, size_t x1, size_t y1) const
+{
+    return sum(x0, y0, x1, y1).normalized((x1 - x0) * (y1 - y0));
+}
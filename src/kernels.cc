@@ -1,157 +1,133 @@
 #include "kernels.hh"
 
-#include "utils.hh"
-
-Matrix<float> mgridy(float begin, float end)
+#include <map>
+#include <math.h>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+/*
+ * Registry of the runtime kernels, one map per value type. A kernel is
+ * identified by its kind and up to two parameters, it is built once and
+ * never freed so the references handed out stay valid.
+ */
+enum class KernelKind
 {
-    Matrix<float> mat(end - begin, end - begin);
-    std::vector<float> values;
-    for (float i = begin; i < end; i++)
-    {
-        for (float j = begin; j < end; j++)
-        {
-            values.push_back(i);
-        }
-    }
-    mat.set_values(values);
-    return mat;
-}
-
-Matrix<float> mgridx(float begin, float end)
+    GAUSSIAN_ROW,
+    DERIVATIVE_GAUSSIAN_ROW,
+    ELLIPSE,
+    SQUARE,
+    GAUSSIAN_WEIGHTS,
+    BILATERAL_SPATIAL,
+};
+
+// `build` must not ask the registry for another kernel, the lock is held
+template <typename T, typename F>
+static const Matrix<T> &cached_kernel(KernelKind kind, double a, double b,
+                                      const F &build)
 {
-    Matrix<float> mat(end - begin, end - begin);
-    std::vector<float> values;
-    for (float i = begin; i < end; i++)
-    {
-        for (float j = begin; j < end; j++)
-        {
-            values.push_back(j);
-        }
-    }
-    mat.set_values(values);
-    return mat;
+    using Key = std::tuple<KernelKind, double, double>;
+    static std::mutex mutex;
+    static std::map<Key, std::unique_ptr<Matrix<T>>> kernels;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &kernel = kernels[Key(kind, a, b)];
+    if (!kernel)
+        kernel = std::make_unique<Matrix<T>>(build());
+    return *kernel;
 }
 
-Matrix<float> gauss_kernel(float size)
+// x^`power` exp(-x^2 / (2 sigma^2)) over [-radius, radius], divided by the
+// sum of x^(2 `power`) exp(-x^2 / (2 sigma^2))
+static Matrix<float> make_gaussian_row(float sigma, size_t radius, int power)
 {
-    Matrix<float> x = mgridx(-size, size + 1);
-    Matrix<float> y = mgridy(-size, size + 1);
-
-    float coef = 2 * (size / 3) * (size / 3);
-
-    auto func = [coef](float a, size_t i) {
-        i = i;
-        return ((a * a) / coef);
-    };
-    x.apply(func);
-    y.apply(func);
-    x += y;
-    auto func2 = [](float a, size_t i) {
-        i = i;
-        return exp(-a);
+    auto weight = [sigma, radius](size_t i, int power) {
+        double x = double(i) - radius;
+        return pow(x, power) * exp(-(x * x) / (2. * sigma * sigma));
     };
-    x.apply(func2);
-    return x;
-}
 
-Matrix<float> derivative_gauss_kernel_x(float size)
-{
-    Matrix<float> x = mgridx(-size, size + 1);
-    Matrix<float> kernel = gauss_kernel(size);
+    double sum = 0;
+    for (size_t i = 0; i < 2 * radius + 1; i++)
+        sum += weight(i, power * 2);
 
-    x *= kernel;
-    return -x;
+    Matrix<float> row(1, 2 * radius + 1);
+    for (size_t i = 0; i < 2 * radius + 1; i++)
+        row.set_value(i, 0, weight(i, power) / sum);
+    return row;
 }
 
-Matrix<float> derivative_gauss_kernel_y(float size)
+const Matrix<float> &gaussian_row(float sigma, size_t radius)
 {
-    Matrix<float> y = mgridy(-size, size + 1);
-    Matrix<float> kernel = gauss_kernel(size);
-
-    y *= kernel;
-    return -y;
+    return cached_kernel<float>(
+        KernelKind::GAUSSIAN_ROW, sigma, radius,
+        [sigma, radius]() { return make_gaussian_row(sigma, radius, 0); });
 }
 
-Matrix<float> ellipse_kernel(int height, int width)
+const Matrix<float> &derivative_gaussian_row(float sigma, size_t radius)
 {
-    int i, j;
-
-    float inv_r2 = 0;
-    int r = height / 2;
-    int c = width / 2;
-    inv_r2 = r ? 1. / ((float)r * r) : 0;
-
-    std::vector<float> vec(height * width, 0);
-
-    for (i = 0; i < height; i++)
-    {
-        int j1 = 0;
-        int j2 = 0;
-
-        int dy = i - r;
-        if (std::abs(dy) <= r)
-        {
-            float tmp = c * std::sqrt((r * r - dy * dy) * inv_r2);
-
-            int dx =
-                saturate_cast<int, float>(tmp, std::numeric_limits<int>::min(),
-                                          std::numeric_limits<int>::max());
-            j1 = std::max(c - dx, 0);
-            j2 = std::min(c + dx + 1, width);
-        }
-
-        for (j = 0; j < j1; j++)
-            vec[i * width + j] = 0;
-        for (; j < j2; j++)
-            vec[i * width + j] = 1;
-        for (; j < width; j++)
-            vec[i * width + j] = 0;
-    }
-
-    return Matrix<float>(height, width, vec);
+    return cached_kernel<float>(
+        KernelKind::DERIVATIVE_GAUSSIAN_ROW, sigma, radius,
+        [sigma, radius]() { return make_gaussian_row(sigma, radius, 1); });
 }
 
-Matrix<float> square_kernel(int height, int width)
+const Matrix<float> &ellipse_kernel(int height, int width)
 {
-    return Matrix<float>(height, width, 1);
+    return cached_kernel<float>(
+        KernelKind::ELLIPSE, height, width, [height, width]() {
+            Matrix<float> kernel(height, width, 0.f);
+            int r = height / 2;
+            int c = width / 2;
+            for (int y = 0; y < height; y++)
+            {
+                int dx = ellipse_half_width(y - r, r, c);
+                for (int x = std::max(c - dx, 0);
+                     x < std::min(c + dx + 1, width); x++)
+                    kernel.set_value(x, y, 1);
+            }
+            return kernel;
+        });
 }
 
-Matrix<float> sobel_x_kernel()
+const Matrix<float> &square_kernel(int height, int width)
 {
-    return Matrix<float>(3, 3, { -1, 0, 1, -2, 0, 2, -1, 0, 1 });
+    return cached_kernel<float>(
+        KernelKind::SQUARE, height, width,
+        [height, width]() { return Matrix<float>(height, width, 1.f); });
 }
 
-Matrix<float> sobel_y_kernel()
+const Matrix<float> &gaussian_weights(size_t radius, float delta)
 {
-    return Matrix<float>(3, 3, { -1, -2, -1, 0, 0, 0, 1, 2, 1 });
+    return cached_kernel<float>(
+        KernelKind::GAUSSIAN_WEIGHTS, radius, delta, [radius, delta]() {
+            Matrix<float> weights(1, 2 * radius + 1);
+            for (size_t i = 0; i < 2 * radius + 1; i++)
+            {
+                float x = float(i) - radius;
+                weights.set_value(i, 0, expf(-(x * x) / (2 * delta * delta)));
+            }
+            return weights;
+        });
 }
 
-Matrix<float> sobel_x_vertical_kernel()
+const Matrix<double> &bilateral_spatial_kernel(size_t diameter, double sigma)
 {
-    return Matrix<float>(3, 1, { 1, 2, 1 });
+    return cached_kernel<double>(
+        KernelKind::BILATERAL_SPATIAL, diameter, sigma, [diameter, sigma]() {
+            Matrix<double> kernel(diameter, diameter);
+            double radius = diameter / 2;
+            for (size_t y = 0; y < diameter; y++)
+            {
+                for (size_t x = 0; x < diameter; x++)
+                {
+                    double dx = double(x) - radius;
+                    double dy = double(y) - radius;
+                    float distance = float(sqrt(pow(dx, 2) + pow(dy, 2)));
+                    kernel.set_value(
+                        x, y,
+                        exp(-(pow(distance, 2)) / (2 * pow(sigma, 2)))
+                            / (2 * M_PI * pow(sigma, 2)));
+                }
+            }
+            return kernel;
+        });
 }
-
-Matrix<float> sobel_x_horizontal_kernel()
-{
-    return Matrix<float>(1, 3, { 1, 0, -1 });
-}
-
-Matrix<float> sobel_y_vertical_kernel()
-{
-    return Matrix<float>(3, 1, { 1, 0, -1 });
-}
-
-Matrix<float> sobel_y_horizontal_kernel()
-{
-    return Matrix<float>(1, 3, { 1, 2, 1 });
-}
-
-Matrix<float> gauss_5()
-{
-    return Matrix<float>(
-        5, 5, { 0.0007889,  0.00658115, 0.01334733, 0.00658115, 0.0007889,
-                0.00658115, 0.05490089, 0.11134531, 0.05490089, 0.00658115,
-                0.01334733, 0.11134531, 0.22582109, 0.11134531, 0.01334733,
-                0.00658115, 0.05490089, 0.11134531, 0.05490089, 0.00658115,
-                0.0007889,  0.00658115, 0.01334733, 0.00658115, 0.0007889 });
-}
\ No newline at end of file
@@ -1,27 +1,144 @@
 #include <SDL2/SDL.h>
 #include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <set>
-// #include <tbb/tbb.h> // To disable multi-threading
+#include <sstream>
 #include <SDL2/SDL_ttf.h>
+#include <fstream>
 #include <thread>
+#include <unistd.h>
 #include <vector>
 
+#include "alloc_stats.hh"
 #include "buffer_utils.hh"
-#include "canny.hh"
-#include "filters.hh"
-#include "kernels.hh"
-#include "octree.hh"
+#include "regression.hh"
+#include "stream_engine.hh"
 
 #define OUTLINE_SIZE 3
+#define EFFECT_CHAIN_PATH "effects.chain"
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-f frames in flight] [-o output] "
+            "[-p rgba|yuv420p|nv12] [-j threads] [-c cpus] [-P] "
+            "[-J I/O workers] [-i I/O cpus] [-b budget ms] [feed...]\n"
+            "       %s -g golden dir [-R] feed\n",
+            name, name);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Output of stream `index` out of `count`: "out.mp4" becomes "out_1.mp4"
+ * when there are several streams
+ */
+static std::string stream_output(const std::string &output, size_t index,
+                                 size_t count)
+{
+    if (output.empty() || count == 1)
+        return output;
+
+    size_t dot = output.rfind('.');
+    if (dot == std::string::npos || output.find('/', dot) != std::string::npos)
+        dot = output.size();
+    return output.substr(0, dot) + "_" + std::to_string(index)
+        + output.substr(dot);
+}
 
 int main(int argc, char *argv[])
 {
-    SDL_Init(SDL_INIT_EVERYTHING);
+    // Frames read, processed and displayed at the same time
+    size_t frames_in_flight = FRAMES_IN_FLIGHT;
+    // Processed frames are also encoded to a file when one is given, one per
+    // stream
+    std::string output;
+    // Pixel format asked to ffmpeg
+    PixelFormat input_format = PixelFormat::RGBA;
+    // Compute threads and their CPUs, -j 1 runs a single stream on one thread
+    ThreadSettings threads;
+    // Processing time per frame the quality is lowered to, 0 to keep it
+    double budget_ms = 0;
+    // Headless golden frame regression, recorded with -R, see regression.hh
+    std::string golden_dir;
+    bool record_goldens = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "f:o:p:j:c:PJ:i:b:g:R")) != -1)
+    {
+        switch (option)
+        {
+        case 'f':
+            frames_in_flight = std::max(atoi(optarg), 1);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'p':
+            if (!parse_pixel_format(optarg, input_format))
+                usage(argv[0]);
+            break;
+        case 'j':
+            threads.workers = std::max(atoi(optarg), 1);
+            break;
+        case 'c':
+            if (!parse_cpu_list(optarg, threads.cpus))
+                usage(argv[0]);
+            break;
+        case 'P':
+            threads.pin = true;
+            break;
+        case 'J':
+            threads.io_workers = std::max(atoi(optarg), 1);
+            break;
+        case 'i':
+            if (!parse_cpu_list(optarg, threads.io_cpus))
+                usage(argv[0]);
+            break;
+        case 'b':
+            budget_ms = std::max(atof(optarg), 0.);
+            break;
+        case 'g':
+            golden_dir = optarg;
+            break;
+        case 'R':
+            record_goldens = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    std::vector<std::string> feeds(argv + optind, argv + argc);
+
+    if (!golden_dir.empty())
+    {
+        if (feeds.size() != 1)
+            usage(argv[0]);
+        ThreadPool pool(threads, 1);
+        size_t failures = 0;
+        try
+        {
+            pool.get_compute_arena().execute([&]() {
+                failures =
+                    run_regression(feeds[0], golden_dir, record_goldens);
+            });
+        }
+        catch (const std::runtime_error &e)
+        {
+            fprintf(stderr, "error: %s\n", e.what());
+            return EXIT_FAILURE;
+        }
+        if (failures)
+            std::cout << failures << " failed cases" << std::endl;
+        return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (feeds.empty())
+        feeds.push_back("/dev/video0");
 
-    // tbb::task_scheduler_init t_init(1); // To disable multi-threading
+    SDL_Init(SDL_INIT_EVERYTHING);
 
     SDL_Window *window = SDL_CreateWindow("TIFO", SDL_WINDOWPOS_UNDEFINED,
                                           SDL_WINDOWPOS_UNDEFINED, screen_width,
@@ -40,9 +157,23 @@ int main(int argc, char *argv[])
                   << std::endl;
     }*/
 
-    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888,
-                                             SDL_TEXTUREACCESS_STREAMING,
-                                             screen_width, screen_height);
+    // Several streams are shown as a mosaic, one texture per stream
+    std::vector<SDL_Texture *> textures;
+    std::vector<SDL_Rect> cells;
+    int mosaic_cols = std::ceil(std::sqrt(feeds.size()));
+    int mosaic_rows = (feeds.size() + mosaic_cols - 1) / mosaic_cols;
+    for (size_t i = 0; i < feeds.size(); i++)
+    {
+        textures.push_back(SDL_CreateTexture(
+            renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING,
+            screen_width, screen_height));
+        int col = i % mosaic_cols;
+        int row = i / mosaic_cols;
+        cells.push_back(SDL_Rect{ int(col * screen_width / mosaic_cols),
+                                  int(row * screen_height / mosaic_rows),
+                                  int(screen_width / mosaic_cols),
+                                  int(screen_height / mosaic_rows) });
+    }
 
     SDL_Event event;
 
@@ -60,6 +191,7 @@ int main(int argc, char *argv[])
     const char *shortcut_text =
         "TAB : display shortcuts\n"
         "SPACE : pause/unpause\n"
+        "T : select the stream the keys apply to\n"
         "\n"
         "E : display contours\n"
         "B : apply border darkening\n"
@@ -67,14 +199,21 @@ int main(int argc, char *argv[])
         "R : edge contrast correction\n"
         "RIGHT and LEFT arrows : select blur function\n"
         "L / H + UP / DOWN : update low/high Canny thresholds\n"
+        "1 - 4 : select Canny resolution (pyramid level)\n"
+        "F : coarse-to-fine edge refinement\n"
+        "K : fixed point (8 bit) / float Canny\n"
         "\n"
         "P : compute color palette\n"
+        "O : next saved palette\n"
         "C : color quantization\n"
         "S : color saturation boost\n"
         "X : color contrast correction\n"
+        "A : adaptive (CLAHE) / global contrast correction\n"
         "UP / DOWN arrows : update saturation value\n"
         "\n"
-        "N : pixel filter\n";
+        "N : pixel filter\n"
+        "M : pixel filter shape\n"
+        "I : only recompute changed tiles\n";
 
     SDL_Color text_color{ 255, 255, 255, 255 };
     SDL_Color outline_color{ 0, 0, 0, 255 };
@@ -102,96 +241,91 @@ int main(int argc, char *argv[])
 
     bool running = true;
 
-    unsigned int frames = 0;
     Uint64 start = SDL_GetPerformanceCounter();
+    AllocationStats last_allocations = get_allocation_stats();
 
-    auto command = std::string("ffmpeg -loglevel error -stream_loop -1 -i ");
-    command.append(argc == 2 ? argv[1] : "/dev/video0");
-    command.append(" -f image2pipe "
-                   "-vcodec rawvideo "
-                   "-pix_fmt rgba -r 30 "
-                   "-s 1280x720 -");
-    FILE *pipein = popen(command.c_str(), "r");
-
-    unsigned char *raw_buffer = (unsigned char *)calloc(
-        screen_width * screen_height * 4, sizeof(unsigned char));
-    unsigned char *tmp_buffer = (unsigned char *)calloc(
-        screen_width * screen_height * 4, sizeof(unsigned char));
-    unsigned char *saved_frame_buffer = (unsigned char *)calloc(
-        screen_width * screen_height * 4, sizeof(unsigned char));
-
-    const size_t padding = 2;
-    std::vector<Matrix<float>> padded_buffers(
-        3,
-        Matrix<float>((screen_height + padding * 2),
-                      (screen_width + padding * 2), 0));
-    auto non_padded_buffer = Matrix<float>(screen_height, screen_width, 0);
-
-    Matrix<RGB> bil_filter_buffer(screen_height, screen_width, RGB());
-    Matrix<RGB> pixels_matrix(screen_height, screen_width, RGB());
-
-    Quantizer q;
-    std::vector<RGB> palette;
-    std::vector<size_t> palette_lightness_cumul_histo;
-    int palette_number = 100;
+    // Generated palettes are kept from run to run, the streams start with
+    // the one of the chain description
+    PaletteLibrary palettes;
+    std::cout << palettes.get_size() << " saved palettes" << std::endl;
 
-    int count;
-
-    bool edges_only = false;
-    bool dark_borders = false;
-    bool border_dilation = true;
-    bool edge_contrast_correction = true;
-
-    bool palette_init = false;
-    bool generate_palette = false;
-    bool color_quantization = false;
-    bool color_contrast_correction = false;
-
-    bool pixelate = false;
-
-    bool saturation_boost = true;
+    // Every feed gets its own processing stages, from the chain description
+    // when there is one
+    StreamEngine engine(feeds.size(), threads, &palettes);
+    for (size_t i = 0; i < feeds.size(); i++)
+    {
+        try
+        {
+            FrameSettings settings;
+            EffectChain chain = default_effect_chain();
+            if (std::ifstream(EFFECT_CHAIN_PATH))
+                chain = load_effect_chain(EFFECT_CHAIN_PATH, settings);
+
+            Stream &stream = engine.add_stream(
+                feeds[i], input_format, frames_in_flight, std::move(chain),
+                settings, stream_output(output, i, feeds.size()));
+            stream.pipeline->set_budget(budget_ms);
+        }
+        catch (const std::runtime_error &e)
+        {
+            fprintf(stderr, "error: %s\n", e.what());
+            exit(EXIT_FAILURE);
+        }
+    }
 
     bool freeze_frame = false;
-    bool frame_saved = false;
     bool render_shortcuts = false;
+    // Stream the keys apply to, -1 for all of them
+    long selected = -1;
 
-    Blur blur = Blur::GAUSS;
-    float low_threshold_ratio = 0.030;
-    float high_threshold_ratio = 0.150;
-    float saturation_value = 1.5;
-
-    auto square = square_kernel(2, 2);
+    auto targets = [&]() {
+        std::vector<Stream *> streams;
+        for (size_t i = 0; i < engine.get_stream_count(); i++)
+        {
+            if (selected < 0 || size_t(selected) == i)
+                streams.push_back(&engine.get_stream(i));
+        }
+        return streams;
+    };
 
     while (running)
     {
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
-        SDL_RenderClear(renderer);
+        // Wait for the next processed frame
+        size_t index = 0;
+        Frame *frame = engine.next_frame(index);
 
-        // Read a frame from the input pipe into the buffer
-        if (!freeze_frame)
-        {
-            count =
-                fread(raw_buffer, 1, screen_width * screen_height * 4, pipein);
+        // If we didn't get a frame of video, we're probably at the end
+        if (!frame)
+            break;
 
-            // If we didn't get a frame of video, we're probably at the end
-            if (count != screen_width * screen_height * 4)
-                break;
-        }
-        else
+        // Every frame processed by now is shown, whatever its stream
+        do
         {
-            if (!frame_saved)
+            Stream &stream = engine.get_stream(index);
+            SDL_UpdateTexture(textures[index], NULL, frame->pixels.data(),
+                              screen_width * 4);
+            if (stream.encoder)
+                stream.encoder->write(frame->pixels.data());
+
+            // Time between reading and displaying a frame
+            stream.latency += std::chrono::duration<double, std::milli>(
+                                  std::chrono::steady_clock::now()
+                                  - frame->read_time)
+                                  .count();
+            stream.updated_tiles += frame->updated_tiles;
+            stream.read_ms += frame->read_ms;
+            stream.process_ms += frame->process_ms;
+            if (frame->quality_level != stream.quality_level)
             {
-                count = fread(saved_frame_buffer, 1,
-                              screen_width * screen_height * 4, pipein);
-
-                // If we didn't get a frame of video, we're probably at the end
-                if (count != screen_width * screen_height * 4)
-                    break;
-                frame_saved = true;
+                stream.quality_level = frame->quality_level;
+                if (engine.get_stream_count() > 1)
+                    std::cout << "[" << index << "] ";
+                std::cout << "Quality level: " << stream.quality_level
+                          << std::endl;
             }
-            memcpy(raw_buffer, saved_frame_buffer,
-                   screen_width * screen_height * 4);
-        }
+            stream.frames++;
+            engine.release(index, frame);
+        } while ((frame = engine.poll_frame(index)));
 
         while (SDL_PollEvent(&event))
         {
@@ -206,6 +340,25 @@ int main(int argc, char *argv[])
             if (SDL_KEYDOWN == event.type)
             {
                 auto state = SDL_GetKeyboardState(NULL);
+                if (state[SDL_SCANCODE_T])
+                {
+                    selected = selected + 1 == long(engine.get_stream_count())
+                        ? -1
+                        : selected + 1;
+                    std::cout << "Selected stream: "
+                              << (selected < 0
+                                      ? "all"
+                                      : engine.get_stream(selected).feed)
+                              << std::endl;
+                }
+
+                // Any setting change invalidates the cached tiles
+                for (Stream *stream : targets())
+                    stream->pipeline->invalidate();
+
+                // Copied to every stream when they are all selected
+                FrameSettings &settings =
+                    engine.get_stream(std::max(selected, 0L)).settings;
                 if (state[SDL_SCANCODE_TAB])
                 {
                     render_shortcuts = !render_shortcuts;
@@ -216,265 +369,332 @@ int main(int argc, char *argv[])
                 if (state[SDL_SCANCODE_SPACE])
                 {
                     freeze_frame = !freeze_frame;
-                    frame_saved = false;
+                    for (Stream *stream : targets())
+                        stream->pipeline->set_freeze(freeze_frame);
                     std::cout << "Freeze frame: "
                               << (freeze_frame ? "enabled" : "disabled")
                               << std::endl;
                 }
                 if (state[SDL_SCANCODE_P])
                 {
-                    generate_palette = !generate_palette;
+                    for (Stream *stream : targets())
+                        stream->pipeline->generate_palette(
+                            stream->settings.palette_size);
+                }
+                if (state[SDL_SCANCODE_O] && palettes.get_size())
+                {
+                    settings.library_palette = (settings.library_palette + 1)
+                        % long(palettes.get_size());
+                    settings.color_quantization = true;
+                    std::cout << "Saved palette: " << settings.library_palette
+                              << std::endl;
                 }
                 if (state[SDL_SCANCODE_C])
                 {
-                    color_quantization = palette_init && !color_quantization;
+                    bool has_palette = true;
+                    for (Stream *stream : targets())
+                        has_palette &= stream->pipeline->has_palette();
+                    settings.color_quantization =
+                        has_palette && !settings.color_quantization;
                     std::cout << "Color quantization: "
-                              << (color_quantization ? "enabled" : "disabled")
+                              << (settings.color_quantization ? "enabled"
+                                                              : "disabled")
                               << std::endl;
                 }
                 if (state[SDL_SCANCODE_B])
                 {
-                    edges_only = false;
-                    dark_borders = !dark_borders;
+                    settings.edges_only = false;
+                    settings.dark_borders = !settings.dark_borders;
                     std::cout << "Border darkening: "
-                              << (dark_borders ? "enabled" : "disabled")
+                              << (settings.dark_borders ? "enabled"
+                                                        : "disabled")
                               << std::endl;
                 }
                 if (state[SDL_SCANCODE_E])
                 {
-                    dark_borders = false;
-                    edges_only = !edges_only;
+                    settings.dark_borders = false;
+                    settings.edges_only = !settings.edges_only;
                 }
                 if (state[SDL_SCANCODE_N])
                 {
-                    pixelate = !pixelate;
+                    settings.pixelate = !settings.pixelate;
+                }
+                if (settings.pixelate && state[SDL_SCANCODE_M])
+                {
+                    ++settings.pixel_shape;
+                    std::cout << "Pixel filter shape: " << settings.pixel_shape
+                              << std::endl;
+                }
+                if (state[SDL_SCANCODE_A])
+                {
+                    settings.adaptive_contrast = !settings.adaptive_contrast;
+                    std::cout << "Contrast correction: "
+                              << (settings.adaptive_contrast ? "adaptive"
+                                                             : "global")
+                              << std::endl;
+                }
+                if (state[SDL_SCANCODE_I])
+                {
+                    settings.incremental = !settings.incremental;
+                    std::cout << "Incremental processing: "
+                              << (settings.incremental ? "enabled" : "disabled")
+                              << std::endl;
                 }
 
-                if (dark_borders || edges_only)
+                if (settings.dark_borders || settings.edges_only)
                 {
                     if (state[SDL_SCANCODE_R])
                     {
-                        edge_contrast_correction = !edge_contrast_correction;
+                        settings.edge_contrast_correction =
+                            !settings.edge_contrast_correction;
                         std::cout << "Edge contrast correction: "
-                                  << (edge_contrast_correction ? "enabled"
-                                                               : "disabled")
+                                  << (settings.edge_contrast_correction
+                                          ? "enabled"
+                                          : "disabled")
                                   << std::endl;
                     }
                     if (state[SDL_SCANCODE_D])
                     {
-                        border_dilation = !border_dilation;
+                        settings.border_dilation = !settings.border_dilation;
                         std::cout << "Border dilation: "
-                                  << (border_dilation ? "enabled" : "disabled")
+                                  << (settings.border_dilation ? "enabled"
+                                                               : "disabled")
+                                  << std::endl;
+                    }
+
+                    for (size_t level = 0; level < PYRAMID_LEVELS; level++)
+                    {
+                        if (state[SDL_SCANCODE_1 + level])
+                        {
+                            settings.pyramid_level = level;
+                            std::cout << "Canny pyramid level: " << level
+                                      << std::endl;
+                        }
+                    }
+                    if (state[SDL_SCANCODE_F])
+                    {
+                        settings.refine_edges = !settings.refine_edges;
+                        std::cout << "Coarse-to-fine edges: "
+                                  << (settings.refine_edges ? "enabled"
+                                                            : "disabled")
+                                  << std::endl;
+                    }
+                    if (state[SDL_SCANCODE_K])
+                    {
+                        settings.integer_canny = !settings.integer_canny;
+                        std::cout << "Canny arithmetic: "
+                                  << (settings.integer_canny ? "fixed point"
+                                                             : "float")
                                   << std::endl;
                     }
 
                     if (state[SDL_SCANCODE_RIGHT])
                     {
-                        ++blur;
-                        std::cout << "Selected canny blur: " << blur
+                        ++settings.blur;
+                        std::cout << "Selected canny blur: " << settings.blur
                                   << std::endl;
                     }
                     else if (state[SDL_SCANCODE_LEFT])
                     {
-                        --blur;
-                        std::cout << "Selected canny blur: " << blur
+                        --settings.blur;
+                        std::cout << "Selected canny blur: " << settings.blur
                                   << std::endl;
                     }
                     else if (state[SDL_SCANCODE_UP])
                     {
                         if (state[SDL_SCANCODE_L])
-                            low_threshold_ratio += 0.01;
+                            settings.low_threshold_ratio = std::clamp(
+                                settings.low_threshold_ratio + 0.01f, 0.f, 1.f);
                         else if (state[SDL_SCANCODE_H])
-                            high_threshold_ratio += 0.01;
+                            settings.high_threshold_ratio = std::clamp(
+                                settings.high_threshold_ratio + 0.01f, 0.f,
+                                1.f);
 
                         std::cout << "Set threshold ratios to: "
-                                  << low_threshold_ratio << ", "
-                                  << high_threshold_ratio << std::endl;
+                                  << settings.low_threshold_ratio << ", "
+                                  << settings.high_threshold_ratio << std::endl;
                     }
                     else if (state[SDL_SCANCODE_DOWN])
                     {
                         if (state[SDL_SCANCODE_L])
-                            low_threshold_ratio -= 0.01;
+                            settings.low_threshold_ratio = std::clamp(
+                                settings.low_threshold_ratio - 0.01f, 0.f, 1.f);
                         else if (state[SDL_SCANCODE_H])
-                            high_threshold_ratio -= 0.01;
+                            settings.high_threshold_ratio = std::clamp(
+                                settings.high_threshold_ratio - 0.01f, 0.f,
+                                1.f);
 
                         std::cout << "Set threshold ratios to: "
-                                  << low_threshold_ratio << ", "
-                                  << high_threshold_ratio << std::endl;
+                                  << settings.low_threshold_ratio << ", "
+                                  << settings.high_threshold_ratio << std::endl;
                     }
                 }
-                if (color_quantization)
+                if (settings.color_quantization)
                 {
                     if (state[SDL_SCANCODE_X])
                     {
-                        color_contrast_correction = !color_contrast_correction;
+                        settings.color_contrast_correction =
+                            !settings.color_contrast_correction;
                         std::cout << "Color contrast correction: "
-                                  << (color_contrast_correction ? "enabled"
-                                                                : "disabled")
+                                  << (settings.color_contrast_correction
+                                          ? "enabled"
+                                          : "disabled")
                                   << std::endl;
                     }
                     if (state[SDL_SCANCODE_S])
                     {
-                        saturation_boost =
-                            color_quantization && !saturation_boost;
+                        settings.saturation_boost = settings.color_quantization
+                            && !settings.saturation_boost;
                         std::cout << "Color saturation boost: "
-                                  << (saturation_boost ? "enabled" : "disabled")
+                                  << (settings.saturation_boost ? "enabled"
+                                                                : "disabled")
                                   << std::endl;
                     }
-                    if (saturation_boost)
+                    if (settings.saturation_boost)
                     {
                         if (state[SDL_SCANCODE_UP] && !state[SDL_SCANCODE_H]
                             && !state[SDL_SCANCODE_L])
                         {
-                            saturation_value += 0.1;
+                            settings.saturation_value += 0.1;
                             std::cout << "Set saturation boost to: "
-                                      << saturation_value << std::endl;
+                                      << settings.saturation_value << std::endl;
                         }
                         else if (state[SDL_SCANCODE_DOWN]
                                  && !state[SDL_SCANCODE_H]
                                  && !state[SDL_SCANCODE_L])
                         {
-                            saturation_value -= 0.1;
+                            settings.saturation_value -= 0.1;
                             std::cout << "Set saturation boost to: "
-                                      << saturation_value << std::endl;
+                                      << settings.saturation_value << std::endl;
                         }
                     }
                 }
             }
         }
 
-        if (generate_palette)
+        // Applies to the frames read from now on, the ones in flight keep
+        // their settings
+        for (size_t i = 0; i < engine.get_stream_count(); i++)
         {
-            q = Quantizer();
-
-            std::cout << "generating new color palette" << std::endl;
-
-            for (size_t i = 0; i < screen_height * screen_width; i++)
-            {
-                auto color = get_pixel(raw_buffer, i * 4);
-                q.add_color(color);
-            }
-
-            palette = q.make_palette(palette_number);
-            std::cout << "color palette: " << palette.size() << std::endl;
-
-            palette_lightness_cumul_histo =
-                q.get_lightness_cumulative_histogram();
-
-            palette_init = true;
-            generate_palette = false;
+            Stream &stream = engine.get_stream(i);
+            if (selected < 0)
+                stream.settings = engine.get_stream(0).settings;
+            stream.pipeline->set_settings(stream.settings);
         }
 
-        // Preprocess
-
-        if (edge_contrast_correction) // From raw buffer
+        // SDL again
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
+        SDL_RenderClear(renderer);
+        for (size_t i = 0; i < textures.size(); i++)
+            SDL_RenderCopy(renderer, textures[i], NULL, &cells[i]);
+        if (selected >= 0 && cells.size() > 1)
         {
-            memcpy(tmp_buffer, raw_buffer, screen_height * screen_width * 4);
-            auto c_histo = compute_lightness_cumul_histogram(tmp_buffer);
-            contrast_correction(tmp_buffer, c_histo);
+            SDL_SetRenderDrawColor(renderer, 255, 255, 255, SDL_ALPHA_OPAQUE);
+            SDL_RenderDrawRect(renderer, &cells[selected]);
         }
+        if (render_shortcuts)
+            SDL_RenderCopy(renderer, shortcut_texture, NULL, &shortcut_rect);
+        SDL_RenderPresent(renderer);
 
-        // Compute edges BEFORE color pre-processing
-        if (dark_borders)
-        {
-            to_grayscale(edge_contrast_correction ? tmp_buffer : raw_buffer,
-                         non_padded_buffer);
-            non_padded_buffer.to_padded(padding, padded_buffers[0]);
-
-            edge_detection(padded_buffers, padding, blur, low_threshold_ratio,
-                           high_threshold_ratio);
-
-            if (border_dilation)
-            {
-                thicken_edges(padded_buffers[0], padded_buffers[2],
-                              padded_buffers[1], padding);
-                padded_buffers[1].swap(padded_buffers[0]);
-                padded_buffers[0].pad_borders(padding);
-            }
-        }
-        else if (edges_only)
+        const Uint64 end = SDL_GetPerformanceCounter();
+        const static Uint64 freq = SDL_GetPerformanceFrequency();
+        const double seconds = (end - start) / static_cast<double>(freq);
+        if (seconds > 2.0)
         {
-            to_grayscale(edge_contrast_correction ? tmp_buffer : raw_buffer,
-                         non_padded_buffer);
-            non_padded_buffer.to_padded(padding, padded_buffers[0]);
-
-            edge_detection(padded_buffers, padding, blur, low_threshold_ratio,
-                           high_threshold_ratio);
-            // remap_to_rgb(canny_edge_buffers[0]);
-            if (border_dilation)
+            size_t frames = 0;
+            for (size_t i = 0; i < engine.get_stream_count(); i++)
             {
-                thicken_edges(padded_buffers[0], padded_buffers[2],
-                              padded_buffers[1], padding);
-                padded_buffers[1].swap(padded_buffers[0]);
-                padded_buffers[0].pad_borders(padding);
-            }
-        }
+                Stream &stream = engine.get_stream(i);
+                frames += stream.frames;
+                if (engine.get_stream_count() > 1)
+                    std::cout << "[" << i << "] " << stream.feed << ": ";
+                if (!stream.frames)
+                {
+                    std::cout << (stream.finished ? "finished" : "no frame")
+                              << std::endl;
+                    continue;
+                }
 
-        if (color_quantization)
-        {
-            apply_palette(raw_buffer, q, palette);
+                std::cout << stream.frames << " frames in "
+                          << std::setprecision(1) << std::fixed << seconds
+                          << " seconds = " << std::setprecision(1)
+                          << std::fixed << stream.frames / seconds
+                          << " FPS (" << std::setprecision(3) << std::fixed
+                          << (seconds * 1000.0) / stream.frames
+                          << " ms/frame, " << stream.latency / stream.frames
+                          << " ms latency with "
+                          << stream.pipeline->get_frames_in_flight()
+                          << " frames in flight)"
+                          << ", read " << stream.read_ms / stream.frames
+                          << " ms, process "
+                          << stream.process_ms / stream.frames << " ms";
+                if (budget_ms > 0)
+                    std::cout << ", quality level " << stream.quality_level;
+                if (stream.settings.incremental)
+                {
+                    std::cout << ", " << std::setprecision(1) << std::fixed
+                              << 100. * stream.updated_tiles
+                            / (stream.frames
+                               * stream.pipeline->get_tile_count())
+                              << "% dirty tiles";
+                }
+                if (stream.encoder)
+                {
+                    std::cout << ", " << stream.encoder->get_frames_written()
+                              << " frames encoded ("
+                              << stream.encoder->get_queue_depth()
+                              << " queued, " << std::setprecision(1)
+                              << std::fixed
+                              << stream.encoder->get_blocked_ms()
+                              << " ms blocked)";
+                    if (stream.encoder->has_failed())
+                        std::cout << ", encoder failed";
+                }
+                std::cout << std::endl;
 
-            if (color_contrast_correction) // From palette
+                stream.frames = 0;
+                stream.updated_tiles = 0;
+                stream.latency = 0;
+                stream.read_ms = 0;
+                stream.process_ms = 0;
+            }
+            if (engine.get_stream_count() > 1)
             {
-                contrast_correction(raw_buffer, palette_lightness_cumul_histo);
+                std::cout << "total: " << std::setprecision(1) << std::fixed
+                          << frames / seconds << " FPS" << std::endl;
             }
 
-            if (saturation_boost)
+            // Threads in each arena on average, out of all the compute
+            // threads, or the I/O workers plus the pipeline threads
+            ThreadPool &pool = engine.get_thread_pool();
+            std::cout << "compute arena: " << std::setprecision(2)
+                      << std::fixed
+                      << pool.take_compute_threads(seconds * 1000.0)
+                      << " threads (" << pool.get_workers()
+                      << " max), I/O arena: "
+                      << pool.take_io_threads(seconds * 1000.0)
+                      << " threads (" << pool.get_io_workers() << " workers)"
+                      << std::endl;
+
+            // Every thread together, nothing should be allocated once the
+            // buffers are warm, see FrameArena
+            AllocationStats allocations = get_allocation_stats();
+            if (frames)
             {
-                saturation_modification(raw_buffer, saturation_value);
+                size_t count = allocations.count - last_allocations.count;
+                size_t bytes = allocations.bytes - last_allocations.bytes;
+                std::cout << "heap: " << std::setprecision(1) << std::fixed
+                          << double(count) / frames << " allocations ("
+                          << bytes / (frames * 1024.0) << " KiB) per frame"
+                          << std::endl;
             }
-
-            //  apply_palette_debug(raw_buffer, q, palette, screen_width /
-            //  2);
-        }
-
-        // Apply edges AFTER color pre-processing
-        if (dark_borders)
-        {
-            padded_buffers[0].to_unpad(padding, non_padded_buffer);
-            set_dark_borders(raw_buffer, non_padded_buffer);
-        }
-        else if (edges_only)
-        {
-            padded_buffers[0].to_unpad(padding, non_padded_buffer);
-            fill_buffer(raw_buffer, non_padded_buffer);
-        }
-
-        if (pixelate)
-        {
-            pixelate_buffer(raw_buffer, 10);
-        }
-
-        // SDL again
-        SDL_UpdateTexture(texture, NULL, raw_buffer, screen_width * 4);
-        SDL_RenderCopy(renderer, texture, NULL, NULL);
-        if (render_shortcuts)
-            SDL_RenderCopy(renderer, shortcut_texture, NULL, &shortcut_rect);
-        SDL_RenderPresent(renderer);
-
-        frames++;
-        const Uint64 end = SDL_GetPerformanceCounter();
-        const static Uint64 freq = SDL_GetPerformanceFrequency();
-        const double seconds = (end - start) / static_cast<double>(freq);
-        if (seconds > 2.0)
-        {
-            std::cout << frames << " frames in " << std::setprecision(1)
-                      << std::fixed << seconds
-                      << " seconds = " << std::setprecision(1) << std::fixed
-                      << frames / seconds << " FPS (" << std::setprecision(3)
-                      << std::fixed << (seconds * 1000.0) / frames
-                      << " ms/frame)" << std::endl;
+            last_allocations = allocations;
             start = end;
-            frames = 0;
         }
     }
 
     // Flush and close input and output pipes
-    fflush(pipein);
-    pclose(pipein);
-    free(raw_buffer);
-    free(tmp_buffer);
-    free(saved_frame_buffer);
+    engine.stop();
 
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
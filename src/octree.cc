@@ -1,5 +1,9 @@
 #include "octree.hh"
 
+#include <algorithm>
+
+#include "histogram.hh"
+
 size_t get_color_index(RGB c, size_t level)
 {
     size_t index = 0;
@@ -24,7 +28,7 @@ Node::Node()
     , pixel_count_(0)
     , palette_index_(0)
 {
-    children_ = std::vector<std::shared_ptr<Node>>(8, nullptr);
+    children_.fill(nullptr);
 }
 
 bool Node::is_leaf()
@@ -32,25 +36,28 @@ bool Node::is_leaf()
     return pixel_count_ > 0;
 }
 
-std::vector<std::shared_ptr<Node>> Node::get_leaves()
+void Node::get_leaves(std::vector<Node *> &leaves)
 {
-    std::vector<std::shared_ptr<Node>> nodes;
     for (auto i : children_)
     {
         if (i == nullptr)
             continue;
         if (i->is_leaf())
-        {
-            nodes.push_back(i);
-        }
+            leaves.push_back(i);
         else
-        {
-            for (auto j : i->get_leaves())
-                nodes.push_back(j);
-        }
+            i->get_leaves(leaves);
     }
+}
 
-    return nodes;
+size_t Node::get_depth()
+{
+    size_t depth = 0;
+    for (auto i : children_)
+    {
+        if (i != nullptr)
+            depth = std::max(depth, i->get_depth() + 1);
+    }
+    return depth;
 }
 
 void Node::add_color(RGB c, size_t level, Quantizer *parent)
@@ -64,7 +71,7 @@ void Node::add_color(RGB c, size_t level, Quantizer *parent)
     size_t index = get_color_index(c, level);
     if (children_[index] == nullptr)
     {
-        auto node = std::make_shared<Node>(Node());
+        auto node = parent->new_node();
         children_[index] = node;
         if (level < MAX_DEPTH - 1)
             parent->add_level_node(level, node);
@@ -118,7 +125,7 @@ size_t Node::remove_leaves()
         pixel_count_ += i->pixel_count_;
         result++;
     }
-    children_.clear();
+    children_.fill(nullptr);
     return result - 1;
 }
 
@@ -138,13 +145,31 @@ void Node::set_palette_index(size_t index)
 }
 
 Quantizer::Quantizer()
+    : node_count_(0)
 {
     // create level, list (size MAX_DEPTH) of list of nodes;
-    for (size_t i = 0; i < MAX_DEPTH; i++)
-    {
-        levels_.push_back(std::vector<std::shared_ptr<Node>>());
-    }
-    root_ = std::make_shared<Node>(Node());
+    levels_.resize(MAX_DEPTH);
+    root_ = new_node();
+}
+
+void Quantizer::clear()
+{
+    node_count_ = 0;
+    for (auto &level : levels_)
+        level.clear();
+    root_ = new_node();
+}
+
+Node *Quantizer::new_node()
+{
+    size_t chunk = node_count_ / OCTREE_NODE_CHUNK;
+    if (chunk == node_chunks_.size())
+        node_chunks_.push_back(std::make_unique<Node[]>(OCTREE_NODE_CHUNK));
+
+    Node *node = &node_chunks_[chunk][node_count_ % OCTREE_NODE_CHUNK];
+    *node = Node();
+    node_count_++;
+    return node;
 }
 
 void Quantizer::add_color(RGB c)
@@ -194,12 +219,14 @@ std::vector<RGB> Quantizer::make_palette(size_t color_amount)
     return palette;
 }
 
-std::vector<std::shared_ptr<Node>> Quantizer::get_leaf_nodes()
+const std::vector<Node *> &Quantizer::get_leaf_nodes()
 {
-    return root_->get_leaves();
+    leaves_.clear();
+    root_->get_leaves(leaves_);
+    return leaves_;
 }
 
-void Quantizer::add_level_node(size_t level, std::shared_ptr<Node> node)
+void Quantizer::add_level_node(size_t level, Node *node)
 {
     levels_[level].push_back(node);
 }
@@ -209,6 +236,11 @@ size_t Quantizer::get_palette_index(RGB c)
     return root_->get_palette_index(c, 0);
 }
 
+size_t Quantizer::get_depth()
+{
+    return root_->get_depth();
+}
+
 std::vector<std::pair<HSV, size_t>> Quantizer::get_histogram()
 {
     return histogram_;
@@ -216,14 +248,10 @@ std::vector<std::pair<HSV, size_t>> Quantizer::get_histogram()
 
 std::vector<size_t> Quantizer::get_lightness_cumulative_histogram()
 {
-    std::vector<size_t> cum_histo(256, 0u);
+    Histogram histogram;
     for (auto i : histogram_)
     {
-        cum_histo[i.first.v * 255] += i.second;
-    }
-    for (size_t i = 1; i < 256; i++)
-    {
-        cum_histo[i] += cum_histo[i - 1];
+        histogram.add(i.first.v * 255, i.second);
     }
-    return cum_histo;
+    return histogram.cumulative();
 }
@@ -0,0 +1,259 @@
+#include "palette.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tbb/parallel_for.h>
+#include <unistd.h>
+
+static const char PALETTE_MAGIC[8] = { 'T', 'I', 'F', 'O', 'P', 'A', 'L', 0 };
+
+// Offsets of the parts of a record, see PaletteFileHeader
+static size_t histogram_offset()
+{
+    return sizeof(PaletteRecordHeader);
+}
+
+static size_t lut_offset()
+{
+    return histogram_offset() + PALETTE_HISTOGRAM_BINS * sizeof(uint64_t);
+}
+
+static size_t colors_offset(size_t lut_bits)
+{
+    return lut_offset() + (size_t(1) << (3 * lut_bits)) * sizeof(uint16_t);
+}
+
+static size_t record_size(size_t lut_bits, size_t color_count)
+{
+    size_t size = colors_offset(lut_bits) + color_count * 3;
+    return (size + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+}
+
+Palette::Palette(Quantizer &q, const std::vector<RGB> &colors)
+{
+    // Past the depth of the tree, the low bits never change a lookup
+    size_t bits = std::clamp<size_t>(q.get_depth(), 1, PALETTE_LUT_MAX_BITS);
+    PaletteRecordHeader header{ record_size(bits, colors.size()),
+                                uint32_t(colors.size()), uint32_t(bits) };
+    mStorage.resize(header.size / sizeof(uint64_t));
+    auto *record = reinterpret_cast<unsigned char *>(mStorage.data());
+    std::memcpy(record, &header, sizeof(header));
+
+    auto histogram = q.get_lightness_cumulative_histogram();
+    auto *histogram_out =
+        reinterpret_cast<uint64_t *>(record + histogram_offset());
+    for (size_t i = 0; i < PALETTE_HISTOGRAM_BINS; i++)
+        histogram_out[i] = i < histogram.size() ? histogram[i] : 0;
+
+    uint8_t *colors_out = record + colors_offset(bits);
+    for (size_t i = 0; i < colors.size(); i++)
+    {
+        colors_out[i * 3] = colors[i].r;
+        colors_out[i * 3 + 1] = colors[i].g;
+        colors_out[i * 3 + 2] = colors[i].b;
+    }
+
+    // Every cell looked up at its center, a single tree walk per cell
+    auto *lut = reinterpret_cast<uint16_t *>(record + lut_offset());
+    size_t side = size_t(1) << bits;
+    size_t shift = 8 - bits;
+    size_t half = (size_t(1) << shift) / 2;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, side),
+                      [&](tbb::blocked_range<size_t> r) {
+                          for (size_t red = r.begin(); red < r.end(); red++)
+                          {
+                              for (size_t green = 0; green < side; green++)
+                              {
+                                  uint16_t *cell =
+                                      lut + (red * side + green) * side;
+                                  for (size_t blue = 0; blue < side; blue++)
+                                  {
+                                      RGB c((red << shift) | half,
+                                            (green << shift) | half,
+                                            (blue << shift) | half);
+                                      cell[blue] = q.get_palette_index(c);
+                                  }
+                              }
+                          }
+                      });
+
+    set_pointers(record);
+}
+
+Palette::Palette(const unsigned char *data, size_t size)
+{
+    PaletteRecordHeader header;
+    if (size < sizeof(header))
+        throw std::runtime_error("truncated palette");
+    std::memcpy(&header, data, sizeof(header));
+
+    if (header.lut_bits < 1 || header.lut_bits > 8 || !header.color_count
+        || header.color_count > PALETTE_MAX_COLORS
+        || header.size != record_size(header.lut_bits, header.color_count)
+        || header.size > size)
+        throw std::runtime_error("invalid palette");
+
+    set_pointers(data);
+
+    // Out of range indices would read past the colors
+    size_t lut_size = size_t(1) << (3 * header.lut_bits);
+    if (std::any_of(mLut, mLut + lut_size, [&](uint16_t index) {
+            return index >= header.color_count;
+        }))
+        throw std::runtime_error("invalid palette lookup table");
+}
+
+void Palette::set_pointers(const unsigned char *record)
+{
+    mHeader = reinterpret_cast<const PaletteRecordHeader *>(record);
+    mHistogram =
+        reinterpret_cast<const uint64_t *>(record + histogram_offset());
+    mLut = reinterpret_cast<const uint16_t *>(record + lut_offset());
+    mColors = record + colors_offset(mHeader->lut_bits);
+}
+
+size_t Palette::get_color_count() const
+{
+    return mHeader->color_count;
+}
+
+void Palette::get_lightness_histogram(std::vector<size_t> &cum_histo) const
+{
+    cum_histo.assign(mHistogram, mHistogram + PALETTE_HISTOGRAM_BINS);
+}
+
+const unsigned char *Palette::get_record() const
+{
+    return reinterpret_cast<const unsigned char *>(mHeader);
+}
+
+size_t Palette::get_record_size() const
+{
+    return mHeader->size;
+}
+
+PaletteLibrary::PaletteLibrary(const std::string &path)
+    : mPath(path)
+    , mData(nullptr)
+    , mSize(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0)
+        return;
+    if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(PaletteFileHeader))
+    {
+        ::close(fd);
+        return;
+    }
+
+    mSize = st.st_size;
+    void *data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        mSize = 0;
+        return;
+    }
+    mData = static_cast<unsigned char *>(data);
+
+    PaletteFileHeader header;
+    std::memcpy(&header, mData, sizeof(header));
+    if (!std::equal(PALETTE_MAGIC, PALETTE_MAGIC + sizeof(PALETTE_MAGIC),
+                    header.magic)
+        || header.version != PALETTE_FILE_VERSION)
+    {
+        std::cerr << path << ": not a palette file of version "
+                  << PALETTE_FILE_VERSION << ", ignored" << std::endl;
+        return;
+    }
+
+    size_t offset = sizeof(header);
+    for (size_t i = 0; i < header.palette_count; i++)
+    {
+        try
+        {
+            auto palette =
+                std::make_shared<Palette>(mData + offset, mSize - offset);
+            offset += palette->get_record_size();
+            mPalettes.push_back(std::move(palette));
+        }
+        catch (const std::runtime_error &e)
+        {
+            // The palettes before it are still usable
+            std::cerr << path << ": palette " << i << ": " << e.what()
+                      << std::endl;
+            break;
+        }
+    }
+}
+
+PaletteLibrary::~PaletteLibrary()
+{
+    if (mData)
+        munmap(mData, mSize);
+}
+
+size_t PaletteLibrary::get_size()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mPalettes.size();
+}
+
+std::shared_ptr<const Palette> PaletteLibrary::get(size_t index)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return index < mPalettes.size() ? mPalettes[index] : nullptr;
+}
+
+size_t PaletteLibrary::add(std::shared_ptr<const Palette> palette)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPalettes.push_back(std::move(palette));
+    try
+    {
+        save();
+    }
+    catch (const std::runtime_error &)
+    {
+        mPalettes.pop_back();
+        throw;
+    }
+    return mPalettes.size() - 1;
+}
+
+void PaletteLibrary::save()
+{
+    std::string tmp_path = mPath + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if (!file)
+        throw std::runtime_error(tmp_path + ": cannot open");
+
+    PaletteFileHeader header;
+    std::memcpy(header.magic, PALETTE_MAGIC, sizeof(header.magic));
+    header.version = PALETTE_FILE_VERSION;
+    header.palette_count = mPalettes.size();
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (auto &palette : mPalettes)
+    {
+        written = written
+            && fwrite(palette->get_record(), palette->get_record_size(), 1,
+                      file)
+                == 1;
+    }
+    written = fclose(file) == 0 && written;
+
+    // The mapped file stays alive as long as it is mapped
+    if (!written || rename(tmp_path.c_str(), mPath.c_str()))
+    {
+        remove(tmp_path.c_str());
+        throw std::runtime_error(mPath + ": cannot write the palettes");
+    }
+}
@@ -0,0 +1,283 @@
+#include "pyramid.hh"
+
+#include <cmath>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+
+#include "canny_streaming.hh"
+#include "filters.hh"
+#include "utils.hh"
+
+Pyramid::Pyramid(size_t rows, size_t cols, size_t levels)
+{
+    for (size_t i = 0; i < levels; i++)
+    {
+        mLevels.push_back(Matrix<float>::make_aligned(rows, cols));
+        rows = (rows + 1) / 2;
+        cols = (cols + 1) / 2;
+    }
+}
+
+size_t Pyramid::get_levels()
+{
+    return mLevels.size();
+}
+
+Matrix<float> &Pyramid::get_level(size_t level)
+{
+    return mLevels[level];
+}
+
+void Pyramid::build(size_t last_level)
+{
+    for (size_t i = 1; i <= last_level && i < mLevels.size(); i++)
+        pyramid_down(mLevels[i - 1], mLevels[i]);
+}
+
+void pyramid_down(Matrix<float> &input, Matrix<float> &output)
+{
+    static tbb::enumerable_thread_specific<std::vector<float>> scratch;
+
+    long rows = input.get_rows();
+    long cols = input.get_cols();
+    long out_cols = output.get_cols();
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, output.get_rows()),
+        [&](tbb::blocked_range<size_t> r) {
+            auto &column_pass = scratch.local();
+            column_pass.resize(cols);
+
+            for (size_t i = r.begin(); i < r.end(); i++)
+            {
+                long y = i * 2;
+                const float *r0 = input.row(mirror_index(y - 2, rows));
+                const float *r1 = input.row(mirror_index(y - 1, rows));
+                const float *r2 = input.row(y);
+                const float *r3 = input.row(mirror_index(y + 1, rows));
+                const float *r4 = input.row(mirror_index(y + 2, rows));
+
+                // Contiguous vertical pass on every column
+                float *tmp = column_pass.data();
+                for (long j = 0; j < cols; j++)
+                {
+                    tmp[j] = r0[j] * GAUSS_1D[0] + r1[j] * GAUSS_1D[1]
+                        + r2[j] * GAUSS_1D[2] + r3[j] * GAUSS_1D[3]
+                        + r4[j] * GAUSS_1D[4];
+                }
+
+                // Horizontal pass on even columns only
+                float *out = output.row(i);
+                for (long j = 0; j < out_cols; j++)
+                {
+                    long x = j * 2;
+                    if (x >= 2 && x + 2 < cols)
+                    {
+                        out[j] = tmp[x - 2] * GAUSS_1D[0]
+                            + tmp[x - 1] * GAUSS_1D[1] + tmp[x] * GAUSS_1D[2]
+                            + tmp[x + 1] * GAUSS_1D[3]
+                            + tmp[x + 2] * GAUSS_1D[4];
+                    }
+                    else
+                    {
+                        float acc = 0;
+                        for (long n = 0; n < 5; n++)
+                            acc += tmp[mirror_index(x + n - 2, cols)]
+                                * GAUSS_1D[n];
+                        out[j] = acc;
+                    }
+                }
+            }
+        });
+}
+
+PyramidEdgeDetector::PyramidEdgeDetector(size_t rows, size_t cols,
+                                         size_t levels)
+    : mPyramid(rows, cols, levels)
+    , mGradientMax(levels, 0)
+    , mLevel(0)
+    , mRefine(false)
+{
+    for (size_t i = 0; i < levels; i++)
+    {
+        // Level 0 is written straight to the caller's buffers
+        size_t level_rows = i ? mPyramid.get_level(i).get_rows() : 0;
+        size_t level_cols = i ? mPyramid.get_level(i).get_cols() : 0;
+        mEdges.push_back(
+            Matrix<uint8_t>::make_aligned(level_rows, level_cols, NONE));
+        mDirections.push_back(
+            Matrix<uint8_t>::make_aligned(level_rows, level_cols, DEG_0));
+    }
+}
+
+Pyramid &PyramidEdgeDetector::get_pyramid()
+{
+    return mPyramid;
+}
+
+size_t PyramidEdgeDetector::get_level()
+{
+    return mLevel;
+}
+
+void PyramidEdgeDetector::set_level(size_t level)
+{
+    mLevel = std::min(level, mPyramid.get_levels() - 1);
+}
+
+bool PyramidEdgeDetector::get_refine()
+{
+    return mRefine;
+}
+
+void PyramidEdgeDetector::set_refine(bool refine)
+{
+    mRefine = refine;
+}
+
+void PyramidEdgeDetector::detect(MatrixView<uint8_t> edges_out,
+                                 MatrixView<uint8_t> direction_out, Blur blur,
+                                 float low_threshold_ratio,
+                                 float high_threshold_ratio)
+{
+    if (!is_streamable(blur))
+        blur = Blur::GAUSS;
+
+    if (mLevel == 0)
+    {
+        mGradientMax[0] = edge_detection_streaming(
+            mPyramid.get_level(0).view(), edges_out, direction_out, blur,
+            low_threshold_ratio, high_threshold_ratio, mGradientMax[0]);
+        return;
+    }
+
+    mPyramid.build(mLevel);
+    mGradientMax[mLevel] = edge_detection_streaming(
+        mPyramid.get_level(mLevel).view(), mEdges[mLevel].view(),
+        mDirections[mLevel].view(), blur, low_threshold_ratio,
+        high_threshold_ratio, mGradientMax[mLevel]);
+
+    if (!mRefine)
+    {
+        upsample(mLevel, edges_out, direction_out);
+        return;
+    }
+
+    // Finer levels see the same step spread over twice as many pixels, the
+    // weak threshold is halved at each level
+    uint16_t low_threshold, high_threshold;
+    hysteresis_thresholds(mGradientMax[mLevel], low_threshold_ratio,
+                          high_threshold_ratio, low_threshold, high_threshold);
+
+    for (size_t level = mLevel; level-- > 0;)
+    {
+        low_threshold /= 2;
+        refine(level, mEdges[level + 1].view(),
+               level ? mEdges[level].view() : edges_out,
+               level ? mDirections[level].view() : direction_out,
+               low_threshold);
+    }
+}
+
+void PyramidEdgeDetector::upsample(size_t level, MatrixView<uint8_t> edges_out,
+                                   MatrixView<uint8_t> direction_out)
+{
+    auto &edges = mEdges[level];
+    auto &directions = mDirections[level];
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, edges_out.get_rows()),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t i = r.begin(); i < r.end(); i++)
+            {
+                const uint8_t *edges_in = edges.row(i >> level);
+                const uint8_t *directions_in = directions.row(i >> level);
+                uint8_t *edges_row = edges_out.row(i);
+                uint8_t *directions_row = direction_out.row(i);
+
+                for (size_t j = 0; j < edges_out.get_cols(); j++)
+                {
+                    edges_row[j] = edges_in[j >> level];
+                    directions_row[j] = directions_in[j >> level];
+                }
+            }
+        });
+}
+
+/*
+ * Sobel at (x, y), mirrored borders
+ */
+void sobel_at(Matrix<float> &image, long x, long y, float &g_x, float &g_y)
+{
+    long rows = image.get_rows();
+    long cols = image.get_cols();
+
+    const float *a = image.row(mirror_index(y - 1, rows));
+    const float *b = image.row(y);
+    const float *c = image.row(mirror_index(y + 1, rows));
+    long l = mirror_index(x - 1, cols);
+    long r = mirror_index(x + 1, cols);
+
+    g_x = -a[l] + a[r] - 2 * b[l] + 2 * b[r] - c[l] + c[r];
+    g_y = -a[l] - 2 * a[x] - a[r] + c[l] + 2 * c[x] + c[r];
+}
+
+uint16_t gradient_at(Matrix<float> &image, long x, long y)
+{
+    long rows = image.get_rows();
+    long cols = image.get_cols();
+    float g_x = 0, g_y = 0;
+    sobel_at(image, mirror_index(x, cols), mirror_index(y, rows), g_x, g_y);
+    return to_gradient(std::abs(g_x) + std::abs(g_y));
+}
+
+void PyramidEdgeDetector::refine(size_t level,
+                                 MatrixView<uint8_t> coarse_edges,
+                                 MatrixView<uint8_t> edges_out,
+                                 MatrixView<uint8_t> direction_out,
+                                 uint16_t low_threshold)
+{
+    auto &image = mPyramid.get_level(level);
+    long cols = image.get_cols();
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, image.get_rows()),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t i = r.begin(); i < r.end(); i++)
+            {
+                const uint8_t *coarse = coarse_edges.row(i / 2);
+                uint8_t *edges_row = edges_out.row(i);
+                uint8_t *directions_row = direction_out.row(i);
+
+                for (long j = 0; j < cols; j++)
+                {
+                    edges_row[j] = NONE;
+
+                    // Only the 4 pixels under a coarse edge are candidates
+                    if (coarse[j / 2] == NONE)
+                        continue;
+
+                    float g_x = 0, g_y = 0;
+                    sobel_at(image, j, i, g_x, g_y);
+                    uint16_t value = to_gradient(std::abs(g_x) + std::abs(g_y));
+                    if (value < low_threshold)
+                        continue;
+
+                    // Non maximum suppression on this level, same neighbours
+                    // as non_maximum_suppression
+                    auto direction = quantize_direction(g_x, g_y);
+                    long dx = direction == DEG_90 ? 0 : 1;
+                    long dy = direction == DEG_0 ? 0 : 1;
+                    if (direction == DEG_135)
+                        dx = -1;
+
+                    if (value >= gradient_at(image, j - dx, i - dy)
+                        && value >= gradient_at(image, j + dx, i + dy))
+                    {
+                        edges_row[j] = STRONG;
+                        directions_row[j] = direction;
+                    }
+                }
+            }
+        });
+}
@@ -0,0 +1,429 @@
+#include "regression.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+#include "alloc_stats.hh"
+#include "frame_processor.hh"
+#include "frame_reader.hh"
+
+/*
+ * Differences a stage may introduce: channels off by up to `max_delta`, and
+ * up to `max_share` of the pixels off by more (edges moving when a gradient
+ * crosses a threshold, palette entries swapping)
+ */
+struct StageTolerance
+{
+    const char *stage;
+    int max_delta;
+    double max_share;
+};
+
+const StageTolerance STAGE_TOLERANCES[] = {
+    { "luma", 1, 0 },
+    { "canny", 0, 0.0005 },
+    { "thicken", 0, 0 },
+    { "colors", 2, 0.001 },
+    { "borders", 0, 0 },
+    { "pixelate", 1, 0 },
+};
+
+std::vector<RegressionCase> regression_cases()
+{
+    std::vector<RegressionCase> cases;
+    auto add = [&](const std::string &name,
+                   const std::function<void(FrameSettings &)> &change) {
+        RegressionCase test{ name, FrameSettings() };
+        change(test.settings);
+        cases.push_back(test);
+    };
+    auto edges = [](FrameSettings &settings) { settings.edges_only = true; };
+    auto colors = [](FrameSettings &settings) {
+        settings.color_quantization = true;
+    };
+
+    add("edges", edges);
+    add("edges_thin", [&](FrameSettings &settings) {
+        edges(settings);
+        settings.border_dilation = false;
+    });
+    add("edges_no_contrast", [&](FrameSettings &settings) {
+        edges(settings);
+        settings.edge_contrast_correction = false;
+    });
+    add("edges_adaptive", [&](FrameSettings &settings) {
+        edges(settings);
+        settings.adaptive_contrast = true;
+    });
+    for (Blur blur = Blur::NONE;;)
+    {
+        std::ostringstream name;
+        name << "edges_blur_" << blur;
+        add(name.str(), [&](FrameSettings &settings) {
+            edges(settings);
+            settings.blur = blur;
+        });
+        if (++blur == Blur::NONE)
+            break;
+    }
+    add("edges_integer", [&](FrameSettings &settings) {
+        edges(settings);
+        settings.integer_canny = true;
+    });
+    add("edges_level_1", [&](FrameSettings &settings) {
+        edges(settings);
+        settings.pyramid_level = 1;
+    });
+    add("edges_level_2_refined", [&](FrameSettings &settings) {
+        edges(settings);
+        settings.pyramid_level = 2;
+        settings.refine_edges = true;
+    });
+    add("dark_borders", [](FrameSettings &settings) {
+        settings.dark_borders = true;
+    });
+
+    add("colors", colors);
+    add("colors_plain", [&](FrameSettings &settings) {
+        colors(settings);
+        settings.saturation_boost = false;
+    });
+    add("colors_contrast", [&](FrameSettings &settings) {
+        colors(settings);
+        settings.color_contrast_correction = true;
+    });
+    add("colors_adaptive", [&](FrameSettings &settings) {
+        colors(settings);
+        settings.color_contrast_correction = true;
+        settings.adaptive_contrast = true;
+    });
+    add("colors_step_4", [&](FrameSettings &settings) {
+        colors(settings);
+        settings.palette_step = 4;
+    });
+
+    for (PixelShape shape = PixelShape::SQUARE;;)
+    {
+        std::ostringstream name;
+        name << "pixelate_" << shape;
+        add(name.str(), [&](FrameSettings &settings) {
+            settings.pixelate = true;
+            settings.pixel_shape = shape;
+        });
+        if (++shape == PixelShape::SQUARE)
+            break;
+    }
+
+    add("cartoon", [&](FrameSettings &settings) {
+        colors(settings);
+        settings.dark_borders = true;
+    });
+    add("cartoon_incremental", [&](FrameSettings &settings) {
+        colors(settings);
+        settings.dark_borders = true;
+        settings.incremental = true;
+    });
+    add("everything", [&](FrameSettings &settings) {
+        colors(settings);
+        settings.dark_borders = true;
+        settings.color_contrast_correction = true;
+        settings.pixelate = true;
+        settings.pixel_shape = PixelShape::HEX;
+    });
+
+    // Lower case file names
+    for (auto &test : cases)
+    {
+        std::transform(test.name.begin(), test.name.end(), test.name.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+    }
+    return cases;
+}
+
+static void write_ppm(const std::string &path, const unsigned char *rgba)
+{
+    std::ofstream file(path, std::ios::binary);
+    file << "P6\n" << screen_width << " " << screen_height << "\n255\n";
+    for (size_t i = 0; i < screen_width * screen_height; i++)
+        file.write(reinterpret_cast<const char *>(rgba + i * 4), 3);
+    if (!file)
+        throw std::runtime_error(path + ": cannot write the golden image");
+}
+
+// False when missing or not a screen sized image
+static bool read_ppm(const std::string &path, std::vector<unsigned char> &rgb)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    size_t width = 0, height = 0, max_value = 0;
+    if (!(file >> magic >> width >> height >> max_value) || magic != "P6"
+        || width != screen_width || height != screen_height
+        || max_value != 255)
+        return false;
+    file.get();
+
+    rgb.resize(width * height * 3);
+    return bool(file.read(reinterpret_cast<char *>(rgb.data()), rgb.size()));
+}
+
+/*
+ * Share of the pixels with a channel more than `max_delta` away from the
+ * golden image, and the largest difference
+ */
+static double compare(const unsigned char *rgba,
+                      const std::vector<unsigned char> &golden, int max_delta,
+                      int &largest_delta)
+{
+    size_t pixels = screen_width * screen_height;
+    size_t different = 0;
+    largest_delta = 0;
+    for (size_t i = 0; i < pixels; i++)
+    {
+        int delta = 0;
+        for (size_t c = 0; c < 3; c++)
+            delta = std::max(delta, std::abs(rgba[i * 4 + c]
+                                             - golden[i * 3 + c]));
+        different += delta > max_delta;
+        largest_delta = std::max(largest_delta, delta);
+    }
+    return double(different) / pixels;
+}
+
+// Frame `index` of the feed through `processor`, returns its output
+static unsigned char *process_frame(FrameProcessor &processor,
+                                    MappedReader &reader, size_t index,
+                                    std::vector<unsigned char> &rgba)
+{
+    const unsigned char *frame = reader.get_frame(index);
+    if (reader.get_format() != PixelFormat::RGBA)
+        return processor.process(rgba.data(), frame, reader.get_format());
+
+    std::memcpy(rgba.data(), frame, rgba.size());
+    return processor.process(rgba.data());
+}
+
+// Best time per frame of every stage over REGRESSION_RUNS runs
+static std::vector<double> time_stages(FrameProcessor &processor,
+                                       MappedReader &reader,
+                                       size_t frame_count,
+                                       std::vector<unsigned char> &rgba)
+{
+    std::vector<double> best_ms;
+    for (size_t run = 0; run < REGRESSION_RUNS; run++)
+    {
+        // Every run starts from a full frame, the palette is kept
+        processor.invalidate();
+        processor.take_stage_ms();
+        for (size_t i = 0; i < frame_count; i++)
+            process_frame(processor, reader, i, rgba);
+
+        auto stage_ms = processor.take_stage_ms();
+        for (auto &ms : stage_ms)
+            ms /= frame_count;
+        if (best_ms.empty())
+            best_ms = stage_ms;
+        for (size_t stage = 0; stage < best_ms.size(); stage++)
+            best_ms[stage] = std::min(best_ms[stage], stage_ms[stage]);
+    }
+    return best_ms;
+}
+
+size_t run_regression(const std::string &feed, const std::string &golden_dir,
+                      bool record)
+{
+    MappedReader reader(feed);
+    size_t frame_count =
+        std::min<size_t>(REGRESSION_FRAMES, reader.get_frame_count());
+    if (!frame_count)
+        throw std::runtime_error(feed + ": no frame");
+
+    // "<case> <stage>" to its time per frame
+    std::string timings_path = golden_dir + "/timings.txt";
+    std::map<std::string, double> timings;
+    if (record)
+    {
+        if (mkdir(golden_dir.c_str(), 0755) && errno != EEXIST)
+            throw std::runtime_error(golden_dir + ": " + strerror(errno));
+    }
+    else
+    {
+        std::ifstream file(timings_path);
+        if (!file)
+        {
+            throw std::runtime_error(timings_path
+                                     + ": cannot read the timings");
+        }
+        std::string test, stage;
+        double ms;
+        while (file >> test >> stage >> ms)
+            timings[test + " " + stage] = ms;
+    }
+    std::ofstream timings_out;
+    if (record)
+        timings_out.open(timings_path);
+
+    std::vector<unsigned char> rgba(get_frame_size(PixelFormat::RGBA));
+    std::vector<unsigned char> golden;
+    size_t failures = 0;
+
+    for (auto &test : regression_cases())
+    {
+        FrameProcessor processor;
+        processor.get_settings() = test.settings;
+        auto &chain = processor.get_chain();
+
+        // Tolerance of the stages that run
+        int max_delta = 0;
+        double max_share = 0;
+        for (auto &effect : chain)
+        {
+            if (!effect->is_enabled(test.settings))
+                continue;
+            for (auto &tolerance : STAGE_TOLERANCES)
+            {
+                if (effect->get_name() != std::string(tolerance.stage))
+                    continue;
+                max_delta = std::max(max_delta, tolerance.max_delta);
+                max_share = std::max(max_share, tolerance.max_share);
+            }
+        }
+
+        std::ostringstream report;
+        bool failed = false;
+        for (size_t i = 0; i < frame_count; i++)
+        {
+            unsigned char *output = process_frame(processor, reader, i, rgba);
+            std::string path =
+                golden_dir + "/" + test.name + "_" + std::to_string(i) + ".ppm";
+            if (record)
+            {
+                write_ppm(path, output);
+                continue;
+            }
+            if (!read_ppm(path, golden))
+            {
+                report << "\n  " << path << ": no golden image";
+                failed = true;
+                continue;
+            }
+
+            int largest_delta;
+            double share = compare(output, golden, max_delta, largest_delta);
+            if (share > max_share)
+            {
+                report << "\n  frame " << i << ": " << std::fixed
+                       << std::setprecision(3) << share * 100
+                       << "% of the pixels off by more than " << max_delta
+                       << " (up to " << largest_delta << ", tolerance "
+                       << max_share * 100 << "%)";
+                failed = true;
+            }
+        }
+
+        // Time expected from the recording for every stage, negative when
+        // unknown
+        std::vector<double> expected_ms(chain.size(), -1);
+        for (size_t stage = 0; stage < chain.size(); stage++)
+        {
+            auto recorded =
+                timings.find(test.name + " " + chain[stage]->get_name());
+            if (recorded != timings.end())
+                expected_ms[stage] = recorded->second;
+        }
+        auto too_slow = [&](size_t stage, double ms) {
+            return expected_ms[stage] >= 0
+                && ms > expected_ms[stage] * REGRESSION_MAX_SLOWDOWN
+                && ms - expected_ms[stage] > REGRESSION_MIN_SLOWDOWN_MS;
+        };
+
+        // A slow stage is timed again before it fails, other processes can
+        // slow a whole run down
+        auto stage_ms = time_stages(processor, reader, frame_count, rgba);
+        for (size_t retry = 0; retry < REGRESSION_RETRIES; retry++)
+        {
+            bool slow = false;
+            for (size_t stage = 0; stage < chain.size(); stage++)
+            {
+                slow = slow
+                    || (chain[stage]->is_enabled(test.settings)
+                        && too_slow(stage, stage_ms[stage]));
+            }
+            if (!slow)
+                break;
+
+            auto retry_ms = time_stages(processor, reader, frame_count, rgba);
+            for (size_t stage = 0; stage < chain.size(); stage++)
+                stage_ms[stage] = std::min(stage_ms[stage], retry_ms[stage]);
+        }
+
+        // Every buffer is warm after the timed runs, processing must not
+        // allocate anymore. Per-thread buffers are only created the first
+        // time a thread joins a loop, a pass that allocates is run again.
+        size_t allocations = 0;
+        for (size_t pass = 0; pass <= REGRESSION_RETRIES; pass++)
+        {
+            allocations = get_allocation_stats().count;
+            for (size_t i = 0; i < frame_count; i++)
+                process_frame(processor, reader, i, rgba);
+            allocations = get_allocation_stats().count - allocations;
+            if (!allocations)
+                break;
+        }
+        if (allocations && !record)
+        {
+            report << "\n  " << allocations << " heap allocations in "
+                   << frame_count << " frames, none expected";
+            failed = true;
+        }
+
+        std::ostringstream stage_times;
+        stage_times << std::fixed << std::setprecision(2);
+        for (size_t stage = 0; stage < chain.size(); stage++)
+        {
+            if (!chain[stage]->is_enabled(test.settings))
+                continue;
+            const char *name = chain[stage]->get_name();
+            stage_times << " " << name << " " << stage_ms[stage] << " ms";
+            if (record)
+            {
+                timings_out << test.name << " " << name << " "
+                            << stage_ms[stage] << "\n";
+                continue;
+            }
+            if (expected_ms[stage] < 0)
+            {
+                report << "\n  " << name << ": no recorded time";
+                failed = true;
+                continue;
+            }
+            stage_times << " (" << expected_ms[stage] << ")";
+            if (too_slow(stage, stage_ms[stage]))
+            {
+                report << "\n  " << name << ": " << std::fixed
+                       << std::setprecision(2) << stage_ms[stage]
+                       << " ms per frame, " << expected_ms[stage]
+                       << " ms expected from the recorded timings";
+                failed = true;
+            }
+        }
+
+        failures += failed;
+        std::cout << (record ? "recorded " : failed ? "FAILED " : "ok ")
+                  << test.name << ":" << stage_times.str() << report.str()
+                  << std::endl;
+    }
+
+    if (record && !timings_out)
+        throw std::runtime_error(timings_path + ": cannot write the timings");
+    return failures;
+}
@@ -0,0 +1,141 @@
+#include "stream_engine.hh"
+
+#include <sstream>
+#include <stdexcept>
+
+StreamEngine::StreamEngine(size_t max_streams, const ThreadSettings &threads,
+                           PaletteLibrary *palettes)
+    : mMaxStreams(std::max<size_t>(max_streams, 1))
+    // The pipeline threads keep their slot for as long as their pipeline runs
+    , mPool(threads, mMaxStreams)
+    , mPalettes(palettes)
+    , mFinishedStreams(0)
+{}
+
+StreamEngine::~StreamEngine()
+{
+    stop();
+}
+
+Stream &StreamEngine::add_stream(const std::string &feed, PixelFormat format,
+                                 size_t frames_in_flight, EffectChain chain,
+                                 const FrameSettings &settings,
+                                 const std::string &output)
+{
+    if (mStreams.size() == mMaxStreams)
+        throw std::runtime_error(feed + ": too many streams");
+
+    auto stream = std::make_unique<Stream>();
+    stream->feed = feed;
+    stream->settings = settings;
+
+    if (MappedReader::is_supported(feed))
+        stream->reader = std::make_unique<MappedReader>(feed);
+    else
+    {
+        std::ostringstream command;
+        command << "ffmpeg -loglevel error -stream_loop -1 -i " << feed
+                << " -f image2pipe "
+                   "-vcodec rawvideo "
+                   "-pix_fmt "
+                << format
+                << " -r 30 "
+                   "-s 1280x720 -";
+        stream->pipe = popen(command.str().c_str(), "r");
+        if (!stream->pipe)
+            throw std::runtime_error(feed + ": cannot start ffmpeg");
+        stream->reader = std::make_unique<PipeReader>(stream->pipe, format);
+    }
+
+    if (!output.empty())
+    {
+        stream->encoder = std::make_unique<EncoderSink>(output);
+        if (!stream->encoder->is_open())
+            throw std::runtime_error(output + ": cannot start the encoder");
+    }
+
+    // Built in the compute arena so its flow graph runs there too
+    size_t index = mStreams.size();
+    mPool.get_compute_arena().execute([&]() {
+        stream->pipeline = std::make_unique<FramePipeline>(
+            *stream->reader, frames_in_flight, std::move(chain), settings,
+            &mPool, [this, index]() { mReadyStreams.push(index); },
+            mPalettes);
+    });
+
+    mStreams.push_back(std::move(stream));
+    return *mStreams.back();
+}
+
+size_t StreamEngine::get_stream_count()
+{
+    return mStreams.size();
+}
+
+Stream &StreamEngine::get_stream(size_t index)
+{
+    return *mStreams[index];
+}
+
+ThreadPool &StreamEngine::get_thread_pool()
+{
+    return mPool;
+}
+
+Frame *StreamEngine::next_frame(size_t &stream)
+{
+    return pop_frame(stream, true);
+}
+
+Frame *StreamEngine::poll_frame(size_t &stream)
+{
+    return pop_frame(stream, false);
+}
+
+Frame *StreamEngine::pop_frame(size_t &stream, bool wait)
+{
+    while (mFinishedStreams < mStreams.size())
+    {
+        if (wait)
+            mReadyStreams.pop(stream);
+        else if (!mReadyStreams.try_pop(stream))
+            return nullptr;
+
+        // Never blocks, the index was pushed after the frame
+        if (Frame *frame = mStreams[stream]->pipeline->next_frame())
+            return frame;
+
+        mStreams[stream]->finished = true;
+        mFinishedStreams++;
+    }
+    return nullptr;
+}
+
+void StreamEngine::release(size_t stream, Frame *frame)
+{
+    mStreams[stream]->pipeline->release(frame);
+}
+
+void StreamEngine::stop()
+{
+    // The I/O workers are shared, one may be blocked in the reader of any
+    // stream: every stream is drained before any of them is joined
+    for (auto &stream : mStreams)
+        stream->pipeline->request_stop();
+    size_t index = 0;
+    while (Frame *frame = next_frame(index))
+        release(index, frame);
+
+    for (auto &stream : mStreams)
+    {
+        stream->pipeline->stop();
+        if (stream->encoder)
+            stream->encoder->close();
+        if (stream->pipe)
+        {
+            fflush(stream->pipe);
+            pclose(stream->pipe);
+            stream->pipe = nullptr;
+        }
+    }
+}
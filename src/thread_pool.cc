@@ -0,0 +1,175 @@
+#include "thread_pool.hh"
+
+#include <algorithm>
+#include <pthread.h>
+#include <sstream>
+#include <tbb/info.h>
+
+bool parse_cpu_list(const std::string &list, std::vector<int> &cpus)
+{
+    std::vector<int> parsed;
+    std::istringstream input(list);
+    std::string range;
+    while (std::getline(input, range, ','))
+    {
+        int first = 0, last = 0;
+        char dash = 0, extra = 0;
+        int fields = sscanf(range.c_str(), "%d%c%d%c", &first, &dash, &last,
+                            &extra);
+        if (fields == 1)
+            last = first;
+        else if (fields != 3 || dash != '-')
+            return false;
+
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+            return false;
+        for (int cpu = first; cpu <= last; cpu++)
+            parsed.push_back(cpu);
+    }
+    if (parsed.empty())
+        return false;
+
+    cpus = parsed;
+    return true;
+}
+
+ArenaObserver::ArenaObserver(tbb::task_arena &arena,
+                             const std::vector<int> &cpus, bool pin)
+    : tbb::task_scheduler_observer(arena)
+    , mCpus(cpus)
+    , mPin(pin)
+    , mNextCpu(0)
+    , mThreadCount(0)
+    , mLastAccount(std::chrono::steady_clock::now())
+    , mThreadMs(0)
+{
+    // Pinning without a list spreads the threads over every CPU
+    if (mPin && mCpus.empty())
+    {
+        for (int cpu = 0; cpu < tbb::info::default_concurrency(); cpu++)
+            mCpus.push_back(cpu);
+    }
+    observe(true);
+}
+
+ArenaObserver::~ArenaObserver()
+{
+    observe(false);
+}
+
+void ArenaObserver::account()
+{
+    auto now = std::chrono::steady_clock::now();
+    mThreadMs += mThreadCount
+        * std::chrono::duration<double, std::milli>(now - mLastAccount)
+              .count();
+    mLastAccount = now;
+}
+
+void ArenaObserver::on_scheduler_entry(bool)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        account();
+        mThreadCount++;
+    }
+
+    auto &thread = mThreads.local();
+    thread.restore = false;
+    if (mCpus.empty())
+        return;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (mPin)
+    {
+        if (thread.pinned < 0)
+            thread.pinned = mNextCpu++ % mCpus.size();
+        CPU_SET(mCpus[thread.pinned], &cpus);
+    }
+    else
+    {
+        for (int cpu : mCpus)
+            CPU_SET(cpu, &cpus);
+    }
+
+    pthread_t self = pthread_self();
+    thread.restore = pthread_getaffinity_np(self, sizeof(cpu_set_t),
+                                            &thread.saved_cpus)
+            == 0
+        && pthread_setaffinity_np(self, sizeof(cpu_set_t), &cpus) == 0;
+}
+
+void ArenaObserver::on_scheduler_exit(bool)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        account();
+        mThreadCount--;
+    }
+
+    auto &thread = mThreads.local();
+    if (thread.restore)
+    {
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                               &thread.saved_cpus);
+        thread.restore = false;
+    }
+}
+
+double ArenaObserver::take_thread_ms()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    account();
+    double thread_ms = mThreadMs;
+    mThreadMs = 0;
+    return thread_ms;
+}
+
+ThreadPool::ThreadPool(const ThreadSettings &settings, size_t masters)
+    // The masters count in the threads of the compute arena, at least their
+    // own slots
+    : mWorkers(std::max<size_t>(settings.workers
+                                    ? settings.workers
+                                    : tbb::info::default_concurrency(),
+                                masters))
+    , mIoWorkers(settings.io_workers ? settings.io_workers
+                                     : std::max<size_t>(masters, 1))
+    // Workers of both arenas, plus the main thread
+    , mControl(tbb::global_control::max_allowed_parallelism,
+               mWorkers - masters + mIoWorkers + 1)
+    , mComputeArena(mWorkers, masters)
+    , mIoArena(mIoWorkers + masters, masters)
+    , mComputeObserver(mComputeArena, settings.cpus, settings.pin)
+    , mIoObserver(mIoArena, settings.io_cpus, false)
+{}
+
+tbb::task_arena &ThreadPool::get_compute_arena()
+{
+    return mComputeArena;
+}
+
+tbb::task_arena &ThreadPool::get_io_arena()
+{
+    return mIoArena;
+}
+
+size_t ThreadPool::get_workers()
+{
+    return mWorkers;
+}
+
+size_t ThreadPool::get_io_workers()
+{
+    return mIoWorkers;
+}
+
+double ThreadPool::take_compute_threads(double elapsed_ms)
+{
+    return mComputeObserver.take_thread_ms() / elapsed_ms;
+}
+
+double ThreadPool::take_io_threads(double elapsed_ms)
+{
+    return mIoObserver.take_thread_ms() / elapsed_ms;
+}
@@ -0,0 +1,145 @@
+#include "tiles.hh"
+
+#include <cstdlib>
+#include <cstring>
+
+DirtyTiles::DirtyTiles(size_t width, size_t height, size_t tile_size,
+                       unsigned threshold)
+    : mWidth(width)
+    , mHeight(height)
+    , mTileSize(tile_size)
+    , mTilesX((width + tile_size - 1) / tile_size)
+    , mTilesY((height + tile_size - 1) / tile_size)
+    , mThreshold(threshold)
+    , mInvalid(true)
+    , mDirtyCount(0)
+    , mReference(width * height * 4)
+    , mDirty(mTilesX * mTilesY)
+{}
+
+size_t DirtyTiles::get_tile_count()
+{
+    return mTilesX * mTilesY;
+}
+
+size_t DirtyTiles::get_dirty_count()
+{
+    return mDirtyCount;
+}
+
+bool DirtyTiles::all_dirty()
+{
+    return mDirtyCount == get_tile_count();
+}
+
+void DirtyTiles::invalidate()
+{
+    mInvalid = true;
+}
+
+const std::vector<Tile> &DirtyTiles::get_update_region()
+{
+    return mUpdateRegion;
+}
+
+Tile DirtyTiles::get_tile(size_t tile_x, size_t tile_y, size_t tile_count)
+{
+    size_t x = tile_x * mTileSize;
+    size_t y = tile_y * mTileSize;
+    return Tile{ x, y, std::min(tile_count * mTileSize, mWidth - x),
+                 std::min(mTileSize, mHeight - y) };
+}
+
+bool DirtyTiles::is_tile_dirty(const unsigned char *raw_buffer, size_t tile_x,
+                               size_t tile_y)
+{
+    Tile tile = get_tile(tile_x, tile_y, 1);
+    size_t limit = (size_t)mThreshold * tile.width * tile.height * 3;
+    size_t sum = 0;
+
+    for (size_t y = tile.y; y < tile.y + tile.height; y++)
+    {
+        size_t offset = (y * mWidth + tile.x) * 4;
+        const unsigned char *current = raw_buffer + offset;
+        const unsigned char *reference = mReference.data() + offset;
+
+        // Alpha is compared too, it is constant in the input frames
+        unsigned row_sum = 0;
+        for (size_t i = 0; i < tile.width * 4; i++)
+            row_sum += std::abs(current[i] - reference[i]);
+
+        // Stop as soon as the tile is known to be dirty
+        sum += row_sum;
+        if (sum > limit)
+            return true;
+    }
+    return false;
+}
+
+void DirtyTiles::update(const unsigned char *raw_buffer)
+{
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, mTilesY),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t tile_y = r.begin(); tile_y < r.end(); tile_y++)
+            {
+                for (size_t tile_x = 0; tile_x < mTilesX; tile_x++)
+                {
+                    bool dirty =
+                        mInvalid || is_tile_dirty(raw_buffer, tile_x, tile_y);
+                    mDirty[tile_y * mTilesX + tile_x] = dirty;
+
+                    if (!dirty)
+                        continue;
+
+                    Tile tile = get_tile(tile_x, tile_y, 1);
+                    for (size_t y = tile.y; y < tile.y + tile.height; y++)
+                    {
+                        size_t offset = (y * mWidth + tile.x) * 4;
+                        std::memcpy(mReference.data() + offset,
+                                    raw_buffer + offset, tile.width * 4);
+                    }
+                }
+            }
+        });
+    mInvalid = false;
+
+    // Grow the dirty tiles by one tile and merge horizontal runs
+    mDirtyCount = 0;
+    mUpdateRegion.clear();
+    for (size_t tile_y = 0; tile_y < mTilesY; tile_y++)
+    {
+        size_t run_start = 0;
+        size_t run_length = 0;
+
+        for (size_t tile_x = 0; tile_x < mTilesX; tile_x++)
+        {
+            mDirtyCount += mDirty[tile_y * mTilesX + tile_x];
+
+            bool update = false;
+            for (size_t y = tile_y ? tile_y - 1 : 0;
+                 y <= std::min(tile_y + 1, mTilesY - 1) && !update; y++)
+            {
+                for (size_t x = tile_x ? tile_x - 1 : 0;
+                     x <= std::min(tile_x + 1, mTilesX - 1); x++)
+                    update = update || mDirty[y * mTilesX + x];
+            }
+
+            if (update)
+            {
+                if (run_length == 0)
+                    run_start = tile_x;
+                run_length++;
+            }
+            else if (run_length > 0)
+            {
+                mUpdateRegion.push_back(
+                    get_tile(run_start, tile_y, run_length));
+                run_length = 0;
+            }
+        }
+
+        if (run_length > 0)
+            mUpdateRegion.push_back(get_tile(run_start, tile_y, run_length));
+    }
+}
@@ -0,0 +1,276 @@
+#include "yuv.hh"
+
+#include <algorithm>
+#include <tbb/parallel_for.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "buffer_utils.hh"
+#include "histogram.hh"
+
+bool parse_pixel_format(const std::string &name, PixelFormat &format)
+{
+    PixelFormat candidate{};
+    do
+    {
+        std::ostringstream candidate_name;
+        candidate_name << candidate;
+        if (candidate_name.str() == name)
+        {
+            format = candidate;
+            return true;
+        }
+    } while (++candidate != PixelFormat{});
+    return false;
+}
+
+size_t get_frame_size(PixelFormat format)
+{
+    size_t pixels = screen_width * screen_height;
+    return format == PixelFormat::RGBA ? pixels * 4 : pixels * 3 / 2;
+}
+
+/*
+ * Fixed point BT.601, 8 fractional bits:
+ *   c = 298 (Y - 16), d = U - 128, e = V - 128
+ *   R = (c + 409 e + 128) >> 8
+ *   G = (c - 100 d - 208 e + 128) >> 8
+ *   B = (c + 516 d + 128) >> 8
+ */
+static void yuv_to_rgba_pixel(int y, int u, int v, unsigned char *out)
+{
+    int c = (y - 16) * 298;
+    int d = u - 128;
+    int e = v - 128;
+
+    out[0] = std::clamp((c + 409 * e + 128) >> 8, 0, 255);
+    out[1] = std::clamp((c - 100 * d - 208 * e + 128) >> 8, 0, 255);
+    out[2] = std::clamp((c + 516 * d + 128) >> 8, 0, 255);
+    out[3] = 255;
+}
+
+#ifdef __SSE2__
+/*
+ * 8 pixels, `uv` holds the (U - 128, V - 128) pairs of their 4 chroma
+ * samples as 16 bit values. Same results as yuv_to_rgba_pixel: every
+ * product and sum is a _mm_madd_epi16 on 32 bit lanes.
+ */
+static void yuv_to_rgba_8(const unsigned char *y_row, __m128i uv,
+                          unsigned char *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i y_coefs = _mm_setr_epi16(298, 128, 298, 128, 298, 128,
+                                           298, 128);
+    const __m128i r_coefs = _mm_setr_epi16(0, 409, 0, 409, 0, 409, 0, 409);
+    const __m128i g_coefs = _mm_setr_epi16(-100, -208, -100, -208, -100,
+                                           -208, -100, -208);
+    const __m128i b_coefs = _mm_setr_epi16(516, 0, 516, 0, 516, 0, 516, 0);
+
+    __m128i y = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)y_row),
+                                  zero);
+    y = _mm_sub_epi16(y, _mm_set1_epi16(16));
+    const __m128i ones = _mm_set1_epi16(1);
+
+    __m128i channels[3][2];
+    for (size_t half = 0; half < 2; half++)
+    {
+        // (Y - 16, 1) and (U, V) pairs of 4 pixels, chroma is shared by 2
+        __m128i y_pairs = half ? _mm_unpackhi_epi16(y, ones)
+                               : _mm_unpacklo_epi16(y, ones);
+        __m128i uv_pairs = half ? _mm_unpackhi_epi32(uv, uv)
+                                : _mm_unpacklo_epi32(uv, uv);
+
+        __m128i c = _mm_madd_epi16(y_pairs, y_coefs);
+        channels[0][half] = _mm_srai_epi32(
+            _mm_add_epi32(c, _mm_madd_epi16(uv_pairs, r_coefs)), 8);
+        channels[1][half] = _mm_srai_epi32(
+            _mm_add_epi32(c, _mm_madd_epi16(uv_pairs, g_coefs)), 8);
+        channels[2][half] = _mm_srai_epi32(
+            _mm_add_epi32(c, _mm_madd_epi16(uv_pairs, b_coefs)), 8);
+    }
+
+    __m128i r = _mm_packs_epi32(channels[0][0], channels[0][1]);
+    __m128i g = _mm_packs_epi32(channels[1][0], channels[1][1]);
+    __m128i b = _mm_packs_epi32(channels[2][0], channels[2][1]);
+
+    // Saturate to bytes and interleave: rg = r0 g0 r1 g1..., ba = b0 ff...
+    __m128i rg8 = _mm_packus_epi16(r, g);
+    __m128i ba8 = _mm_packus_epi16(b, _mm_set1_epi16(255));
+    __m128i rg = _mm_unpacklo_epi8(rg8, _mm_srli_si128(rg8, 8));
+    __m128i ba = _mm_unpacklo_epi8(ba8, _mm_srli_si128(ba8, 8));
+
+    _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi16(rg, ba));
+}
+#endif
+
+/*
+ * `count` pixels, `u_row` and `v_row` step by `chroma_step` bytes per chroma
+ * sample
+ */
+static void yuv_to_rgba_row(const unsigned char *y_row,
+                            const unsigned char *u_row,
+                            const unsigned char *v_row, size_t chroma_step,
+                            unsigned char *out, size_t count)
+{
+    size_t j = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    for (; j + 8 <= count; j += 8)
+    {
+        const unsigned char *u = u_row + j / 2 * chroma_step;
+        const unsigned char *v = v_row + j / 2 * chroma_step;
+
+        __m128i uv;
+        if (chroma_step == 2)
+        {
+            // NV12, already (U, V) pairs
+            uv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)u),
+                                   zero);
+        }
+        else
+        {
+            __m128i u16 = _mm_unpacklo_epi8(
+                _mm_cvtsi32_si128(*(const int32_t *)u), zero);
+            __m128i v16 = _mm_unpacklo_epi8(
+                _mm_cvtsi32_si128(*(const int32_t *)v), zero);
+            uv = _mm_unpacklo_epi16(u16, v16);
+        }
+
+        yuv_to_rgba_8(y_row + j, _mm_sub_epi16(uv, bias), out);
+        out += 32;
+    }
+#endif
+
+    for (; j < count; j++)
+    {
+        size_t chroma = j / 2 * chroma_step;
+        yuv_to_rgba_pixel(y_row[j], u_row[chroma], v_row[chroma], out);
+        out += 4;
+    }
+}
+
+void yuv_to_rgba(const unsigned char *yuv, PixelFormat format,
+                 unsigned char *raw_buffer)
+{
+    const size_t chroma_width = screen_width / 2;
+    const unsigned char *u_plane = yuv + screen_width * screen_height;
+    const unsigned char *v_plane = format == PixelFormat::NV12
+        ? u_plane + 1
+        : u_plane + chroma_width * (screen_height / 2);
+    // Bytes between two chroma rows and two chroma samples
+    size_t chroma_pitch =
+        format == PixelFormat::NV12 ? screen_width : chroma_width;
+    size_t chroma_step = format == PixelFormat::NV12 ? 2 : 1;
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, screen_height),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t i = r.begin(); i < r.end(); i++)
+            {
+                size_t chroma_row = (i / 2) * chroma_pitch;
+                yuv_to_rgba_row(yuv + i * screen_width, u_plane + chroma_row,
+                                v_plane + chroma_row, chroma_step,
+                                raw_buffer + i * screen_width * 4,
+                                screen_width);
+            }
+        });
+}
+
+template <typename T>
+static void y_to_luma_row(const unsigned char *y_row, const T *lut, T *output,
+                          size_t x_begin, size_t x_end)
+{
+    for (size_t x = x_begin; x < x_end; x++)
+        output[x] = lut[y_row[x]];
+}
+
+template <typename T>
+static void y_to_luma_frame(const unsigned char *y_plane, const T *lut,
+                            MatrixView<T> output)
+{
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, screen_height),
+                      [&](tbb::blocked_range<size_t> r) {
+                          for (size_t i = r.begin(); i < r.end(); i++)
+                              y_to_luma_row(y_plane + i * screen_width, lut,
+                                            output.row(i), 0, screen_width);
+                      });
+}
+
+template <typename T>
+static void y_to_luma_tiles(const unsigned char *y_plane, const T *lut,
+                            MatrixView<T> output,
+                            const std::vector<Tile> &tiles)
+{
+    for_each_tile_row(tiles, [&](size_t y, size_t x_begin, size_t x_end) {
+        y_to_luma_row(y_plane + y * screen_width, lut, output.row(y), x_begin,
+                      x_end);
+    });
+}
+
+void y_to_luma(const unsigned char *y_plane, const float *lut,
+               MatrixView<float> output)
+{
+    y_to_luma_frame(y_plane, lut, output);
+}
+
+void y_to_luma(const unsigned char *y_plane, const float *lut,
+               MatrixView<float> output, const std::vector<Tile> &tiles)
+{
+    y_to_luma_tiles(y_plane, lut, output, tiles);
+}
+
+void y_to_luma(const unsigned char *y_plane, const uint8_t *lut,
+               MatrixView<uint8_t> output)
+{
+    y_to_luma_frame(y_plane, lut, output);
+}
+
+void y_to_luma(const unsigned char *y_plane, const uint8_t *lut,
+               MatrixView<uint8_t> output, const std::vector<Tile> &tiles)
+{
+    y_to_luma_tiles(y_plane, lut, output, tiles);
+}
+
+void luma_lut(float *lut)
+{
+    for (size_t y = 0; y < 256; y++)
+        lut[y] = std::clamp((y - 16.f) * 255.f / 219.f, 0.f, 255.f);
+}
+
+void equalized_luma_lut(const unsigned char *y_plane, float *lut,
+                        Histogram &histogram)
+{
+    histogram.clear();
+    histogram.compute(screen_height, screen_width,
+                      [&](size_t y, uint8_t *values) {
+                          std::copy(y_plane + y * screen_width,
+                                    y_plane + (y + 1) * screen_width, values);
+                      });
+
+    // The cumulative histogram is summed on the fly
+    const auto &counts = histogram.get_counts();
+    size_t cdf_min = 0;
+    for (size_t count : counts)
+    {
+        if (count)
+        {
+            cdf_min = count;
+            break;
+        }
+    }
+
+    size_t pixels = screen_width * screen_height;
+    size_t cum = 0;
+    for (size_t y = 0; y < 256; y++)
+    {
+        cum += counts[y];
+        lut[y] = cum < cdf_min || pixels == cdf_min
+            ? 0.f
+            : 255.f * (cum - cdf_min) / (pixels - cdf_min);
+    }
+}